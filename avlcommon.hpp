@@ -0,0 +1,570 @@
+#ifndef AVL_COMMON_HEADER_HPP
+#define AVL_COMMON_HEADER_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <ios>
+#include <locale>
+#include <ostream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+namespace Homebrew {
+
+/**
+ * Tag for the bulk-load constructors: the input range is already sorted
+ * in ascending order and holds no duplicates, so the tree can be built
+ * directly in O(n) instead of inserting element by element.
+ */
+struct sorted_unique_t {
+    explicit sorted_unique_t() = default;
+};
+
+constexpr sorted_unique_t sorted_unique {};
+
+/**
+ * Hot path counters of a tree or map built with Stats = true, returned by
+ * stats(). Rotations are named after the member doing them and counted
+ * where balance() picks them.
+ */
+struct AvlStats {
+    std::uint64_t searches = 0;                // exact key lookups: search, find, at...
+    std::uint64_t search_comparisons = 0;      // key comparisons made by them
+    std::uint64_t max_search_comparisons = 0;  // most taken by a single lookup
+    std::uint64_t rotate_with_left_child = 0;
+    std::uint64_t rotate_with_right_child = 0;
+    std::uint64_t double_with_left_child = 0;
+    std::uint64_t double_with_right_child = 0;
+    std::uint64_t retraces = 0;                // bottom up walks after an insert or erase
+    std::uint64_t retrace_steps = 0;           // nodes rebalanced by them
+    std::uint64_t allocations = 0;             // nodes created
+};
+
+/**
+ * Memory held by a tree or map, returned by memory_usage(). With a
+ * NodePool allocated_bytes is every slab of its arena; with any other
+ * allocator it is an estimate of what a general purpose heap takes for
+ * one block per node.
+ */
+struct AvlMemoryUsage {
+    std::size_t nodes = 0;            // live nodes, size() of the container
+    std::size_t node_size = 0;        // bytes of a single node
+    std::size_t node_bytes = 0;       // nodes * node_size
+    std::size_t allocated_bytes = 0;  // taken from the system for them
+
+    // Headers, padding, free slots and unused slab space
+    std::size_t overhead() const noexcept
+    {
+        return allocated_bytes > node_bytes ? allocated_bytes - node_bytes : 0;
+    }
+};
+
+/**
+ * Order in which compact() lays the nodes out in memory. in_order puts
+ * neighbouring keys next to each other, for iteration and range walks;
+ * van_emde_boas stores the top half of the levels first, then each subtree
+ * hanging below them the same way, so a lookup touches few cache lines
+ * whatever their size.
+ */
+enum class NodeLayout {
+    in_order,
+    van_emde_boas
+};
+
+/**
+ * Buffered text sink for write_to(): what is written collects in a fixed
+ * buffer and goes to the stream in large blocks. Integers, characters and
+ * strings are formatted in place, floating point with snprintf at the
+ * precision of the stream, as long as the stream is in its default state
+ * for them. Any flag that changes their text (hex, fixed, boolalpha,
+ * showpos, a width, a locale other than "C", ...) sends them through the
+ * stream's operator<< instead, like types with no overload here: the
+ * output is always what the stream would print, only slower.
+ * flush() before the buffer goes out of scope, nothing is lost otherwise
+ * but the destructor doesn't write.
+ */
+class OutputBuffer {
+public:
+    static constexpr std::size_t CAPACITY = 1 << 14;
+
+private:
+    std::ostream& os;
+    std::size_t len = 0;
+    bool classic; // numbers need no grouping or other decimal point
+    char buf[CAPACITY];
+
+public:
+    explicit OutputBuffer(std::ostream& o)
+        : os{o}, classic{o.getloc() == std::locale::classic()} {}
+
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    void flush()
+    {
+        if (len != 0) os.write(buf, static_cast<std::streamsize>(len));
+        len = 0;
+    }
+
+    // The stream itself, up to date with what was written so far
+    std::ostream& stream()
+    {
+        flush();
+        return os;
+    }
+
+    void put(char c)
+    {
+        if (len == CAPACITY) flush();
+        buf[len++] = c;
+    }
+
+    void write(const char* s, std::size_t n)
+    {
+        if (n > CAPACITY - len) {
+            flush();
+            if (n >= CAPACITY) { // too big to be worth a copy
+                os.write(s, static_cast<std::streamsize>(n));
+                return;
+            }
+        }
+        std::memcpy(buf + len, s, n);
+        len += n;
+    }
+
+    OutputBuffer& operator<<(char c)          { return character(c); }
+    OutputBuffer& operator<<(signed char c)   { return character(c); }
+    OutputBuffer& operator<<(unsigned char c) { return character(c); }
+
+    OutputBuffer& operator<<(bool b)
+    {
+        if (!plain(std::ios_base::boolalpha)) return slow(b);
+        put(b ? '1' : '0');
+        return *this;
+    }
+
+    OutputBuffer& operator<<(const char* s)
+    {
+        if (os.width() != 0) return slow(s);
+        write(s, std::strlen(s));
+        return *this;
+    }
+
+    template<typename Traits, typename A>
+    OutputBuffer& operator<<(const std::basic_string<char, Traits, A>& s)
+    {
+        if (os.width() != 0) return slow(s);
+        write(s.data(), s.size());
+        return *this;
+    }
+
+    // Digits written backwards into a small scratch array
+    template<typename T>
+    std::enable_if_t<std::is_integral<T>::value, OutputBuffer&> operator<<(T v)
+    {
+        if (!classic || !plain(std::ios_base::showpos) || !decimal()) return slow(v);
+
+        using U = std::make_unsigned_t<T>;
+
+        char tmp[24];
+        char* end = tmp + sizeof tmp;
+        char* p = end;
+
+        bool negative = std::is_signed<T>::value && v < T(0);
+        U u = negative ? U(U(0) - static_cast<U>(v)) : static_cast<U>(v);
+
+        do {
+            *--p = static_cast<char>('0' + u % 10);
+            u /= 10;
+        } while (u != 0);
+        if (negative) *--p = '-';
+
+        write(p, static_cast<std::size_t>(end - p));
+        return *this;
+    }
+
+    OutputBuffer& operator<<(double v)
+    {
+        return format("%.*g", v);
+    }
+
+    OutputBuffer& operator<<(float v)
+    {
+        return format("%.*g", static_cast<double>(v));
+    }
+
+    OutputBuffer& operator<<(long double v)
+    {
+        return format("%.*Lg", v);
+    }
+
+    template<typename T>
+    std::enable_if_t<!std::is_arithmetic<T>::value, OutputBuffer&> operator<<(const T& v)
+    {
+        return slow(v);
+    }
+
+private:
+    // No width pending and none of the given flags set
+    bool plain(std::ios_base::fmtflags special) const
+    {
+        return os.width() == 0 && (os.flags() & special) == 0;
+    }
+
+    // Integers are decimal when no base is chosen too
+    bool decimal() const
+    {
+        auto base = os.flags() & std::ios_base::basefield;
+        return base == std::ios_base::dec || base == 0;
+    }
+
+    template<typename T>
+    OutputBuffer& slow(const T& v)
+    {
+        stream() << v;
+        return *this;
+    }
+
+    template<typename C>
+    OutputBuffer& character(C c)
+    {
+        if (os.width() != 0) return slow(c);
+        put(static_cast<char>(c));
+        return *this;
+    }
+
+    // %g is the stream's default notation, anything else goes through it
+    template<typename T>
+    OutputBuffer& format(const char* spec, T v)
+    {
+        const auto special = std::ios_base::floatfield | std::ios_base::showpoint |
+                             std::ios_base::showpos | std::ios_base::uppercase;
+        if (!classic || !plain(special)) return slow(v);
+
+        char tmp[64];
+        int n = std::snprintf(tmp, sizeof tmp, spec, static_cast<int>(os.precision()), v);
+        if (n > 0) write(tmp, std::min(static_cast<std::size_t>(n), sizeof tmp - 1));
+        return *this;
+    }
+};
+
+/**
+ * Default formatter of write_to(): elements as print() shows them,
+ * map entries as "(key, value)".
+ */
+struct TextFormat {
+    template<typename T>
+    void operator()(OutputBuffer& out, const T& v) const
+    {
+        out << v;
+    }
+
+    template<typename K, typename V>
+    void operator()(OutputBuffer& out, const std::pair<K, V>& kv) const
+    {
+        out << '(' << kv.first << ", " << kv.second << ')';
+    }
+};
+
+namespace detail {
+
+template<typename...>
+struct make_void {
+    using type = void;
+};
+
+// Comparators tagged with is_transparent accept any comparable type
+template<typename C, typename = void>
+struct is_transparent : std::false_type {};
+
+template<typename C>
+struct is_transparent<C, typename make_void<typename C::is_transparent>::type>
+    : std::true_type {};
+
+/**
+ * Element count of the subtree rooted at a node, kept only when the
+ * OrderStats parameter of a container is on. The disabled version is
+ * empty, so plain nodes don't grow.
+ */
+template<bool Enabled>
+struct SubtreeSize {
+    std::size_t subtree_size() const noexcept { return 0; }
+    void set_subtree_size(std::size_t) noexcept {}
+};
+
+template<>
+struct SubtreeSize<true> {
+    std::size_t count = 1;
+
+    std::size_t subtree_size() const noexcept { return count; }
+    void set_subtree_size(std::size_t n) noexcept { count = n; }
+};
+
+// Start pulling the cache line at p, a no-op where unsupported
+inline void prefetch(const void* p) noexcept
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(p);
+#else
+    (void)p;
+#endif
+}
+
+/**
+ * Storage for AvlStats, an empty base of the containers unless their
+ * Stats parameter is on: every hook below is then an empty inline call.
+ * Counters are mutable since lookups are const, and plain integers, so
+ * like the containers themselves they are not meant for concurrent use.
+ */
+template<bool Enabled>
+struct StatsCounters {
+    const AvlStats& counters() const noexcept
+    {
+        static const AvlStats none {};
+        return none;
+    }
+
+    void reset_counters() const noexcept {}
+    void count_search(std::uint64_t) const noexcept {}
+    void count_rotation(std::uint64_t AvlStats::*) const noexcept {}
+    void count_retrace(std::uint64_t) const noexcept {}
+    void count_allocation() const noexcept {}
+};
+
+template<>
+struct StatsCounters<true> {
+    mutable AvlStats stats_data;
+
+    const AvlStats& counters() const noexcept { return stats_data; }
+    void reset_counters() const noexcept { stats_data = AvlStats{}; }
+
+    void count_search(std::uint64_t comparisons) const noexcept
+    {
+        ++stats_data.searches;
+        stats_data.search_comparisons += comparisons;
+        if (comparisons > stats_data.max_search_comparisons)
+            stats_data.max_search_comparisons = comparisons;
+    }
+
+    void count_rotation(std::uint64_t AvlStats::* kind) const noexcept
+    {
+        ++(stats_data.*kind);
+    }
+
+    void count_retrace(std::uint64_t steps) const noexcept
+    {
+        ++stats_data.retraces;
+        stats_data.retrace_steps += steps;
+    }
+
+    void count_allocation() const noexcept { ++stats_data.allocations; }
+};
+
+/**
+ * Binary map files: a fixed header, then count records laid out in level
+ * order as an implicit complete tree (children of i at 2i + 1, 2i + 2).
+ * Native byte order, the header tells if the writer's was different.
+ */
+struct MapFileHeader {
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint32_t key_size;
+    std::uint32_t value_size;
+    std::uint32_t record_size;
+    std::uint64_t count;
+};
+
+constexpr std::uint32_t MAP_FILE_VERSION = 1;
+constexpr std::uint32_t MAP_FILE_BYTE_ORDER = 0x01020304;
+
+template<typename Key, typename Value>
+struct MapRecord {
+    Key key;
+    Value value;
+};
+
+template<typename Key, typename Value>
+inline MapFileHeader make_map_header(std::uint64_t count) noexcept
+{
+    MapFileHeader h;
+    std::memcpy(h.magic, "AVLM", 4);
+    h.version = MAP_FILE_VERSION;
+    h.byte_order = MAP_FILE_BYTE_ORDER;
+    h.key_size = sizeof(Key);
+    h.value_size = sizeof(Value);
+    h.record_size = sizeof(MapRecord<Key, Value>);
+    h.count = count;
+    return h;
+}
+
+template<typename Key, typename Value>
+inline bool valid_map_header(const MapFileHeader& h) noexcept
+{
+    return std::memcmp(h.magic, "AVLM", 4) == 0 &&
+           h.version == MAP_FILE_VERSION &&
+           h.byte_order == MAP_FILE_BYTE_ORDER &&
+           h.key_size == sizeof(Key) &&
+           h.value_size == sizeof(Value) &&
+           h.record_size == sizeof(MapRecord<Key, Value>);
+}
+
+// Number of consecutive 1 bits at the bottom of x, x must not be all ones
+inline unsigned trailing_ones(std::size_t x) noexcept
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_ctzll(~static_cast<unsigned long long>(x)));
+#else
+    unsigned n = 0;
+    for (; x & 1; x >>= 1) ++n;
+    return n;
+#endif
+}
+
+// Call fn on the level order positions of an n-node implicit tree, in order
+template<typename F>
+void level_order_inorder(std::size_t i, std::size_t n, F& fn)
+{
+    if (i >= n) return;
+
+    level_order_inorder(2 * i + 1, n, fn);
+    fn(i);
+    level_order_inorder(2 * i + 2, n, fn);
+}
+
+// Raw pointer to a child, whichever way the nodes own them
+template<typename N>
+N* child(N* p) noexcept
+{
+    return p;
+}
+
+template<typename P>
+auto child(const P& p) noexcept -> decltype(p.get())
+{
+    return p.get();
+}
+
+/**
+ * Call fn on the data of every node under t in order, without recursion:
+ * the pending ancestors sit on a fixed stack of Depth slots, more than
+ * the height of any AVL tree that fits in memory.
+ */
+template<std::size_t Depth, typename N, typename F>
+void inorder(N* t, F& fn)
+{
+    N* stack[Depth];
+    std::size_t top = 0;
+
+    for (;;) {
+        for (; t != nullptr; t = child(t->left)) stack[top++] = t;
+        if (top == 0) return;
+
+        t = stack[--top];
+        fn(t->data);
+        t = child(t->right);
+    }
+}
+
+// "{a, b, c}\n" out of what walk(one) passes to one, each element written by fmt
+template<typename W, typename F>
+void write_list(std::ostream& os, W&& walk, F& fmt)
+{
+    OutputBuffer out (os);
+    bool first = true;
+
+    auto one = [&](const auto& v) {
+        if (!first) out.write(", ", 2);
+        first = false;
+        fmt(out, v);
+    };
+
+    out.put('{');
+    walk(one);
+    out.write("}\n", 2);
+    out.flush();
+}
+
+// write_list() of the tree under root, in order
+template<std::size_t Depth, typename N, typename F>
+void write_tree(std::ostream& os, N* root, F& fmt)
+{
+    write_list(os, [root](auto& one) { inorder<Depth>(root, one); }, fmt);
+}
+
+// Fork-join block, shared by the parallel algorithms of the trees
+
+// Levels of a divide and conquer that may fork, a bit of oversubscription
+// evens out uneven splits. threads = 0 stands for every core
+inline int fork_depth(unsigned threads = 0) noexcept
+{
+    unsigned n = (threads != 0) ? threads : std::thread::hardware_concurrency();
+    int d = 0;
+    while ((1u << d) < n) ++d;
+    
+    return d + 1;
+}
+
+/**
+ * Run a and b, a on a new thread if it is worth it (and one can be had).
+ * Both always finish, on one thread or two; an exception thrown by
+ * either is passed on afterwards, b's first.
+ */
+template<typename A, typename B>
+void fork2(bool parallel, A& a, B& b)
+{
+    std::exception_ptr ea;
+    auto run_a = [&] {
+        try { a(); }
+        catch (...) { ea = std::current_exception(); }
+    };
+    std::thread th;
+    
+    if (parallel) {
+        try { th = std::thread(run_a); }
+        catch (const std::system_error&) { parallel = false; }
+    }
+    if (!parallel) run_a();
+    
+    try { b(); }
+    catch (...) {
+        if (th.joinable()) th.join();
+        throw;
+    }
+    
+    if (th.joinable()) th.join();
+    if (ea) std::rethrow_exception(ea);
+}
+
+// std::stable_sort with the halves sorted on two threads, budget levels deep
+template<typename Iter, typename Less>
+void parallel_stable_sort(Iter first, Iter last, Less& less, int budget)
+{
+    auto n = last - first;
+    
+    if (budget <= 0 || n < 4096) {
+        std::stable_sort(first, last, less);
+        return;
+    }
+    
+    Iter mid = first + n / 2;
+    auto left = [&] { parallel_stable_sort(first, mid, less, budget - 1); };
+    auto right = [&] { parallel_stable_sort(mid, last, less, budget - 1); };
+    fork2(true, left, right);
+    
+    std::inplace_merge(first, mid, last, less);
+}
+
+} // end of namespace detail
+
+} // end of namespace Homebrew
+
+#endif // AVL_COMMON_HEADER_HPP
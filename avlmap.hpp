@@ -3,84 +3,304 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <functional>
+#include <cstdint>
+#include <exception>
 #include <initializer_list>
 #include <iostream>
 #include <iterator>
 #include <memory>
+#include <new>
 #include <stdexcept>
+#include <tuple>
 #include <type_traits>
 #include <utility>
+#include <vector>
+
+#include "avlcommon.hpp"
+#include "avlmap_frozen.hpp"
+#include "avlnodepool.hpp"
 
 namespace Homebrew {  
     
-template<typename Key, typename Value>
-class AvlMap {
+/**
+ * OrderStats keeps the size of every subtree in its root node, which
+ * enables nth(), rank() and count_range() in O(log n).
+ * Stats counts lookup comparisons, rotations, retraces and allocations,
+ * see stats(). Off, it adds neither space nor work.
+ */
+template<typename Key, 
+         typename Value,
+         typename Compare = std::less<Key>,
+         typename Alloc = std::allocator<std::pair<const Key, Value>>,
+         bool OrderStats = false,
+         bool Stats = false>
+class AvlMap : private detail::StatsCounters<Stats> {
+    struct Node;
+    
+    // nodes are obtained through the (rebound) allocator
+    using NodeAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<Node>;
+    using NodeTraits = std::allocator_traits<NodeAlloc>;
+    using node_ptr = std::unique_ptr<Node, detail::NodeDeleter<NodeAlloc>>;
     
     // Node of the tree and proxy class for return values
-    struct Node {
-        std::unique_ptr<Node> left;
-        std::unique_ptr<Node> right;
-        Key key;
-        Value value;
+    struct Node : detail::SubtreeSize<OrderStats> {
+        node_ptr left;
+        node_ptr right;
+        Node* parent; // non owning, used by the iterators
+        std::pair<const Key, Value> data;
         std::int32_t height;
         
         template<typename K = Key,
                  typename V = Value>
         Node(K&& k, 
              V&& v,
-             std::unique_ptr<Node>&& lt,
-             std::unique_ptr<Node>&& rt,
+             node_ptr&& lt,
+             node_ptr&& rt,
              std::int32_t h = 0)
                 : left{std::move(lt)},
                   right{std::move(rt)},
-                  key{std::forward<K>(k)},
-                  value{std::forward<V>(v)},
-                  height{h} {}
+                  parent{nullptr},
+                  data{std::forward<K>(k), std::forward<V>(v)},
+                  height{h}
+        {
+            if (left != nullptr) left->parent = this;
+            if (right != nullptr) right->parent = this;
+            update_size(*this);
+        }
+        
+        // leaf whose pair is built straight from args
+        template<typename... Args>
+        Node(std::piecewise_construct_t, Args&&... args)
+                : left{nullptr},
+                  right{nullptr},
+                  parent{nullptr},
+                  data(std::forward<Args>(args)...),
+                  height{0} {}
                   
-        operator Value& () {return value;}
-        operator const Value& () const {return value;}
+        const Key& key() const {return data.first;}
+                  
+        operator Value& () {return data.second;}
+        operator const Value& () const {return data.second;}
         //Value& operator*() {return value;}
         //const Value& operator*() const {return value;}
     };
     
     // root of the tree
-    std::unique_ptr<Node> root;
+    node_ptr root;
+    
+    // Largest node, nullptr when empty: end() hints and --end() start here
+    Node* rightmost;
     
     // Number of elements
     std::size_t sz;
     
+    // Longest possible search path, AVL height is below 1.44 * log2(n + 2)
+    static constexpr std::size_t MAX_DEPTH = 96;
+    
+    // Subtrees below this height are not worth a thread
+    static constexpr std::int32_t FORK_HEIGHT = 10;
+    
+    // Source of the nodes
+    NodeAlloc alloc;
+    
+    // Ordering of the keys
+    Compare comp;
+    
+    // Lookups with other types than Key need a transparent comparator
+    template<typename K>
+    using enable_transparent = std::enable_if_t<detail::is_transparent<Compare>::value, K>;
+    
 public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using value_type = std::pair<const Key, Value>;
+    using key_compare = Compare;
+    using allocator_type = Alloc;
+    
+    /**
+     * Bidirectional iterator, walks the tree in order through the parent
+     * links: no allocation, amortized O(1) increment.
+     */
+    template<bool Const>
+    class Iterator {
+        friend class AvlMap;
+        template<bool> friend class Iterator;
+        
+        using node_type = std::conditional_t<Const, const Node, Node>;
+        
+        node_type* node;
+        const AvlMap* tree; // needed to step back from end()
+        
+        Iterator(node_type* n, const AvlMap* t) noexcept
+            : node{n}, tree{t} {}
+        
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = std::pair<const Key, Value>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<Const, const value_type*, value_type*>;
+        using reference = std::conditional_t<Const, const value_type&, value_type&>;
+        
+        Iterator() noexcept : node{nullptr}, tree{nullptr} {}
+        
+        // iterator -> const_iterator
+        template<bool C, typename = std::enable_if_t<Const && !C>>
+        Iterator(const Iterator<C>& other) noexcept
+            : node{other.node}, tree{other.tree} {}
+        
+        reference operator*() const noexcept { return node->data; }
+        pointer operator->() const noexcept { return &node->data; }
+        
+        Iterator& operator++() noexcept
+        {
+            node = next(node);
+            return *this;
+        }
+        
+        Iterator operator++(int) noexcept
+        {
+            auto tmp = *this;
+            ++*this;
+            return tmp;
+        }
+        
+        Iterator& operator--() noexcept
+        {
+            node = (node == nullptr) ? tree->rightmost : prev(node);
+            return *this;
+        }
+        
+        Iterator operator--(int) noexcept
+        {
+            auto tmp = *this;
+            --*this;
+            return tmp;
+        }
+        
+        template<bool C>
+        bool operator==(const Iterator<C>& other) const noexcept
+        {
+            return node == other.node;
+        }
+        
+        template<bool C>
+        bool operator!=(const Iterator<C>& other) const noexcept
+        {
+            return node != other.node;
+        }
+    };
+    
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+    
+    /**
+     * Owner of an element taken out with extract(), as in C++17.
+     * insert() links the node itself into a map of the same type, nothing
+     * is allocated, copied or moved; the key can be changed in between.
+     */
+    class node_type {
+        friend class AvlMap;
+        
+        node_ptr node;
+        NodeAlloc alloc; // the one the node came from
+        
+        node_type(node_ptr n, const NodeAlloc& a) noexcept
+            : node{std::move(n)}, alloc{a} {}
+        
+    public:
+        using key_type = Key;
+        using mapped_type = Value;
+        using allocator_type = Alloc;
+        
+        node_type() noexcept : node{nullptr}, alloc{} {}
+        
+        node_type(node_type&&) noexcept = default;
+        node_type& operator=(node_type&&) noexcept = default;
+        
+        bool empty() const noexcept { return node == nullptr; }
+        explicit operator bool() const noexcept { return node != nullptr; }
+        
+        // the key is only const while linked, same as std::map::node_type
+        Key& key() const noexcept { return const_cast<Key&>(node->data.first); }
+        Value& mapped() const noexcept { return node->data.second; }
+        
+        allocator_type get_allocator() const { return allocator_type(alloc); }
+        
+        friend void swap(node_type& a, node_type& b) noexcept
+        {
+            using std::swap;
+            swap(a.node, b.node);
+            swap(a.alloc, b.alloc);
+        }
+    };
+    
+    // Result of insert(node_type&&), node is given back if the key was there
+    struct insert_return_type {
+        iterator position;
+        bool inserted;
+        node_type node;
+    };
+    
     // constructors block
-    AvlMap() : root{nullptr}, sz{0} {}
+    AvlMap() : root{nullptr}, rightmost{nullptr}, sz{0}, alloc{}, comp{} {}
+    
+    explicit AvlMap(const Compare& c, const Alloc& a = Alloc()) 
+        : root{nullptr}, rightmost{nullptr}, sz{0}, alloc{a}, comp{c} {}
+    
+    explicit AvlMap(const Alloc& a) : root{nullptr}, rightmost{nullptr}, sz{0}, alloc{a}, comp{} {}
     
     AvlMap(const AvlMap& other)
-        : root{clone(other.root)}, sz{other.sz} {}
+        : root{nullptr}, 
+          rightmost{nullptr},
+          sz{other.sz},
+          alloc{NodeTraits::select_on_container_copy_construction(other.alloc)},
+          comp{other.comp}
+    {
+        root = clone(other.root);
+        rightmost = findMax(root);
+    }
         
     AvlMap& operator=(const AvlMap& other) 
     {
         // copy and swap idiom
         AvlMap tmp (other);
         std::swap(root, tmp.root);
+        std::swap(rightmost, tmp.rightmost);
         std::swap(sz, tmp.sz);
+        std::swap(alloc, tmp.alloc);
+        std::swap(comp, tmp.comp);
 
         return *this;
     }
     
     AvlMap(AvlMap&& other) noexcept
-        : AvlMap()
+        : root{std::move(other.root)}, 
+          rightmost{other.rightmost},
+          sz{other.sz}, 
+          alloc{std::move(other.alloc)},
+          comp{other.comp}
     {
-        std::swap(root, other.root);
-        std::swap(sz, other.sz);
+        other.rightmost = nullptr;
+        other.sz = 0;
     }
     
     AvlMap& operator=(AvlMap&& other) noexcept
     {
         std::swap(root, other.root);
+        std::swap(rightmost, other.rightmost);
         std::swap(sz, other.sz);
+        std::swap(alloc, other.alloc);
+        std::swap(comp, other.comp);
         return *this;
     }
     
-    ~AvlMap() = default;
+    ~AvlMap() noexcept
+    {
+        destroy(std::move(root));
+    }
     
     template<typename Iter>
     AvlMap(Iter first, Iter last)
@@ -97,6 +317,64 @@ public:
         }
     }
     
+    // O(n) bulk load, keys in [first, last) must be sorted and unique
+    template<typename Iter>
+    AvlMap(sorted_unique_t, Iter first, Iter last)
+        : AvlMap()
+    {
+        // Check std::pair type
+        using k_tp = typename std::iterator_traits<Iter>::value_type::first_type;
+        static_assert(std::is_constructible<Key, k_tp>::value, "Type mismatch");
+        using v_tp = typename std::iterator_traits<Iter>::value_type::second_type;
+        static_assert(std::is_constructible<Value, v_tp>::value, "Type mismatch");
+        
+        auto n = static_cast<std::size_t>(std::distance(first, last));
+        root = build_sorted(first, n);
+        rightmost = findMax(root);
+        sz = n;
+    }
+    
+    template<typename Iter>
+    static AvlMap from_sorted(Iter first, Iter last)
+    {
+        return AvlMap(sorted_unique, first, last);
+    }
+    
+    /**
+     * Build from an unsorted range on several threads. The pairs are
+     * copied out (moved with move_iterators), merge sorted with the halves
+     * on separate threads, then the balanced tree is built with its two
+     * subtrees on separate threads near the top. The first value of a
+     * duplicate key is kept, as with the range constructor. threads = 0
+     * uses every core; with a NodePool or Stats only the sort does, the
+     * nodes are made on one thread. The map gets
+     * the comparator c and nodes from the allocator a, as a constructor
+     * would. The comparator and the moves of keys and values must not throw.
+     */
+    template<typename Iter>
+    static AvlMap build_parallel(Iter first, Iter last, unsigned threads = 0,
+                                 const Compare& c = Compare(), const Alloc& a = Alloc())
+    {
+        std::vector<std::pair<Key, Value>> items (first, last);
+        
+        AvlMap m (c, a);
+        
+        auto less = [&m](const std::pair<Key, Value>& x, const std::pair<Key, Value>& y) {
+            return m.comp(x.first, y.first);
+        };
+        auto same = [&m](const std::pair<Key, Value>& x, const std::pair<Key, Value>& y) {
+            return !m.comp(x.first, y.first);
+        };
+        // the sort touches neither the nodes nor the counters
+        detail::parallel_stable_sort(items.begin(), items.end(), less, detail::fork_depth(threads));
+        items.erase(std::unique(items.begin(), items.end(), same), items.end());
+        
+        m.root = m.build_parallel_util(items.data(), items.size(), fork_budget(threads));
+        m.rightmost = m.findMax(m.root);
+        m.sz = items.size();
+        return m;
+    }
+    
     AvlMap(const std::initializer_list<std::pair<const Key, Value>>& lst)
         : AvlMap(std::begin(lst), std::end(lst)) {}
 
@@ -106,7 +384,10 @@ public:
         // copy and swap idiom
         AvlMap tmp (lst);
         std::swap(root, tmp.root);
+        std::swap(rightmost, tmp.rightmost);
         std::swap(sz, tmp.sz);
+        std::swap(alloc, tmp.alloc);
+        std::swap(comp, tmp.comp);
 
         return *this;
     }
@@ -114,7 +395,9 @@ public:
     // Member functions block
     void clear() noexcept
     {
-        root.reset(nullptr);
+        destroy(std::move(root));
+        rightmost = nullptr;
+        sz = 0;
     }
     
     inline bool empty() const noexcept
@@ -127,222 +410,1624 @@ public:
         return sz;
     }
     
+    allocator_type get_allocator() const
+    {
+        return allocator_type(alloc);
+    }
+    
+    // Bytes held by the nodes and by the allocator around them
+    AvlMemoryUsage memory_usage() const noexcept
+    {
+        return {sz, sizeof(Node), sz * sizeof(Node), detail::allocated_bytes(alloc, sz)};
+    }
+    
+    /**
+     * Copy every node into fresh memory, laid out in the given order, and
+     * free the old one. Nodes come from a new allocator as for a copy, so
+     * a NodePool starts a new arena and the old one, holes left by erase
+     * included, is released whole. The shape of the tree is kept.
+     * Invalidates iterators and references. Strong exception guarantee.
+     */
+    void compact(NodeLayout layout = NodeLayout::in_order)
+    {
+        AvlMap tmp (comp, get_allocator());
+        tmp.alloc = NodeTraits::select_on_container_copy_construction(alloc);
+        
+        if (layout == NodeLayout::van_emde_boas) tmp.root = tmp.clone_veb(root);
+        else tmp.root = tmp.clone_in_order(root);
+        tmp.sz = sz;
+        
+        std::swap(root, tmp.root);
+        std::swap(alloc, tmp.alloc);
+        rightmost = findMax(root);
+    }
+    
+    key_compare key_comp() const
+    {
+        return comp;
+    }
+    
+    // Counters since construction or the last reset_stats(), all 0 without Stats
+    const AvlStats& stats() const noexcept
+    {
+        return this->counters();
+    }
+    
+    void reset_stats() noexcept
+    {
+        this->reset_counters();
+    }
+    
+    // does nothing if k is already there
     template<typename K = Key,
              typename V = Value>
-    void insert(K&& k, V&& v)
+    std::pair<iterator, bool> insert(K&& k, V&& v)
     {
-        insert_util(std::forward<K>(k), std::forward<V>(v), root);
-        ++sz;
+        return try_emplace(std::forward<K>(k), std::forward<V>(v));
+    }
+    
+    /**
+     * Build the element from args, then link it unless its key is
+     * already there (the new element is dropped in that case).
+     */
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args)
+    {
+        auto n = create_node(std::piecewise_construct, std::forward<Args>(args)...);
+        auto res = insert_util(n->key(), [&n]() { return std::move(n); });
+        
+        return {iterator(res.first, this), res.second};
+    }
+    
+    /**
+     * Insert a value built from args only if k is absent; otherwise
+     * nothing is constructed, args are left untouched.
+     */
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& k, Args&&... args)
+    {
+        auto res = insert_util(k, [&]() { 
+            return create_node(std::piecewise_construct,
+                               std::piecewise_construct,
+                               std::forward_as_tuple(k),
+                               std::forward_as_tuple(std::forward<Args>(args)...));
+        });
+        
+        return {iterator(res.first, this), res.second};
+    }
+    
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& k, Args&&... args)
+    {
+        auto res = insert_util(k, [&]() { 
+            return create_node(std::piecewise_construct,
+                               std::piecewise_construct,
+                               std::forward_as_tuple(std::move(k)),
+                               std::forward_as_tuple(std::forward<Args>(args)...));
+        });
+        
+        return {iterator(res.first, this), res.second};
+    }
+    
+    /**
+     * Insert with a hint: the search starts from hint instead of the root,
+     * so a key d positions away from it costs O(log d) comparisons. Passing
+     * back the returned iterator as the next hint makes it a finger for
+     * sorted or almost sorted input; end() appends after the largest key.
+     * Rebalancing walks up the parent links and stops early as usual.
+     * Returns the element with key k, new or not.
+     */
+    template<typename K = Key,
+             typename V = Value>
+    iterator insert(const_iterator hint, K&& k, V&& v)
+    {
+        auto res = insert_near(hint.node, k, [&]() {
+            return create_node(std::piecewise_construct,
+                               std::piecewise_construct,
+                               std::forward_as_tuple(std::forward<K>(k)),
+                               std::forward_as_tuple(std::forward<V>(v)));
+        });
+        
+        return iterator(res.first, this);
+    }
+    
+    template<typename... Args>
+    iterator emplace_hint(const_iterator hint, Args&&... args)
+    {
+        auto n = create_node(std::piecewise_construct, std::forward<Args>(args)...);
+        auto res = insert_near(hint.node, n->key(), [&n]() { return std::move(n); });
+        
+        return iterator(res.first, this);
+    }
+    
+    // Insert, or assign to the mapped value if k is already there
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& k, M&& obj)
+    {
+        auto res = try_emplace(k, std::forward<M>(obj));
+        if (!res.second) res.first->second = std::forward<M>(obj);
+        return res;
+    }
+    
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(Key&& k, M&& obj)
+    {
+        auto res = try_emplace(std::move(k), std::forward<M>(obj));
+        if (!res.second) res.first->second = std::forward<M>(obj);
+        return res;
     }
     
     void erase(const Key& k) noexcept
     {
         remove_util(k, root);
-        --sz;
+    }
+    
+    // Unlink the element with key k and hand it over, empty if k is absent
+    node_type extract(const Key& k) noexcept
+    {
+        return node_type(remove_util(k, root), alloc);
+    }
+    
+    // Unlink the element at pos, found without a search
+    node_type extract(const_iterator pos) noexcept
+    {
+        return node_type(remove_node(const_cast<Node*>(pos.node)), alloc);
+    }
+    
+    /**
+     * Link an extracted node unless its key is already there.
+     * Nodes of an allocator comparing unequal to this one cannot be
+     * adopted, their element is moved into a new node instead.
+     */
+    insert_return_type insert(node_type&& nh)
+    {
+        if (nh.empty()) return {end(), false, node_type()};
+        
+        std::pair<Node*, bool> res;
+        
+        if (nh.alloc == alloc)
+            res = insert_util(nh.key(), [&nh]() { return std::move(nh.node); });
+        else
+            res = insert_util(nh.key(), [&]() {
+                return create_node(std::piecewise_construct,
+                                   std::piecewise_construct,
+                                   std::forward_as_tuple(std::move(nh.key())),
+                                   std::forward_as_tuple(std::move(nh.mapped())));
+            });
+        
+        if (!res.second) return {iterator(res.first, this), false, std::move(nh)};
+        return {iterator(res.first, this), true, node_type()};
+    }
+    
+    // Call fn on every pair in order, without recursion
+    template<typename F>
+    void visit(F&& fn)
+    {
+        detail::inorder<MAX_DEPTH>(root.get(), fn);
+    }
+    
+    template<typename F>
+    void visit(F&& fn) const
+    {
+        detail::inorder<MAX_DEPTH>(static_cast<const Node*>(root.get()), fn);
+    }
+    
+    /**
+     * Stream the map to os as "{(k, v), ...}", each pair written by
+     * fmt(OutputBuffer&, const value_type&). Output goes through a fixed
+     * buffer in large blocks, and the walk is a loop over a fixed stack.
+     */
+    template<typename F = TextFormat>
+    void write_to(std::ostream& os, F fmt = F()) const
+    {
+        detail::write_tree<MAX_DEPTH>(os, static_cast<const Node*>(root.get()), fmt);
     }
     
     void print() const noexcept
     {
-        if (empty()) std::cout << "{}\n";
-        else {
-            std::cout << "{";
-            print(root);
-            std::cout << "\b\b}\n";
-        }
+        write_to(std::cout);
     }
     
     //access or insert specified element 
     Value& operator[](const Key& k)
     {
-        std::unique_ptr<Node>& ptr = search(k, root);
-        
-        if (ptr == nullptr) {
-            // insert default constructed value
-            insert_util(k, Value(), ptr);
-            ++sz;
-        }
+        // insert default constructed value if needed
+        return try_emplace(k).first->second;
+    }
+    
+    Value& operator[](Key&& k)
+    {
+        return try_emplace(std::move(k)).first->second;
+    }
+    
+    // heterogeneous version, the Key is only built when inserting
+    template<typename K, 
+             typename = enable_transparent<K>,
+             typename = std::enable_if_t<std::is_constructible<Key, K>::value>>
+    Value& operator[](K&& k)
+    {
+        auto res = insert_util(k, [&]() { 
+            return create_node(std::piecewise_construct,
+                               std::piecewise_construct,
+                               std::forward_as_tuple(std::forward<K>(k)),
+                               std::tuple<>());
+        });
         
-        return *ptr;
+        return res.first->data.second;
     }
     
     const Value& operator[](const Key& k) const noexcept
     {
-        auto& ptr = search(k, root);
-        return ptr != nullptr ? *ptr : Value();
+        static const Value empty {};
+        auto ptr = find_node(k);
+        return ptr != nullptr ? *ptr : empty;
     }
     
     // access specified elem with checking
     Value& at(const Key& k)
     {
-        auto& ptr = search(k, root);
+        auto ptr = find_node(k);
         if (ptr == nullptr) throw std::out_of_range("Elem not found error");
         return *ptr;
     }
     
     const Value& at(const Key& k) const
     {
-        return at(k);
+        auto ptr = find_node(k);
+        if (ptr == nullptr) throw std::out_of_range("Elem not found error");
+        return *ptr;
+    }
+    
+    template<typename K, typename = enable_transparent<K>>
+    Value& at(const K& k)
+    {
+        auto ptr = find_node(k);
+        if (ptr == nullptr) throw std::out_of_range("Elem not found error");
+        return *ptr;
+    }
+    
+    template<typename K, typename = enable_transparent<K>>
+    const Value& at(const K& k) const
+    {
+        auto ptr = find_node(k);
+        if (ptr == nullptr) throw std::out_of_range("Elem not found error");
+        return *ptr;
     }
     
     
     // Check if conatiner has an specific key
     bool search(const Key& x) const noexcept
     {
-        return search(x, root) != nullptr;
+        return find_node(x) != nullptr;
     }    
-        
-private:
-    // recursive method to clone a tree
-    std::unique_ptr<Node> clone(const std::unique_ptr<Node>& node) const
+    
+    template<typename K, typename = enable_transparent<K>>
+    bool search(const K& x) const noexcept
     {
-        if (!node) return nullptr;
-        else
-            return std::make_unique<Node>(node->key,
-                                          node->value,
-                                          clone(node->left), 
-                                          clone(node->right), 
-                                          node->height);
+        return find_node(x) != nullptr;
     }
     
-    // Returns height of a node
-    inline std::int32_t height(const std::unique_ptr<Node>& node) const noexcept
+    // iterator to the element with key x, end() if there is none
+    iterator find(const Key& x) noexcept
     {
-        return node == nullptr ? -1 : node->height;
+        return iterator(find_node(x), this);
     }
     
-    // print tree inorder
-    void print(const std::unique_ptr<Node>& t) const noexcept
-    { 
-        if (t != nullptr) {
-            
-            print(t->left);
-            std::cout << "(" << t->key << ", " << t->value << "), ";
-            print(t->right);
-        }
+    const_iterator find(const Key& x) const noexcept
+    {
+        return const_iterator(find_node(x), this);
     }
     
+    template<typename K, typename = enable_transparent<K>>
+    iterator find(const K& x) noexcept
+    {
+        return iterator(find_node(x), this);
+    }
     
-    // binary search an element in the tree
-    std::unique_ptr<Node>& search(const Key& x, std::unique_ptr<Node>& t) const noexcept
+    template<typename K, typename = enable_transparent<K>>
+    const_iterator find(const K& x) const noexcept
     {
-        // recursive
-        /*return (t == nullptr || t->key == x) ? t : 
-                                                 x < t->key ? search(x, t->left) : 
-                                                              search(x, t->right);
-        
-        */
-        
-        // iterative 
-        if (t == nullptr || t->key == x) return t;
-        
-        Node* tmp = t.get();
-        
-        while(true) {
-            if(x < tmp->key) {
-                if (tmp->left == nullptr || tmp->left->key == x) {
-                    return tmp->left;
-                }
-                tmp = tmp->left.get();
-            }
-            else if(tmp->key < x) {
-                if (tmp->right == nullptr || tmp->right->key == x) {
-                    return tmp->right;
-                }
-                tmp = tmp->right.get();
-            }
-        }
+        return const_iterator(find_node(x), this);
     }
     
+    /**
+     * Look up every key of [first, last), writing to out in the same order
+     * whether it is there. The descents run interleaved in groups, so the
+     * cache misses of one overlap with the work of the others.
+     */
+    template<typename ForwardIt, typename OutputIt>
+    OutputIt search_many(ForwardIt first, ForwardIt last, OutputIt out) const
+    {
+        find_many(first, last, [&](const Node* n) { *out++ = n != nullptr; });
+        return out;
+    }
     
-    // Recursive insert method
-    template<typename K = Key,
-             typename V = Value>
-    void insert_util(K&& k, V&& v, std::unique_ptr<Node>& t)
+    // Values of the keys of [first, last) to out, throws at the first missing
+    template<typename ForwardIt, typename OutputIt>
+    OutputIt at_many(ForwardIt first, ForwardIt last, OutputIt out) const
     {
-        if (t == nullptr)
-            t = std::make_unique<Node>(std::forward<K>(k), std::forward<V>(v), nullptr, nullptr, 0);
-        else if (k < t->key)
-            insert_util(std::forward<K>(k), std::forward<V>(v), t->left);
-        else if (t->key < k)
-            insert_util(std::forward<K>(k), std::forward<V>(v), t->right);
-        else //duplicate key
-            --sz;
-        
-        balance(t);
+        find_many(first, last, [&](const Node* n) {
+            if (n == nullptr) throw std::out_of_range("Elem not found error");
+            *out++ = n->data.second;
+        });
+        return out;
     }
     
-    // Recursive delete method
-    void remove_util(const Key& x, std::unique_ptr<Node>& t) noexcept
+    // first element whose key is not less than x
+    iterator lower_bound(const Key& x) noexcept
     {
-        if (t == nullptr) {
-            ++sz;
-            return;   // Item not found; do nothing
-        } 
-        
-        if(x < t->key)
-            remove_util(x, t->left);
-        else if(t->key < x)
-            remove_util(x, t->right);
-        else if(t->left != nullptr && t->right != nullptr) { // Two children
-            t->key = findMin(t->right)->key;
-            remove_util(t->key, t->right);
-        }
-        else { // One child
-            std::unique_ptr<Node> oldNode {std::move(t)};
-            t = (oldNode->left != nullptr) ? std::move(oldNode->left) : 
-                                             std::move(oldNode->right);
-            
-            // oldNode.reset(nullptr); -> unneeded, auto delete when go out of scope
-        }
-        
-        balance(t);
+        return iterator(lower_node(x), this);
     }
     
-    // Find smallest elem in a tree
-    Node* findMin(const std::unique_ptr<Node>& node) const noexcept
+    const_iterator lower_bound(const Key& x) const noexcept
     {
-        auto t = node.get();
-
-        if(t != nullptr)
-            while (t->left != nullptr)
-                t = t->left.get();
-
-        return t;
+        return const_iterator(lower_node(x), this);
     }
     
-    // Find largest elem in a tree
-    Node* findMax(const std::unique_ptr<Node>& node) const noexcept
+    template<typename K, typename = enable_transparent<K>>
+    iterator lower_bound(const K& x) noexcept
     {
-        auto t = node.get();
-
-        if(t != nullptr)
-            while (t->right != nullptr)
-                t = t->right.get();
-
-        return t;
+        return iterator(lower_node(x), this);
     }
     
-    // Internal method to re-balance the tree
-    void balance(std::unique_ptr<Node>& t) noexcept
+    template<typename K, typename = enable_transparent<K>>
+    const_iterator lower_bound(const K& x) const noexcept
     {
-        static const int ALLOWED_IMBALANCE = 1;
-        
-        if(t == nullptr) return;
-        
-        if(height(t->left) - height(t->right) > ALLOWED_IMBALANCE) {
-            if(height(t->left->left) >= height(t->left->right))
-                rotateWithLeftChild(t);
-            else
-                doubleWithLeftChild(t);
-        }
+        return const_iterator(lower_node(x), this);
+    }
+    
+    // first element whose key is greater than x
+    iterator upper_bound(const Key& x) noexcept
+    {
+        return iterator(upper_node(x), this);
+    }
+    
+    const_iterator upper_bound(const Key& x) const noexcept
+    {
+        return const_iterator(upper_node(x), this);
+    }
+    
+    template<typename K, typename = enable_transparent<K>>
+    iterator upper_bound(const K& x) noexcept
+    {
+        return iterator(upper_node(x), this);
+    }
+    
+    template<typename K, typename = enable_transparent<K>>
+    const_iterator upper_bound(const K& x) const noexcept
+    {
+        return const_iterator(upper_node(x), this);
+    }
+    
+    std::pair<iterator, iterator> equal_range(const Key& x) noexcept
+    {
+        return {lower_bound(x), upper_bound(x)};
+    }
+    
+    std::pair<const_iterator, const_iterator> equal_range(const Key& x) const noexcept
+    {
+        return {lower_bound(x), upper_bound(x)};
+    }
+    
+    template<typename K, typename = enable_transparent<K>>
+    std::pair<iterator, iterator> equal_range(const K& x) noexcept
+    {
+        return {lower_bound(x), upper_bound(x)};
+    }
+    
+    template<typename K, typename = enable_transparent<K>>
+    std::pair<const_iterator, const_iterator> equal_range(const K& x) const noexcept
+    {
+        return {lower_bound(x), upper_bound(x)};
+    }
+    
+    /**
+     * Call fn on every (key, value) pair with a key in [lo, hi), in order.
+     * One descent to the first key, then successor steps until hi:
+     * nothing outside the range is visited but the path to it.
+     */
+    template<typename F>
+    void for_each_in_range(const Key& lo, const Key& hi, F&& fn)
+    {
+        for_each_util(lower_node(lo), hi, fn);
+    }
+    
+    template<typename F>
+    void for_each_in_range(const Key& lo, const Key& hi, F&& fn) const
+    {
+        for_each_util(static_cast<const Node*>(lower_node(lo)), hi, fn);
+    }
+    
+    template<typename K, typename F, typename = enable_transparent<K>>
+    void for_each_in_range(const K& lo, const K& hi, F&& fn)
+    {
+        for_each_util(lower_node(lo), hi, fn);
+    }
+    
+    template<typename K, typename F, typename = enable_transparent<K>>
+    void for_each_in_range(const K& lo, const K& hi, F&& fn) const
+    {
+        for_each_util(static_cast<const Node*>(lower_node(lo)), hi, fn);
+    }
+    
+    /**
+     * Call fn on every pair, with disjoint subtrees near the top on
+     * separate threads: no particular order, fn must be safe to call
+     * concurrently. threads = 0 uses every core. An exception
+     * thrown by fn (in any thread) is rethrown once all of them are done.
+     */
+    template<typename F>
+    void parallel_for_each(F&& fn, unsigned threads = 0)
+    {
+        parallel_visit(root.get(), fn, detail::fork_depth(threads));
+    }
+    
+    template<typename F>
+    void parallel_for_each(F&& fn, unsigned threads = 0) const
+    {
+        parallel_visit(static_cast<const Node*>(root.get()), fn, detail::fork_depth(threads));
+    }
+    
+    // Iterators block
+    iterator begin() noexcept
+    {
+        return iterator(findMin(root), this);
+    }
+    
+    const_iterator begin() const noexcept
+    {
+        return const_iterator(findMin(root), this);
+    }
+    
+    iterator end() noexcept
+    {
+        return iterator(nullptr, this);
+    }
+    
+    const_iterator end() const noexcept
+    {
+        return const_iterator(nullptr, this);
+    }
+    
+    const_iterator cbegin() const noexcept { return begin(); }
+    const_iterator cend() const noexcept { return end(); }
+    
+    reverse_iterator rbegin() noexcept { return reverse_iterator(end()); }
+    reverse_iterator rend() noexcept { return reverse_iterator(begin()); }
+    
+    const_reverse_iterator rbegin() const noexcept
+    {
+        return const_reverse_iterator(end());
+    }
+    
+    const_reverse_iterator rend() const noexcept
+    {
+        return const_reverse_iterator(begin());
+    }
+    
+    const_reverse_iterator crbegin() const noexcept { return rbegin(); }
+    const_reverse_iterator crend() const noexcept { return rend(); }
+    
+    /**
+     * Insert a whole (forward) range of pairs at once. Iterators to them
+     * are sorted first, a recursive pass over the tree finds the keys
+     * already there and the others get a node, merged into the tree in a
+     * second pass; both only touch the subtrees the keys land in, so
+     * O(k log(n/k + 1)) after the O(k log k) sort. Keys already present
+     * keep their value and cost no allocation.
+     */
+    template<typename Iter>
+    void insert_batch(Iter first, Iter last)
+    {
+        std::vector<Iter> items;
+        for (auto it = first; it != last; std::advance(it, 1))
+            items.push_back(it);
+        sort_batch(items);
+        
+        // only the elements not in the tree yet get a node
+        std::vector<char> present (items.size(), 0);
+        Iter* base = items.data();
+        find_sorted(root.get(), base, base + items.size(), base, present);
+        
+        std::vector<node_ptr> batch;
+        batch.reserve(items.size());
+        for (std::size_t i = 0; i < items.size(); ++i)
+            if (!present[i]) batch.push_back(create_node(items[i]->first, items[i]->second, nullptr, nullptr));
+        
+        // everything that can throw is above, the tree is untouched until here
+        std::size_t added = 0;
+        root = insert_sorted(std::move(root), batch.data(), batch.data() + batch.size(), added);
+        if (root != nullptr) root->parent = nullptr;
+        rightmost = findMax(root);
+        sz += added;
+    }
+    
+    // Remove every key of the range, in a single pass
+    template<typename Iter>
+    void erase_batch(Iter first, Iter last)
+    {
+        std::vector<Key> keys (first, last);
+        std::sort(keys.begin(), keys.end(), comp);
+        
+        std::size_t dropped = 0;
+        root = erase_sorted(std::move(root), keys.cbegin(), keys.cend(), dropped);
+        if (root != nullptr) root->parent = nullptr;
+        rightmost = findMax(root);
+        sz -= dropped;
+    }
+    
+    // Immutable copy in a flat, cache friendly layout for read-only use, O(n)
+    FrozenAvlMap<Key, Value, Compare> freeze() const
+    {
+        return FrozenAvlMap<Key, Value, Compare>(sorted_unique, cbegin(), cend(), comp);
+    }
+    
+    // Serialization block, for trivially copyable keys and values
+    
+    /**
+     * Write the map in compact binary form: a header, then the pairs laid
+     * out as an implicit tree in level order. MappedAvlMap can search
+     * such a file in place. Check os for errors afterwards.
+     */
+    void serialize(std::ostream& os) const
+    {
+        static_assert(std::is_trivially_copyable<Key>::value &&
+                      std::is_trivially_copyable<Value>::value,
+                      "serialize() needs trivially copyable keys and values");
+        
+        using Record = detail::MapRecord<Key, Value>;
+        
+        // zeroed, so padding bytes don't leak into the file
+        std::vector<unsigned char> buf (sz * sizeof(Record), 0);
+        auto it = cbegin();
+        auto place = [&](std::size_t i) {
+            ::new (static_cast<void*>(&buf[i * sizeof(Record)])) Record{it->first, it->second};
+            ++it;
+        };
+        detail::level_order_inorder(0, sz, place);
+        
+        auto header = detail::make_map_header<Key, Value>(sz);
+        os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        os.write(reinterpret_cast<const char*>(buf.data()), static_cast<std::streamsize>(buf.size()));
+    }
+    
+    /**
+     * Read back what serialize() wrote, O(n), into a map with comparator c
+     * and nodes from the allocator a. Throws on malformed input.
+     */
+    static AvlMap deserialize(std::istream& is, const Compare& c = Compare(),
+                              const Alloc& a = Alloc())
+    {
+        static_assert(std::is_trivially_copyable<Key>::value &&
+                      std::is_trivially_copyable<Value>::value,
+                      "deserialize() needs trivially copyable keys and values");
+        
+        using Record = detail::MapRecord<Key, Value>;
+        
+        detail::MapFileHeader header;
+        if (!is.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+            !detail::valid_map_header<Key, Value>(header))
+            throw std::runtime_error("Not a map file for these types");
+        
+        if (header.count > PTRDIFF_MAX / sizeof(Record))
+            throw std::runtime_error("Corrupt map file");
+        
+        /*
+         * Records come in level order, the shape of a complete binary tree,
+         * which is balanced: each node is linked under its parent as soon
+         * as it is read. The stream is read in fixed chunks, so memory
+         * follows what it really holds whatever count the header claims.
+         */
+        using Slot = std::aligned_storage_t<sizeof(Record), alignof(Record)>;
+        constexpr std::size_t CHUNK = std::max<std::size_t>(1, (64 * 1024) / sizeof(Record));
+        
+        auto n = static_cast<std::size_t>(header.count);
+        std::unique_ptr<Slot[]> buf {new Slot[CHUNK]};
+        std::vector<Node*> nodes;
+        AvlMap res (c, a);
+        
+        for (std::size_t i = 0; i < n; ) {
+            std::size_t m = std::min(CHUNK, n - i);
+            if (!is.read(reinterpret_cast<char*>(buf.get()), static_cast<std::streamsize>(m * sizeof(Record))))
+                throw std::runtime_error("Truncated map file");
+            
+            const Record* r = reinterpret_cast<const Record*>(buf.get());
+            for (std::size_t j = 0; j < m; ++j, ++i) {
+                node_ptr t = res.create_node(r[j].key, r[j].value, nullptr, nullptr);
+                nodes.push_back(t.get());
+                
+                if (i == 0) {
+                    res.root = std::move(t);
+                    continue;
+                }
+                
+                Node* p = nodes[(i - 1) / 2];
+                t->parent = p;
+                if (i % 2 == 1) p->left = std::move(t);
+                else p->right = std::move(t);
+            }
+        }
+        res.rightmost = res.findMax(res.root);
+        res.sz = n;
+        
+        for (std::size_t i = n; i-- > 0; ) {
+            Node& t = *nodes[i];
+            t.height = std::max(res.height(t.left), res.height(t.right)) + 1;
+            update_size(t);
+        }
+        
+        // the keys have to come out sorted
+        const Key* prev = nullptr;
+        for (const Node* t = res.findMin(res.root); t != nullptr; t = next(t)) {
+            if (prev != nullptr && !res.comp(*prev, t->key()))
+                throw std::runtime_error("Corrupt map file");
+            prev = &t->key();
+        }
+        
+        return res;
+    }
+    
+    // Order statistics block, needs OrderStats
+    
+    // k-th smallest key counting from 0, end() if k >= size()
+    iterator nth(std::size_t k) noexcept
+    {
+        return iterator(nth_node(k), this);
+    }
+    
+    const_iterator nth(std::size_t k) const noexcept
+    {
+        return const_iterator(nth_node(k), this);
+    }
+    
+    // Number of keys smaller than x
+    std::size_t rank(const Key& x) const noexcept
+    {
+        return rank_util(x);
+    }
+    
+    template<typename K, typename = enable_transparent<K>>
+    std::size_t rank(const K& x) const noexcept
+    {
+        return rank_util(x);
+    }
+    
+    // Number of keys in [lo, hi)
+    std::size_t count_range(const Key& lo, const Key& hi) const noexcept
+    {
+        return comp(lo, hi) ? rank_util(hi) - rank_util(lo) : 0;
+    }
+    
+    template<typename K, typename = enable_transparent<K>>
+    std::size_t count_range(const K& lo, const K& hi) const noexcept
+    {
+        return comp(lo, hi) ? rank_util(hi) - rank_util(lo) : 0;
+    }
+        
+private:
+    // allocate and construct a node, the node_ptr takes care of the rest
+    template<typename... Args>
+    node_ptr create_node(Args&&... args)
+    {
+        Node* p = NodeTraits::allocate(alloc, 1);
+        this->count_allocation();
+        
+        try {
+            NodeTraits::construct(alloc, p, std::forward<Args>(args)...);
+        }
+        catch (...) {
+            NodeTraits::deallocate(alloc, p, 1);
+            throw;
+        }
+        
+        return node_ptr{p};
+    }
+    
+    /**
+     * Iterative teardown of a whole tree with O(1) extra space.
+     * Left children are rotated up into the right spine, so every node is
+     * freed once it has no left child, no recursion involved. When the node
+     * pool holds nothing but this tree it is dropped in one go instead.
+     */
+    void destroy(node_ptr t) noexcept
+    {
+        if (t == nullptr) return;
+        
+        if (std::is_trivially_destructible<Key>::value &&
+            std::is_trivially_destructible<Value>::value &&
+            detail::release_all(alloc, sz)) {
+            t.release();
+            return;
+        }
+        
+        while (t != nullptr) {
+            if (t->left != nullptr) {
+                node_ptr l = std::move(t->left);
+                t->left = std::move(l->right);
+                l->right = std::move(t);
+                t = std::move(l);
+            }
+            else {
+                t = std::move(t->right);
+            }
+        }
+    }
+    
+    /**
+     * Build a perfectly balanced tree out of the next n pairs of a
+     * sorted range, consumed in order. O(n), recursion depth is log n.
+     */
+    template<typename Iter>
+    node_ptr build_sorted(Iter& it, std::size_t n)
+    {
+        if (n == 0) return nullptr;
+        
+        auto left = build_sorted(it, (n - 1) / 2);
+        auto t = create_node(it->first, it->second, std::move(left), nullptr);
+        ++it;
+        
+        t->right = build_sorted(it, n - 1 - (n - 1) / 2);
+        if (t->right != nullptr) t->right->parent = t.get();
+        t->height = std::max(height(t->left), height(t->right)) + 1;
+        update_size(*t);
+        
+        return t;
+    }
+    
+    // recursive method to clone a tree
+    node_ptr clone(const node_ptr& node)
+    {
+        if (!node) return nullptr;
+        else
+            return create_node(node->data.first,
+                               node->data.second,
+                               clone(node->left), 
+                               clone(node->right), 
+                               node->height);
+    }
+    
+    // Clone allocating the nodes in key order
+    node_ptr clone_in_order(const node_ptr& node)
+    {
+        if (!node) return nullptr;
+        
+        auto left = clone_in_order(node->left);
+        auto t = create_node(node->data.first, node->data.second, std::move(left), nullptr, node->height);
+        
+        t->right = clone_in_order(node->right);
+        if (t->right != nullptr) t->right->parent = t.get();
+        update_size(*t);
+        
+        return t;
+    }
+    
+    // Link of a node copied by clone_veb() still to be filled
+    struct Hanging {
+        Node* parent;
+        node_ptr Node::* side;
+        const Node* source;
+    };
+    
+    node_ptr clone_veb(const node_ptr& node)
+    {
+        if (!node) return nullptr;
+        
+        std::vector<Hanging> below;
+        return clone_veb(node.get(), height(node) + 1, below);
+    }
+    
+    /**
+     * Clone of the top levels of t in van Emde Boas order: the upper half
+     * of them first, then each subtree hanging below it. Children past the
+     * last level are left empty and queued in below, left to right.
+     */
+    node_ptr clone_veb(const Node* t, std::int32_t levels, std::vector<Hanging>& below)
+    {
+        if (levels == 1) {
+            auto n = create_node(t->data.first, t->data.second, nullptr, nullptr, t->height);
+            n->set_subtree_size(t->subtree_size());
+            
+            if (t->left != nullptr) below.push_back({n.get(), &Node::left, t->left.get()});
+            if (t->right != nullptr) below.push_back({n.get(), &Node::right, t->right.get()});
+            return n;
+        }
+        
+        std::int32_t lower = levels / 2;
+        std::vector<Hanging> middle;
+        auto top = clone_veb(t, levels - lower, middle);
+        
+        for (const Hanging& h : middle) {
+            node_ptr& link = h.parent->*h.side;
+            link = clone_veb(h.source, lower, below);
+            link->parent = h.parent;
+        }
+        
+        return top;
+    }
+    
+    /**
+     * Balanced tree out of the n sorted pairs at first, moved into the
+     * nodes; both subtrees are built on separate threads near the top.
+     */
+    node_ptr build_parallel_util(std::pair<Key, Value>* first, std::size_t n, int budget)
+    {
+        if (n == 0) return nullptr;
+        
+        std::size_t half = (n - 1) / 2;
+        auto* mid = first + half;
+        node_ptr l, r;
+        
+        if (budget > 0 && n >= (std::size_t(1) << FORK_HEIGHT)) {
+            // allocations can still fail, fork2 passes that on
+            auto left = [&] { l = build_parallel_util(first, half, budget - 1); };
+            auto right = [&] { r = build_parallel_util(mid + 1, n - 1 - half, budget - 1); };
+            detail::fork2(true, left, right);
+        }
+        else {
+            l = build_parallel_util(first, half, 0);
+            r = build_parallel_util(mid + 1, n - 1 - half, 0);
+        }
+        
+        auto h = std::max(height(l), height(r)) + 1;
+        return create_node(std::move(mid->first), std::move(mid->second), std::move(l), std::move(r), h);
+    }
+    
+    // In order walk of t, subtrees of a tall enough node on two threads
+    template<typename N, typename F>
+    static void parallel_visit(N* t, F& fn, int budget)
+    {
+        if (t == nullptr) return;
+        
+        if (budget <= 0 || t->height < FORK_HEIGHT) {
+            parallel_visit<N>(t->left.get(), fn, 0);
+            fn(t->data);
+            parallel_visit<N>(t->right.get(), fn, 0);
+            return;
+        }
+        
+        auto left = [&] { parallel_visit<N>(t->left.get(), fn, budget - 1); };
+        auto rest = [&] {
+            fn(t->data);
+            parallel_visit<N>(t->right.get(), fn, budget - 1);
+        };
+        detail::fork2(true, left, rest);
+    }
+    
+    /**
+     * Levels of build_parallel_util() that may fork. None when the nodes
+     * come from a pool, as the arenas are not thread-safe, nor with Stats,
+     * whose counters aren't either.
+     */
+    static int fork_budget(unsigned threads) noexcept
+    {
+        if (!NodeTraits::is_always_equal::value || Stats) return 0;
+        return detail::fork_depth(threads);
+    }
+    
+    // Returns height of a node
+    inline std::int32_t height(const node_ptr& node) const noexcept
+    {
+        return node == nullptr ? -1 : node->height;
+    }
+    
+    // Returns key count of a subtree, 0 without OrderStats
+    static std::size_t subtree_size(const node_ptr& node) noexcept
+    {
+        return node == nullptr ? 0 : node->subtree_size();
+    }
+    
+    static void update_size(Node& t) noexcept
+    {
+        if (OrderStats) t.set_subtree_size(subtree_size(t.left) + subtree_size(t.right) + 1);
+    }
+    
+    Node* nth_node(std::size_t k) const noexcept
+    {
+        static_assert(OrderStats, "nth() needs the OrderStats parameter");
+        
+        auto t = root.get();
+        
+        while (t != nullptr) {
+            auto l = subtree_size(t->left);
+            
+            if (k < l)
+                t = t->left.get();
+            else if (k > l) {
+                k -= l + 1;
+                t = t->right.get();
+            }
+            else break;
+        }
+        
+        return t;
+    }
+    
+    // Count the keys below x in a single descent
+    template<typename K>
+    std::size_t rank_util(const K& x) const noexcept
+    {
+        static_assert(OrderStats, "rank() needs the OrderStats parameter");
+        
+        std::size_t r = 0;
+        auto t = root.get();
+        
+        while (t != nullptr)
+            if (comp(t->key(), x)) {
+                r += subtree_size(t->left) + 1;
+                t = t->right.get();
+            }
+            else
+                t = t->left.get();
+        
+        return r;
+    }
+    
+    
+    /**
+     * Binary search an element in the tree.
+     * One comparison per level and no early exit: the walk remembers the
+     * last node not greater than x and checks it for equality at the end,
+     * so the child pick compiles to a conditional move rather than a hard
+     * to predict branch. Both children are prefetched before comparing,
+     * the next node is then already on its way whichever side wins.
+     */
+    template<typename K>
+    Node* find_node(const K& x) const noexcept
+    {
+        auto t = root.get();
+        Node* candidate = nullptr;
+        std::uint64_t comparisons = 0; // dead code without Stats
+        auto less = [&](const auto& a, const auto& b) { ++comparisons; return comp(a, b); };
+        
+        while (t != nullptr) {
+            Node* l = t->left.get();
+            Node* r = t->right.get();
+            detail::prefetch(l);
+            detail::prefetch(r);
+            
+            bool go_left = less(x, t->key());
+            candidate = go_left ? candidate : t;
+            t = go_left ? l : r;
+        }
+        
+        if (candidate != nullptr && less(candidate->key(), x)) candidate = nullptr;
+        
+        this->count_search(comparisons);
+        return candidate;
+    }
+    
+    /**
+     * find_node() for a whole range of keys, fn gets each result in order.
+     * GROUP descents advance one level per round, each prefetching its
+     * next node, so up to GROUP memory loads are in flight at once.
+     */
+    template<typename ForwardIt, typename F>
+    void find_many(ForwardIt first, ForwardIt last, F&& fn) const
+    {
+        static constexpr std::size_t GROUP = 16;
+        
+        ForwardIt keys[GROUP];
+        const Node* t[GROUP];
+        const Node* candidate[GROUP];
+        std::uint64_t comparisons[GROUP];
+        
+        while (first != last) {
+            std::size_t n = 0;
+            for (; n < GROUP && first != last; ++n, ++first) {
+                keys[n] = first;
+                t[n] = root.get();
+                candidate[n] = nullptr;
+                comparisons[n] = 0;
+            }
+            
+            for (bool active = true; active; ) {
+                active = false;
+                
+                for (std::size_t i = 0; i < n; ++i) {
+                    if (t[i] == nullptr) continue;
+                    
+                    bool go_left = comp(*keys[i], t[i]->key());
+                    candidate[i] = go_left ? candidate[i] : t[i];
+                    t[i] = go_left ? t[i]->left.get() : t[i]->right.get();
+                    detail::prefetch(t[i]);
+                    if (Stats) ++comparisons[i];
+                    
+                    active |= t[i] != nullptr;
+                }
+            }
+            
+            for (std::size_t i = 0; i < n; ++i) {
+                auto c = candidate[i];
+                this->count_search(comparisons[i] + (c != nullptr));
+                if (c != nullptr && comp(c->key(), *keys[i])) c = nullptr;
+                fn(c);
+            }
+        }
+    }
+    
+    // lowest node whose key is not less than x
+    template<typename K>
+    Node* lower_node(const K& x) const noexcept
+    {
+        Node* res = nullptr;
+        auto t = root.get();
+        
+        while (t != nullptr)
+            if (comp(t->key(), x))
+                t = t->right.get();
+            else {
+                res = t;
+                t = t->left.get();
+            }
+            
+        return res;
+    }
+    
+    // lowest node whose key is greater than x
+    template<typename K>
+    Node* upper_node(const K& x) const noexcept
+    {
+        Node* res = nullptr;
+        auto t = root.get();
+        
+        while (t != nullptr)
+            if (comp(x, t->key())) {
+                res = t;
+                t = t->left.get();
+            }
+            else
+                t = t->right.get();
+            
+        return res;
+    }
+    
+    template<typename N, typename K, typename F>
+    void for_each_util(N* t, const K& hi, F& fn) const
+    {
+        for (; t != nullptr && comp(t->key(), hi); t = next(t))
+            fn(t->data);
+    }
+    
+    /**
+     * Iterative insert method, single descent looking for k.
+     * Only when k is absent make_node() is called and its node linked
+     * in the empty slot. Returns the node holding k and whether it is new.
+     * The search path is recorded in a fixed-size stack of slots, then
+     * retraced bottom-up only as long as subtree heights keep changing.
+     */
+    template<typename K, typename F>
+    std::pair<Node*, bool> insert_util(const K& k, F&& make_node)
+    {
+        node_ptr* path[MAX_DEPTH];
+        std::size_t depth = 0;
+        node_ptr* slot = &root;
+        Node* parent = nullptr;
+        
+        while (*slot != nullptr) {
+            parent = slot->get();
+            path[depth++] = slot;
+            
+            if (comp(k, parent->key()))
+                slot = &parent->left;
+            else if (comp(parent->key(), k))
+                slot = &parent->right;
+            else //duplicate key
+                return {parent, false};
+        }
+        
+        *slot = make_node();
+        (*slot)->parent = parent;
+        Node* ret = slot->get();
+        track_rightmost(ret);
+        ++sz;
+        
+        retrace(path, depth);
+        return {ret, true};
+    }
+    
+    /**
+     * Called on a node just linked, before any rotation: it is the new
+     * largest one when it went right of the old one, or in an empty tree.
+     * Rotations move nodes but never change which one is the largest.
+     */
+    void track_rightmost(Node* t) noexcept
+    {
+        if (t->parent == rightmost && (rightmost == nullptr || rightmost->right.get() == t))
+            rightmost = t;
+    }
+    
+    /**
+     * insert_util() starting from the node of a hint, nullptr for end().
+     * Climb from the hint to the first ancestor bounding k on the far
+     * side; meanwhile the place of k narrows to the subtree next to the
+     * last ancestor k passed, which is where the descent starts. Both
+     * walks stay below the common ancestor of k and the hint, O(log d).
+     * Past the largest key there is nothing to climb for: end() and the
+     * last node take the cached rightmost one, so appends cost one
+     * comparison plus the amortized O(1) retrace.
+     */
+    template<typename K, typename F>
+    std::pair<Node*, bool> insert_near(const Node* hint, const K& k, F&& make_node)
+    {
+        if (root == nullptr) return insert_util(k, make_node);
+        
+        Node* t = (hint != nullptr) ? const_cast<Node*>(hint) : rightmost;
+        Node* parent = t;
+        node_ptr* slot;
+        
+        if (comp(k, t->key())) {
+            slot = &t->left;
+            
+            // a left child learns nothing about the lower bound
+            for (Node* p = t->parent; p != nullptr; t = p, p = p->parent) {
+                if (p->right.get() != t) continue;
+                if (comp(p->key(), k)) break;
+                if (!comp(k, p->key())) return {p, false};
+                parent = p;
+                slot = &p->left;
+            }
+        }
+        else if (comp(t->key(), k)) {
+            slot = &t->right;
+            
+            // nothing is after the largest key, no need to look up
+            if (t != rightmost) {
+                for (Node* p = t->parent; p != nullptr; t = p, p = p->parent) {
+                    if (p->left.get() != t) continue;
+                    if (comp(k, p->key())) break;
+                    if (!comp(p->key(), k)) return {p, false};
+                    parent = p;
+                    slot = &p->right;
+                }
+            }
+        }
+        else return {t, false};
+        
+        while (*slot != nullptr) {
+            parent = slot->get();
+            
+            if (comp(k, parent->key()))
+                slot = &parent->left;
+            else if (comp(parent->key(), k))
+                slot = &parent->right;
+            else //duplicate key
+                return {parent, false};
+        }
+        
+        *slot = make_node();
+        (*slot)->parent = parent;
+        Node* ret = slot->get();
+        track_rightmost(ret);
+        ++sz;
+        
+        retrace_up(parent);
+        return {ret, true};
+    }
+    
+    // Iterative delete method, returns the unlinked node as a lone leaf
+    node_ptr remove_util(const Key& x, node_ptr& t) noexcept
+    {
+        node_ptr* path[MAX_DEPTH];
+        std::size_t depth = 0;
+        node_ptr* slot = &t;
+        
+        while (*slot != nullptr) {
+            Node* n = slot->get();
+            
+            if (comp(x, n->key())) {
+                path[depth++] = slot;
+                slot = &n->left;
+            }
+            else if (comp(n->key(), x)) {
+                path[depth++] = slot;
+                slot = &n->right;
+            }
+            else break;
+        }
+        
+        if (*slot == nullptr) return nullptr;   // Item not found; do nothing
+        
+        return unlink_at(slot, path, depth);
+    }
+    
+    // remove_util() of the node t itself, its path rebuilt from the parent links
+    node_ptr remove_node(Node* t) noexcept
+    {
+        node_ptr* path[MAX_DEPTH];
+        std::size_t depth = 0;
+        
+        for (Node* p = t->parent; p != nullptr; p = p->parent)
+            path[depth++] = &slot_of(p);
+        std::reverse(path, path + depth);
+        
+        return unlink_at(&slot_of(t), path, depth);
+    }
+    
+    /**
+     * Unlink the node in *slot, found through the slots in path (root
+     * first), and rebalance; no comparisons. Returns it as a lone leaf.
+     */
+    node_ptr unlink_at(node_ptr* slot, node_ptr** path, std::size_t depth) noexcept
+    {
+        --sz;
+        
+        // the largest node has no right child, its predecessor stays linked
+        if (slot->get() == rightmost) rightmost = prev(rightmost);
+        
+        node_ptr oldNode {std::move(*slot)};
+        
+        if (oldNode->left != nullptr && oldNode->right != nullptr) { // Two children
+            // keys are const: the successor node takes the place of *slot
+            std::size_t pos = depth;
+            path[depth++] = slot;
+            node_ptr* sslot = &oldNode->right;
+            
+            while ((*sslot)->left != nullptr) {
+                path[depth++] = sslot;
+                sslot = &(*sslot)->left;
+            }
+            
+            node_ptr succ {std::move(*sslot)};
+            *sslot = std::move(succ->right);
+            if (*sslot != nullptr) (*sslot)->parent = succ->parent;
+            
+            succ->parent = oldNode->parent;
+            succ->height = oldNode->height;
+            succ->left = std::move(oldNode->left);
+            succ->left->parent = succ.get();
+            succ->right = std::move(oldNode->right);
+            if (succ->right != nullptr) succ->right->parent = succ.get();
+            *slot = std::move(succ);
+            
+            // the slot right below the removed node now belongs to succ
+            if (pos + 1 < depth) path[pos + 1] = &(*slot)->right;
+        }
+        else { // One child
+            *slot = (oldNode->left != nullptr) ? std::move(oldNode->left) : 
+                                                 std::move(oldNode->right);
+            if (*slot != nullptr) (*slot)->parent = oldNode->parent;
+        }
+        
+        retrace(path, depth);
+        
+        // dropped by the caller unless extract() keeps it
+        oldNode->parent = nullptr;
+        oldNode->height = 0;
+        update_size(*oldNode);
+        return oldNode;
+    }
+    
+    /**
+     * Rebalance the recorded search path from the bottom up.
+     * Once a subtree ends up with the height it had before the update
+     * nothing above it can change, so the walk stops there; only subtree
+     * sizes (with OrderStats) still need fixing up to the root.
+     */
+    void retrace(node_ptr** path, std::size_t depth) noexcept
+    {
+        std::uint64_t steps = 0;
+        
+        while (depth > 0) {
+            node_ptr& t = *path[--depth];
+            auto old_height = t->height;
+            
+            balance(t);
+            ++steps;
+            
+            if (t->height == old_height) break;
+        }
+        
+        this->count_retrace(steps);
+        
+        if (OrderStats)
+            while (depth > 0) update_size(**path[--depth]);
+    }
+    
+    // retrace() of the path from t up to the root, through the parent links
+    void retrace_up(Node* t) noexcept
+    {
+        std::uint64_t steps = 0;
+        
+        while (t != nullptr) {
+            node_ptr& slot = slot_of(t);
+            auto old_height = slot->height;
+            t = t->parent;
+            
+            balance(slot);
+            ++steps;
+            
+            if (slot->height == old_height) break;
+        }
+        
+        this->count_retrace(steps);
+        
+        if (OrderStats)
+            for (; t != nullptr; t = t->parent) update_size(*t);
+    }
+    
+    // The link owning t: its parent's left or right, or root
+    node_ptr& slot_of(Node* t) noexcept
+    {
+        Node* p = t->parent;
+        if (p == nullptr) return root;
+        return (p->left.get() == t) ? p->left : p->right;
+    }
+    
+    // Batch block
+    
+    // Detach the children of t, leaving a lone node
+    static void unlink(Node& t, node_ptr& l, node_ptr& r) noexcept
+    {
+        l = std::move(t.left);
+        r = std::move(t.right);
+        t.height = 0;
+        update_size(t);
+    }
+    
+    // AVL join: every key in l is before k, every key in r after it
+    node_ptr join_util(node_ptr l, node_ptr k, node_ptr r) noexcept
+    {
+        if (height(l) > height(r) + 1) 
+            return join_right(std::move(l), std::move(k), std::move(r));
+        if (height(r) > height(l) + 1) 
+            return join_left(std::move(l), std::move(k), std::move(r));
+        
+        k->left = std::move(l);
+        k->right = std::move(r);
+        if (k->left != nullptr) k->left->parent = k.get();
+        if (k->right != nullptr) k->right->parent = k.get();
+        balance(k);
+        
+        return k;
+    }
+    
+    // l is the taller one: walk down its right spine to r's height
+    node_ptr join_right(node_ptr l, node_ptr k, node_ptr r) noexcept
+    {
+        if (height(l->right) <= height(r) + 1) {
+            k->left = std::move(l->right);
+            k->right = std::move(r);
+            if (k->left != nullptr) k->left->parent = k.get();
+            if (k->right != nullptr) k->right->parent = k.get();
+            balance(k);
+        }
+        else k = join_right(std::move(l->right), std::move(k), std::move(r));
+        
+        l->right = std::move(k);
+        l->right->parent = l.get();
+        balance(l);
+        
+        return l;
+    }
+    
+    node_ptr join_left(node_ptr l, node_ptr k, node_ptr r) noexcept
+    {
+        if (height(r->left) <= height(l) + 1) {
+            k->left = std::move(l);
+            k->right = std::move(r->left);
+            if (k->left != nullptr) k->left->parent = k.get();
+            if (k->right != nullptr) k->right->parent = k.get();
+            balance(k);
+        }
+        else k = join_left(std::move(l), std::move(k), std::move(r->left));
+        
+        r->left = std::move(k);
+        r->left->parent = r.get();
+        balance(r);
+        
+        return r;
+    }
+    
+    // join without a middle node: the largest one of l takes that role
+    node_ptr join2(node_ptr l, node_ptr r) noexcept
+    {
+        if (l == nullptr) return r;
+        
+        node_ptr k = extract_max(l);
+        return join_util(std::move(l), std::move(k), std::move(r));
+    }
+    
+    node_ptr extract_max(node_ptr& t) noexcept
+    {
+        if (t->right == nullptr) {
+            node_ptr k {std::move(t)};
+            t = std::move(k->left);
+            if (t != nullptr) t->parent = k->parent;
+            k->height = 0;
+            update_size(*k);
+            return k;
+        }
+        
+        node_ptr k = extract_max(t->right);
+        balance(t);
+        return k;
+    }
+    
+    // Sort iterators to the new pairs keeping the first of equal keys
+    template<typename Iter>
+    void sort_batch(std::vector<Iter>& items)
+    {
+        auto less = [&](const Iter& a, const Iter& b) { return comp(a->first, b->first); };
+        auto same = [&](const Iter& a, const Iter& b) { return !comp(a->first, b->first); };
+        
+        std::stable_sort(items.begin(), items.end(), less);
+        items.erase(std::unique(items.begin(), items.end(), same), items.end());
+    }
+    
+    // Flag in present the elements of the sorted [first, last) already under t
+    template<typename Iter>
+    void find_sorted(const Node* t, Iter* first, Iter* last, Iter* base, std::vector<char>& present) const
+    {
+        if (t == nullptr || first == last) return;
+        
+        auto mid = std::lower_bound(first, last, t->key(),
+                                    [&](const Iter& i, const Key& x) { return comp(i->first, x); });
+        auto after = mid;
+        
+        if (mid != last && !comp(t->key(), (*mid)->first)) {
+            present[static_cast<std::size_t>(mid - base)] = 1;
+            ++after;
+        }
+        
+        find_sorted(t->left.get(), first, mid, base, present);
+        find_sorted(t->right.get(), after, last, base, present);
+    }
+    
+    // Balanced tree out of n sorted lone nodes, no allocation
+    node_ptr link_sorted(node_ptr* first, std::size_t n) noexcept
+    {
+        if (n == 0) return nullptr;
+        
+        std::size_t half = (n - 1) / 2;
+        node_ptr t {std::move(first[half])};
+        
+        t->left = link_sorted(first, half);
+        t->right = link_sorted(first + half + 1, n - 1 - half);
+        if (t->left != nullptr) t->left->parent = t.get();
+        if (t->right != nullptr) t->right->parent = t.get();
+        balance(t);
+        
+        return t;
+    }
+    
+    // Merge sorted lone nodes into t, those with keys already there are dropped
+    node_ptr insert_sorted(node_ptr t, node_ptr* first, node_ptr* last, std::size_t& added) noexcept
+    {
+        if (first == last) return t;
+        
+        if (t == nullptr) {
+            added += static_cast<std::size_t>(last - first);
+            return link_sorted(first, static_cast<std::size_t>(last - first));
+        }
+        
+        node_ptr l, r;
+        unlink(*t, l, r);
+        
+        auto mid = std::lower_bound(first, last, t->key(), 
+                                    [&](const node_ptr& n, const Key& x) { return comp(n->key(), x); });
+        auto after = mid;
+        
+        if (mid != last && !comp(t->key(), (*mid)->key())) { // duplicate key
+            mid->reset();
+            ++after;
+        }
+        
+        l = insert_sorted(std::move(l), first, mid, added);
+        r = insert_sorted(std::move(r), after, last, added);
+        
+        return join_util(std::move(l), std::move(t), std::move(r));
+    }
+    
+    // Drop from t every key found in the sorted range [first, last)
+    template<typename Iter>
+    node_ptr erase_sorted(node_ptr t, Iter first, Iter last, std::size_t& dropped) noexcept
+    {
+        if (t == nullptr || first == last) return t;
+        
+        node_ptr l, r;
+        unlink(*t, l, r);
+        
+        auto mid = std::lower_bound(first, last, t->key(), comp);
+        bool found = (mid != last && !comp(t->key(), *mid));
+        
+        l = erase_sorted(std::move(l), first, mid, dropped);
+        r = erase_sorted(std::move(r), found ? std::next(mid) : mid, last, dropped);
+        
+        if (found) {
+            t.reset();
+            ++dropped;
+            return join2(std::move(l), std::move(r));
+        }
+        
+        return join_util(std::move(l), std::move(t), std::move(r));
+    }
+    
+    // Find smallest elem in a tree
+    Node* findMin(const node_ptr& node) const noexcept
+    {
+        auto t = node.get();
+
+        if(t != nullptr)
+            while (t->left != nullptr)
+                t = t->left.get();
+
+        return t;
+    }
+    
+    // Find largest elem in a tree
+    Node* findMax(const node_ptr& node) const noexcept
+    {
+        auto t = node.get();
+
+        if(t != nullptr)
+            while (t->right != nullptr)
+                t = t->right.get();
+
+        return t;
+    }
+    
+    // In order successor of t, nullptr past the largest one
+    template<typename N>
+    static N* next(N* t) noexcept
+    {
+        if (t->right != nullptr) {
+            t = t->right.get();
+            while (t->left != nullptr) t = t->left.get();
+            return t;
+        }
+        
+        while (t->parent != nullptr && t == t->parent->right.get())
+            t = t->parent;
+            
+        return t->parent;
+    }
+    
+    // In order predecessor of t, nullptr before the smallest one
+    template<typename N>
+    static N* prev(N* t) noexcept
+    {
+        if (t->left != nullptr) {
+            t = t->left.get();
+            while (t->right != nullptr) t = t->right.get();
+            return t;
+        }
+        
+        while (t->parent != nullptr && t == t->parent->left.get())
+            t = t->parent;
+            
+        return t->parent;
+    }
+    
+    // Internal method to re-balance the tree
+    void balance(node_ptr& t) noexcept
+    {
+        static const int ALLOWED_IMBALANCE = 1;
+        
+        if(t == nullptr) return;
+        
+        if(height(t->left) - height(t->right) > ALLOWED_IMBALANCE) {
+            if(height(t->left->left) >= height(t->left->right)) {
+                rotateWithLeftChild(t);
+                this->count_rotation(&AvlStats::rotate_with_left_child);
+            }
+            else {
+                doubleWithLeftChild(t);
+                this->count_rotation(&AvlStats::double_with_left_child);
+            }
+        }
         else if(height(t->right) - height(t->left) > ALLOWED_IMBALANCE) {
-            if(height(t->right->right) >= height(t->right->left))
+            if(height(t->right->right) >= height(t->right->left)) {
                 rotateWithRightChild(t);
-            else
+                this->count_rotation(&AvlStats::rotate_with_right_child);
+            }
+            else {
                 doubleWithRightChild(t);
+                this->count_rotation(&AvlStats::double_with_right_child);
+            }
         }
         
         t->height = std::max(height(t->left), height(t->right)) + 1;
+        update_size(*t);
     }
     
     // Rotations block
@@ -352,12 +2037,17 @@ private:
      * For AVL trees, this is a single rotation for case 1.
      * Update heights, then set new root.
      */
-    void rotateWithLeftChild(std::unique_ptr<Node>& k2) noexcept
+    void rotateWithLeftChild(node_ptr& k2) noexcept
     {
         auto k1 = std::move(k2->left);
         k2->left = std::move(k1->right);
+        if (k2->left != nullptr) k2->left->parent = k2.get();
+        k1->parent = k2->parent;
+        k2->parent = k1.get();
         k2->height = std::max(height(k2->left), height(k2->right)) + 1;
         k1->height = std::max(height(k1->left), k2->height) + 1;
+        k1->set_subtree_size(k2->subtree_size());
+        update_size(*k2);
         k1->right = std::move(k2);
         k2 = std::move(k1);
     }
@@ -367,12 +2057,17 @@ private:
      * For AVL trees, this is a single rotation for case 4.
      * Update heights, then set new root.
      */
-    void rotateWithRightChild(std::unique_ptr<Node>& k1) noexcept
+    void rotateWithRightChild(node_ptr& k1) noexcept
     {
         auto k2 = std::move(k1->right);
         k1->right = std::move(k2->left);
+        if (k1->right != nullptr) k1->right->parent = k1.get();
+        k2->parent = k1->parent;
+        k1->parent = k2.get();
         k1->height = std::max(height(k1->left), height(k1->right)) + 1;
         k2->height = std::max(height(k2->right), k1->height) + 1;
+        k2->set_subtree_size(k1->subtree_size());
+        update_size(*k1);
         k2->left = std::move(k1);
         k1 = std::move(k2);
     }
@@ -383,7 +2078,7 @@ private:
      * For AVL trees, this is a double rotation for case 2.
      * Update heights, then set new root.
      */
-    void doubleWithLeftChild(std::unique_ptr<Node>& k3) noexcept
+    void doubleWithLeftChild(node_ptr& k3) noexcept
     {
         rotateWithRightChild(k3->left);
         rotateWithLeftChild(k3);
@@ -395,7 +2090,7 @@ private:
      * For AVL trees, this is a double rotation for case 3.
      * Update heights, then set new root.
      */
-    void doubleWithRightChild(std::unique_ptr<Node>& k1) noexcept
+    void doubleWithRightChild(node_ptr& k1) noexcept
     {
         rotateWithLeftChild(k1->right);
         rotateWithRightChild(k1);
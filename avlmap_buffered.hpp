@@ -0,0 +1,238 @@
+#ifndef AVL_MAP_BUFFERED_HEADER_HPP
+#define AVL_MAP_BUFFERED_HEADER_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+#include "avlmap.hpp"
+
+namespace Homebrew {
+
+/**
+ * AvlMap for write bursts: writes land in a small buffer tree, one pending
+ * operation per key, and reach the main tree in key order once the buffer
+ * is full. Applying them in order with the previous one as hint turns
+ * each descent into a short finger walk over the part of the tree just
+ * visited, so the main tree is updated at a fraction of the cache misses.
+ * The buffer nodes come from a NodePool and are dropped at once.
+ * Point lookups check the buffer then the tree; size(), iteration and
+ * the flushed() view apply the pending writes first.
+ * Value must be default constructible, erases are buffered as tombstones.
+ * Flushing changes the map from const calls too (empty(), size(),
+ * begin(), end(), flushed(), print()), so unlike the standard containers
+ * const access from several threads at once needs a lock as well.
+ */
+template<typename Key,
+         typename Value,
+         typename Compare = std::less<Key>,
+         typename Alloc = std::allocator<std::pair<const Key, Value>>>
+class BufferedAvlMap {
+public:
+    using map_type = AvlMap<Key, Value, Compare, Alloc>;
+
+private:
+    // What a pending write does to the tree
+    enum class Op : unsigned char {
+        insert, // add unless the key is there
+        assign, // add or overwrite
+        erase   // drop if there
+    };
+
+    struct Pending {
+        Value value;
+        Op op;
+
+        template<typename V>
+        Pending(V&& v, Op o) : value(std::forward<V>(v)), op{o} {}
+    };
+
+    using buffer_type = AvlMap<Key, Pending, Compare,
+                               NodePool<std::pair<const Key, Pending>>>;
+
+    // mutable: flushing changes the layout, never the contents
+    mutable map_type tree;
+    mutable buffer_type buffer;
+
+    std::size_t capacity;
+
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using value_type = std::pair<const Key, Value>;
+    using key_compare = Compare;
+    using const_iterator = typename map_type::const_iterator;
+
+    static constexpr std::size_t DEFAULT_CAPACITY = 1 << 16;
+
+    // constructors block
+    explicit BufferedAvlMap(std::size_t cap = DEFAULT_CAPACITY, const Compare& c = Compare())
+        : tree{c}, buffer{c}, capacity{std::max<std::size_t>(cap, 1)} {}
+
+    // Member functions block
+    inline bool empty() const
+    {
+        return size() == 0;
+    }
+
+    std::size_t size() const
+    {
+        flush();
+        return tree.size();
+    }
+
+    // Writes not yet in the tree
+    std::size_t pending() const noexcept
+    {
+        return buffer.size();
+    }
+
+    std::size_t buffer_capacity() const noexcept
+    {
+        return capacity;
+    }
+
+    key_compare key_comp() const
+    {
+        return tree.key_comp();
+    }
+
+    // does nothing if k is already there
+    template<typename K = Key,
+             typename V = Value>
+    void insert(K&& k, V&& v)
+    {
+        auto res = buffer.try_emplace(std::forward<K>(k), std::forward<V>(v), Op::insert);
+
+        // an erased key comes back, otherwise it is there already
+        if (!res.second && res.first->second.op == Op::erase)
+            res.first->second = Pending(std::forward<V>(v), Op::assign);
+
+        written();
+    }
+
+    // Insert, or assign to the mapped value if k is already there
+    template<typename K = Key,
+             typename V = Value>
+    void insert_or_assign(K&& k, V&& v)
+    {
+        buffer.insert_or_assign(std::forward<K>(k), Pending(std::forward<V>(v), Op::assign));
+        written();
+    }
+
+    void erase(const Key& k)
+    {
+        buffer.insert_or_assign(k, Pending(Value(), Op::erase));
+        written();
+    }
+
+    // Check if conatiner has an specific key
+    bool search(const Key& x) const
+    {
+        return find(x) != nullptr;
+    }
+
+    // pointer to the value of x, nullptr if x is not there; any write may move it
+    const Value* find(const Key& x) const
+    {
+        auto b = buffer.find(x);
+        bool buffered = (b != buffer.end());
+
+        if (buffered && b->second.op != Op::insert)
+            return b->second.op == Op::assign ? &b->second.value : nullptr;
+
+        auto t = tree.find(x);
+        if (t != tree.end()) return &t->second;
+        return buffered ? &b->second.value : nullptr;
+    }
+
+    // access specified elem with checking
+    const Value& at(const Key& x) const
+    {
+        auto v = find(x);
+        if (v == nullptr) throw std::out_of_range("Elem not found error");
+        return *v;
+    }
+
+    /**
+     * Apply the buffered writes to the tree, in key order, each one hinted
+     * by the element of the previous one. Erases relink nodes, so that
+     * hint stays valid across them. If a write throws, the ones applied
+     * before it leave the buffer and the rest stay pending.
+     */
+    void flush() const
+    {
+        if (buffer.empty()) return;
+
+        auto hint = tree.end();
+        auto it = buffer.begin();
+
+        try {
+            for (; it != buffer.end(); ++it) {
+                Pending& p = it->second;
+
+                if (p.op == Op::erase) {
+                    tree.erase(it->first);
+                    continue;
+                }
+
+                auto before = tree.size();
+                hint = tree.insert(hint, it->first, std::move(p.value));
+
+                // the value is only moved from when the key was new
+                if (p.op == Op::assign && tree.size() == before) hint->second = std::move(p.value);
+            }
+        }
+        catch (...) {
+            // their values are moved out, applying them again would be wrong
+            while (buffer.begin() != it) buffer.extract(buffer.begin());
+            throw;
+        }
+
+        buffer.clear();
+    }
+
+    // Up to date tree, for everything else AvlMap offers
+    const map_type& flushed() const
+    {
+        flush();
+        return tree;
+    }
+
+    // Iterators block, they stay valid until the next write
+    const_iterator begin() const
+    {
+        return flushed().begin();
+    }
+
+    const_iterator end() const
+    {
+        return flushed().end();
+    }
+
+    void clear() noexcept
+    {
+        buffer.clear();
+        tree.clear();
+    }
+
+    void print() const
+    {
+        flushed().print();
+    }
+
+private:
+    void written()
+    {
+        if (buffer.size() >= capacity) flush();
+    }
+
+}; // end of class BufferedAvlMap
+
+} // end of namespace Homebrew
+
+#endif // AVL_MAP_BUFFERED_HEADER_HPP
@@ -0,0 +1,872 @@
+#ifndef AVL_MAP_COMPACT_HEADER_HPP
+#define AVL_MAP_COMPACT_HEADER_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "avlcommon.hpp"
+
+namespace Homebrew {
+
+/**
+ * Compact storage flavour of AvlMap.
+ * Nodes live in a single contiguous array and refer to each other by
+ * 32-bit indices; instead of a height every node keeps its balance factor
+ * in 2 bits packed next to the parent index. For <int,int> a node is 20
+ * bytes against 40 for AvlMap. At most 2^30 - 1 elements.
+ * Iterators hold indices, so they survive the array growing; growing does
+ * copy the keys, as with a std::vector of pairs. Use reserve() to avoid it.
+ */
+template<typename Key,
+         typename Value,
+         typename Compare = std::less<Key>>
+class CompactAvlMap {
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using value_type = std::pair<const Key, Value>;
+    using key_compare = Compare;
+
+private:
+    using index = std::uint32_t;
+
+    // slot 0 is never used, it stands for the null link
+    static constexpr index NIL = 0;
+    static constexpr index MAX_NODES = (index(1) << 30) - 1;
+    static constexpr index FREE = 3; // balance code of an unused slot
+
+    // node of the tree, 3 words of structure around the element
+    struct Node {
+        index left;
+        index right;
+        index link; // parent index in the low 30 bits, balance + 1 on top
+        union {
+            value_type data; // alive only while the slot is in use
+        };
+
+        Node() noexcept {}
+        ~Node() {}
+
+        index parent() const noexcept { return link & MAX_NODES; }
+        int balance() const noexcept { return static_cast<int>(link >> 30) - 1; }
+        bool unused() const noexcept { return (link >> 30) == FREE; }
+
+        void set_parent(index p) noexcept { link = (link & ~MAX_NODES) | p; }
+        void set_balance(int b) noexcept
+        {
+            link = (link & MAX_NODES) | (static_cast<index>(b + 1) << 30);
+        }
+    };
+
+    std::unique_ptr<Node[]> nodes;
+    index cap;       // slots allocated
+    index top;       // slots ever handed out, [1, top)
+    index free_head; // released slots, chained through left
+    index root;
+
+    // Number of elements
+    std::size_t sz;
+
+    // Ordering of the keys
+    Compare comp;
+
+    // Lookups with other types than Key need a transparent comparator
+    template<typename K>
+    using enable_transparent = std::enable_if_t<detail::is_transparent<Compare>::value, K>;
+
+public:
+    /**
+     * Bidirectional iterator, walks the tree in order through the parent
+     * links. Keeps an index, not an address, into the node array.
+     */
+    template<bool Const>
+    class Iterator {
+        friend class CompactAvlMap;
+        template<bool> friend class Iterator;
+
+        using map_type = std::conditional_t<Const, const CompactAvlMap, CompactAvlMap>;
+
+        map_type* map;
+        index i;
+
+        Iterator(map_type* m, index n) noexcept
+            : map{m}, i{n} {}
+
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = std::pair<const Key, Value>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<Const, const value_type*, value_type*>;
+        using reference = std::conditional_t<Const, const value_type&, value_type&>;
+
+        Iterator() noexcept : map{nullptr}, i{NIL} {}
+
+        // iterator -> const_iterator
+        template<bool C, typename = std::enable_if_t<Const && !C>>
+        Iterator(const Iterator<C>& other) noexcept
+            : map{other.map}, i{other.i} {}
+
+        reference operator*() const noexcept { return map->nodes[i].data; }
+        pointer operator->() const noexcept { return &map->nodes[i].data; }
+
+        Iterator& operator++() noexcept
+        {
+            i = map->next(i);
+            return *this;
+        }
+
+        Iterator operator++(int) noexcept
+        {
+            auto tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        Iterator& operator--() noexcept
+        {
+            i = (i == NIL) ? map->findMax(map->root) : map->prev(i);
+            return *this;
+        }
+
+        Iterator operator--(int) noexcept
+        {
+            auto tmp = *this;
+            --*this;
+            return tmp;
+        }
+
+        template<bool C>
+        bool operator==(const Iterator<C>& other) const noexcept
+        {
+            return i == other.i;
+        }
+
+        template<bool C>
+        bool operator!=(const Iterator<C>& other) const noexcept
+        {
+            return i != other.i;
+        }
+    };
+
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    // constructors block
+    CompactAvlMap()
+        : nodes{nullptr}, cap{0}, top{1}, free_head{NIL}, root{NIL}, sz{0}, comp{} {}
+
+    explicit CompactAvlMap(const Compare& c)
+        : nodes{nullptr}, cap{0}, top{1}, free_head{NIL}, root{NIL}, sz{0}, comp{c} {}
+
+    CompactAvlMap(const CompactAvlMap& other)
+        : CompactAvlMap(other.comp)
+    {
+        if (other.top == 1) return;
+
+        // same slots at the same indices, so the links are copied as they are
+        nodes.reset(new Node[other.top]);
+        cap = other.top;
+
+        for (index i = 1; i < other.top; ++i) {
+            const Node& src = other.nodes[i];
+            Node& dst = nodes[i];
+
+            if (!src.unused()) ::new (static_cast<void*>(&dst.data)) value_type(src.data);
+
+            dst.left = src.left;
+            dst.right = src.right;
+            dst.link = src.link;
+            top = i + 1;
+        }
+
+        free_head = other.free_head;
+        root = other.root;
+        sz = other.sz;
+    }
+
+    CompactAvlMap& operator=(const CompactAvlMap& other)
+    {
+        // copy and swap idiom
+        CompactAvlMap tmp (other);
+        swap(tmp);
+        return *this;
+    }
+
+    CompactAvlMap(CompactAvlMap&& other) noexcept
+        : CompactAvlMap()
+    {
+        swap(other);
+    }
+
+    CompactAvlMap& operator=(CompactAvlMap&& other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    ~CompactAvlMap() noexcept
+    {
+        clear();
+    }
+
+    template<typename Iter>
+    CompactAvlMap(Iter first, Iter last)
+        : CompactAvlMap()
+    {
+        for (auto it = first; it != last; std::advance(it, 1)) {
+            insert(it->first, it->second);
+        }
+    }
+
+    CompactAvlMap(const std::initializer_list<std::pair<const Key, Value>>& lst)
+        : CompactAvlMap(std::begin(lst), std::end(lst)) {}
+
+    // Member functions block
+    void swap(CompactAvlMap& other) noexcept
+    {
+        std::swap(nodes, other.nodes);
+        std::swap(cap, other.cap);
+        std::swap(top, other.top);
+        std::swap(free_head, other.free_head);
+        std::swap(root, other.root);
+        std::swap(sz, other.sz);
+        std::swap(comp, other.comp);
+    }
+
+    // Destroys the elements but keeps the node array for reuse
+    void clear() noexcept
+    {
+        for (index i = 1; i < top; ++i)
+            if (!nodes[i].unused()) nodes[i].data.~value_type();
+
+        top = 1;
+        free_head = NIL;
+        root = NIL;
+        sz = 0;
+    }
+
+    inline bool empty() const noexcept
+    {
+        return sz == 0;
+    }
+
+    inline const std::size_t& size() const noexcept
+    {
+        return sz;
+    }
+
+    key_compare key_comp() const
+    {
+        return comp;
+    }
+
+    // Make room for n elements without moving the node array again
+    void reserve(std::size_t n)
+    {
+        if (n > MAX_NODES) throw std::length_error("CompactAvlMap is full");
+        if (n + 1 > cap) grow(static_cast<index>(n + 1));
+    }
+
+    // does nothing if k is already there
+    template<typename K = Key,
+             typename V = Value>
+    std::pair<iterator, bool> insert(K&& k, V&& v)
+    {
+        return try_emplace(std::forward<K>(k), std::forward<V>(v));
+    }
+
+    // Insert a value built from args only if k is absent
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& k, Args&&... args)
+    {
+        auto res = insert_util(k, [&](index parent) {
+            return create_node(parent,
+                               std::piecewise_construct,
+                               std::forward_as_tuple(k),
+                               std::forward_as_tuple(std::forward<Args>(args)...));
+        });
+
+        return {iterator(this, res.first), res.second};
+    }
+
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& k, Args&&... args)
+    {
+        auto res = insert_util(k, [&](index parent) {
+            return create_node(parent,
+                               std::piecewise_construct,
+                               std::forward_as_tuple(std::move(k)),
+                               std::forward_as_tuple(std::forward<Args>(args)...));
+        });
+
+        return {iterator(this, res.first), res.second};
+    }
+
+    // Insert, or assign to the mapped value if k is already there
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& k, M&& obj)
+    {
+        auto res = try_emplace(k, std::forward<M>(obj));
+        if (!res.second) res.first->second = std::forward<M>(obj);
+        return res;
+    }
+
+    void erase(const Key& k) noexcept
+    {
+        index d = find_index(k);
+        if (d != NIL) remove_util(d);
+    }
+
+    /**
+     * Stream the map to os as "{(k, v), ...}", each pair written by
+     * fmt(OutputBuffer&, const value_type&). Output goes through a fixed
+     * buffer in large blocks.
+     */
+    template<typename F = TextFormat>
+    void write_to(std::ostream& os, F fmt = F()) const
+    {
+        auto walk = [this](auto& one) {
+            for (const auto& kv: *this) one(kv);
+        };
+        detail::write_list(os, walk, fmt);
+    }
+
+    void print() const
+    {
+        write_to(std::cout);
+    }
+
+    //access or insert specified element
+    Value& operator[](const Key& k)
+    {
+        return try_emplace(k).first->second;
+    }
+
+    Value& operator[](Key&& k)
+    {
+        return try_emplace(std::move(k)).first->second;
+    }
+
+    // access specified elem with checking
+    Value& at(const Key& k)
+    {
+        index i = find_index(k);
+        if (i == NIL) throw std::out_of_range("Elem not found error");
+        return nodes[i].data.second;
+    }
+
+    const Value& at(const Key& k) const
+    {
+        index i = find_index(k);
+        if (i == NIL) throw std::out_of_range("Elem not found error");
+        return nodes[i].data.second;
+    }
+
+    template<typename K, typename = enable_transparent<K>>
+    const Value& at(const K& k) const
+    {
+        index i = find_index(k);
+        if (i == NIL) throw std::out_of_range("Elem not found error");
+        return nodes[i].data.second;
+    }
+
+    // Check if conatiner has an specific key
+    bool search(const Key& x) const noexcept
+    {
+        return find_index(x) != NIL;
+    }
+
+    template<typename K, typename = enable_transparent<K>>
+    bool search(const K& x) const noexcept
+    {
+        return find_index(x) != NIL;
+    }
+
+    // iterator to the element with key x, end() if there is none
+    iterator find(const Key& x) noexcept
+    {
+        return iterator(this, find_index(x));
+    }
+
+    const_iterator find(const Key& x) const noexcept
+    {
+        return const_iterator(this, find_index(x));
+    }
+
+    template<typename K, typename = enable_transparent<K>>
+    const_iterator find(const K& x) const noexcept
+    {
+        return const_iterator(this, find_index(x));
+    }
+
+    // Iterators block
+    iterator begin() noexcept { return iterator(this, findMin(root)); }
+    const_iterator begin() const noexcept { return const_iterator(this, findMin(root)); }
+    iterator end() noexcept { return iterator(this, NIL); }
+    const_iterator end() const noexcept { return const_iterator(this, NIL); }
+
+    const_iterator cbegin() const noexcept { return begin(); }
+    const_iterator cend() const noexcept { return end(); }
+
+    reverse_iterator rbegin() noexcept { return reverse_iterator(end()); }
+    reverse_iterator rend() noexcept { return reverse_iterator(begin()); }
+    const_reverse_iterator rbegin() const noexcept { return const_reverse_iterator(end()); }
+    const_reverse_iterator rend() const noexcept { return const_reverse_iterator(begin()); }
+
+private:
+    const Key& key(index i) const noexcept
+    {
+        return nodes[i].data.first;
+    }
+
+    // Storage block
+
+    void grow(index new_cap)
+    {
+        std::unique_ptr<Node[]> fresh {new Node[new_cap]};
+        index i = 1;
+
+        try {
+            for (; i < top; ++i) {
+                Node& src = nodes[i];
+                Node& dst = fresh[i];
+
+                if (!src.unused())
+                    ::new (static_cast<void*>(&dst.data)) value_type(std::move_if_noexcept(src.data));
+
+                dst.left = src.left;
+                dst.right = src.right;
+                dst.link = src.link;
+            }
+        }
+        catch (...) {
+            while (--i > 0)
+                if (!fresh[i].unused()) fresh[i].data.~value_type();
+            throw;
+        }
+
+        for (i = 1; i < top; ++i)
+            if (!nodes[i].unused()) nodes[i].data.~value_type();
+
+        nodes = std::move(fresh);
+        cap = new_cap;
+    }
+
+    // Hand out a slot, may move the whole node array
+    index new_slot()
+    {
+        if (free_head != NIL) {
+            index i = free_head;
+            free_head = nodes[i].left;
+            return i;
+        }
+
+        if (top >= cap) {
+            auto wanted = std::max<std::size_t>(16, std::size_t(cap) * 2);
+            grow(static_cast<index>(std::min<std::size_t>(wanted, std::size_t(MAX_NODES) + 1)));
+        }
+
+        return top++;
+    }
+
+    // True when new_slot() is about to move the node array
+    bool full() const noexcept
+    {
+        return free_head == NIL && top >= cap;
+    }
+
+    void release_slot(index i) noexcept
+    {
+        nodes[i].link = FREE << 30;
+        nodes[i].left = free_head;
+        free_head = i;
+    }
+
+    template<typename... Args>
+    index create_node(index parent, Args&&... args)
+    {
+        if (sz == MAX_NODES) throw std::length_error("CompactAvlMap is full");
+
+        // args may refer into the array: build the element before it moves
+        if (full()) return place_node(parent, value_type(std::forward<Args>(args)...));
+        return place_node(parent, std::forward<Args>(args)...);
+    }
+
+    template<typename... Args>
+    index place_node(index parent, Args&&... args)
+    {
+        index n = new_slot();
+
+        try {
+            ::new (static_cast<void*>(&nodes[n].data)) value_type(std::forward<Args>(args)...);
+        }
+        catch (...) {
+            release_slot(n);
+            throw;
+        }
+
+        nodes[n].left = NIL;
+        nodes[n].right = NIL;
+        nodes[n].link = parent;
+        nodes[n].set_balance(0);
+
+        return n;
+    }
+
+    // Navigation block
+
+    template<typename K>
+    index find_index(const K& x) const noexcept
+    {
+        index t = root;
+
+        while (t != NIL)
+            if (comp(x, key(t)))
+                t = nodes[t].left;
+            else if (comp(key(t), x))
+                t = nodes[t].right;
+            else
+                return t;
+
+        return NIL;
+    }
+
+    index findMin(index t) const noexcept
+    {
+        if (t != NIL)
+            while (nodes[t].left != NIL) t = nodes[t].left;
+        return t;
+    }
+
+    index findMax(index t) const noexcept
+    {
+        if (t != NIL)
+            while (nodes[t].right != NIL) t = nodes[t].right;
+        return t;
+    }
+
+    index next(index t) const noexcept
+    {
+        if (nodes[t].right != NIL) return findMin(nodes[t].right);
+
+        index p = nodes[t].parent();
+        while (p != NIL && t == nodes[p].right) {
+            t = p;
+            p = nodes[t].parent();
+        }
+
+        return p;
+    }
+
+    index prev(index t) const noexcept
+    {
+        if (nodes[t].left != NIL) return findMax(nodes[t].left);
+
+        index p = nodes[t].parent();
+        while (p != NIL && t == nodes[p].left) {
+            t = p;
+            p = nodes[t].parent();
+        }
+
+        return p;
+    }
+
+    // Make n the child of g that used to be old (or the root)
+    void replace_child(index g, index old, index n) noexcept
+    {
+        if (n != NIL) nodes[n].set_parent(g);
+
+        if (g == NIL) root = n;
+        else if (nodes[g].left == old) nodes[g].left = n;
+        else nodes[g].right = n;
+    }
+
+    /**
+     * Iterative insert, single descent looking for k.
+     * make_node(parent) is called only when k is absent.
+     * Returns the index holding k and whether it is new.
+     */
+    template<typename K, typename F>
+    std::pair<index, bool> insert_util(const K& k, F&& make_node)
+    {
+        index parent = NIL;
+        index t = root;
+        bool go_left = false;
+
+        while (t != NIL) {
+            parent = t;
+
+            if (comp(k, key(t))) {
+                t = nodes[t].left;
+                go_left = true;
+            }
+            else if (comp(key(t), k)) {
+                t = nodes[t].right;
+                go_left = false;
+            }
+            else //duplicate key
+                return {t, false};
+        }
+
+        index n = make_node(parent);
+
+        if (parent == NIL) root = n;
+        else if (go_left) nodes[parent].left = n;
+        else nodes[parent].right = n;
+
+        ++sz;
+        retrace_insert(n);
+
+        return {n, true};
+    }
+
+    // Walk up from the new leaf z updating balance factors
+    void retrace_insert(index z) noexcept
+    {
+        for (index x = nodes[z].parent(); x != NIL; z = x, x = nodes[z].parent()) {
+            if (z == nodes[x].right) {
+                if (nodes[x].balance() > 0) { // right side now 2 levels higher
+                    index g = nodes[x].parent();
+                    index n = nodes[z].balance() < 0 ? rotateRightLeft(x, z) :
+                                                       rotateLeft(x, z);
+                    replace_child(g, x, n);
+                    return;
+                }
+                if (nodes[x].balance() < 0) {
+                    nodes[x].set_balance(0);
+                    return;
+                }
+                nodes[x].set_balance(+1);
+            }
+            else {
+                if (nodes[x].balance() < 0) { // left side now 2 levels higher
+                    index g = nodes[x].parent();
+                    index n = nodes[z].balance() > 0 ? rotateLeftRight(x, z) :
+                                                       rotateRight(x, z);
+                    replace_child(g, x, n);
+                    return;
+                }
+                if (nodes[x].balance() > 0) {
+                    nodes[x].set_balance(0);
+                    return;
+                }
+                nodes[x].set_balance(-1);
+            }
+        }
+    }
+
+    // Unlink node d, splicing its successor in when it has two children
+    void remove_util(index d) noexcept
+    {
+        Node& D = nodes[d];
+        index x;         // lowest node whose subtree got shorter
+        bool from_left;  // on which side of x
+
+        if (D.left != NIL && D.right != NIL) { // Two children
+            index s = findMin(D.right);
+
+            if (s == D.right) {
+                x = s;
+                from_left = false;
+            }
+            else {
+                x = nodes[s].parent();
+                from_left = true;
+
+                index r = nodes[s].right;
+                nodes[x].left = r;
+                if (r != NIL) nodes[r].set_parent(x);
+
+                nodes[s].right = D.right;
+                nodes[D.right].set_parent(s);
+            }
+
+            nodes[s].left = D.left;
+            nodes[D.left].set_parent(s);
+            nodes[s].link = D.link; // takes over parent and balance
+            replace_child(D.parent(), d, s);
+        }
+        else { // One child
+            index c = (D.left != NIL) ? D.left : D.right;
+            x = D.parent();
+            from_left = (x != NIL && nodes[x].left == d);
+            replace_child(x, d, c);
+        }
+
+        D.data.~value_type();
+        release_slot(d);
+        --sz;
+
+        retrace_erase(x, from_left);
+    }
+
+    // Walk up from x, whose subtree on one side lost a level
+    void retrace_erase(index x, bool from_left) noexcept
+    {
+        while (x != NIL) {
+            index g = nodes[x].parent();
+            bool g_left = (g != NIL && nodes[g].left == x);
+            index n = x;
+            int b = 1;
+
+            if (from_left) {
+                if (nodes[x].balance() > 0) {
+                    index z = nodes[x].right;
+                    b = nodes[z].balance();
+                    n = b < 0 ? rotateRightLeft(x, z) : rotateLeft(x, z);
+                }
+                else if (nodes[x].balance() == 0) {
+                    nodes[x].set_balance(+1);
+                    return;
+                }
+                else nodes[x].set_balance(0);
+            }
+            else {
+                if (nodes[x].balance() < 0) {
+                    index z = nodes[x].left;
+                    b = nodes[z].balance();
+                    n = b > 0 ? rotateLeftRight(x, z) : rotateRight(x, z);
+                }
+                else if (nodes[x].balance() == 0) {
+                    nodes[x].set_balance(-1);
+                    return;
+                }
+                else nodes[x].set_balance(0);
+            }
+
+            if (n != x) {
+                replace_child(g, x, n);
+                if (b == 0) return; // single rotation kept the height
+            }
+
+            x = g;
+            from_left = g_left;
+        }
+    }
+
+    // Rotations block, x is the unbalanced node and z its taller child
+
+    index rotateLeft(index x, index z) noexcept
+    {
+        index t = nodes[z].left;
+        nodes[x].right = t;
+        if (t != NIL) nodes[t].set_parent(x);
+        nodes[z].left = x;
+        nodes[x].set_parent(z);
+
+        if (nodes[z].balance() == 0) { // only happens on erase
+            nodes[x].set_balance(+1);
+            nodes[z].set_balance(-1);
+        }
+        else {
+            nodes[x].set_balance(0);
+            nodes[z].set_balance(0);
+        }
+
+        return z;
+    }
+
+    index rotateRight(index x, index z) noexcept
+    {
+        index t = nodes[z].right;
+        nodes[x].left = t;
+        if (t != NIL) nodes[t].set_parent(x);
+        nodes[z].right = x;
+        nodes[x].set_parent(z);
+
+        if (nodes[z].balance() == 0) { // only happens on erase
+            nodes[x].set_balance(-1);
+            nodes[z].set_balance(+1);
+        }
+        else {
+            nodes[x].set_balance(0);
+            nodes[z].set_balance(0);
+        }
+
+        return z;
+    }
+
+    index rotateRightLeft(index x, index z) noexcept
+    {
+        index y = nodes[z].left;
+
+        index t3 = nodes[y].right;
+        nodes[z].left = t3;
+        if (t3 != NIL) nodes[t3].set_parent(z);
+        nodes[y].right = z;
+        nodes[z].set_parent(y);
+
+        index t2 = nodes[y].left;
+        nodes[x].right = t2;
+        if (t2 != NIL) nodes[t2].set_parent(x);
+        nodes[y].left = x;
+        nodes[x].set_parent(y);
+
+        if (nodes[y].balance() == 0) {
+            nodes[x].set_balance(0);
+            nodes[z].set_balance(0);
+        }
+        else if (nodes[y].balance() > 0) {
+            nodes[x].set_balance(-1);
+            nodes[z].set_balance(0);
+        }
+        else {
+            nodes[x].set_balance(0);
+            nodes[z].set_balance(+1);
+        }
+        nodes[y].set_balance(0);
+
+        return y;
+    }
+
+    index rotateLeftRight(index x, index z) noexcept
+    {
+        index y = nodes[z].right;
+
+        index t3 = nodes[y].left;
+        nodes[z].right = t3;
+        if (t3 != NIL) nodes[t3].set_parent(z);
+        nodes[y].left = z;
+        nodes[z].set_parent(y);
+
+        index t2 = nodes[y].right;
+        nodes[x].left = t2;
+        if (t2 != NIL) nodes[t2].set_parent(x);
+        nodes[y].right = x;
+        nodes[x].set_parent(y);
+
+        if (nodes[y].balance() == 0) {
+            nodes[x].set_balance(0);
+            nodes[z].set_balance(0);
+        }
+        else if (nodes[y].balance() < 0) {
+            nodes[x].set_balance(+1);
+            nodes[z].set_balance(0);
+        }
+        else {
+            nodes[x].set_balance(0);
+            nodes[z].set_balance(-1);
+        }
+        nodes[y].set_balance(0);
+
+        return y;
+    }
+
+}; // end of class CompactAvlMap
+
+} // end of namespace Homebrew
+
+#endif // AVL_MAP_COMPACT_HEADER_HPP
@@ -0,0 +1,699 @@
+#ifndef AVL_MAP_CONCURRENT_HEADER_HPP
+#define AVL_MAP_CONCURRENT_HEADER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "avlcommon.hpp"
+
+namespace Homebrew {
+
+/**
+ * Thread-safe flavour of AvlMap.
+ * Writers take turns on a mutex and run the usual AVL insert, erase and
+ * rotations. Readers never lock: they walk the tree optimistically and
+ * validate the walk against a sequence counter that writers bump around
+ * rotations and unlinks, retrying if the shape changed under them (a
+ * few failed tries fall back to the mutex).
+ * Published nodes are immutable, assigning a value swaps in a new node,
+ * so readers always see whole pairs. Unlinked nodes are freed once every
+ * reader that might still be walking them is done (a grace period).
+ * The comparator must not throw.
+ */
+template<typename Key,
+         typename Value,
+         typename Compare = std::less<Key>,
+         typename Alloc = std::allocator<std::pair<const Key, Value>>>
+class ConcurrentAvlMap {
+    struct Node;
+
+    // nodes are obtained through the (rebound) allocator, by the writer only
+    using NodeAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<Node>;
+    using NodeTraits = std::allocator_traits<NodeAlloc>;
+    using link = std::atomic<Node*>;
+
+    struct Node {
+        link left;
+        link right;
+        const std::pair<const Key, Value> data; // never changes once published
+        std::int32_t height;                     // only touched by the writer
+
+        template<typename K, typename V>
+        Node(K&& k, V&& v)
+            : left{nullptr},
+              right{nullptr},
+              data{std::forward<K>(k), std::forward<V>(v)},
+              height{0} {}
+    };
+
+    // one cache line each, so readers on different slots don't collide
+    struct alignas(64) ReaderSlot {
+        std::atomic<std::size_t> count {0};
+    };
+
+    // Longest possible search path, AVL height is below 1.44 * log2(n + 2)
+    static constexpr std::size_t MAX_DEPTH = 96;
+
+    // Optimistic tries of a reader before it waits for the writers
+    static constexpr int MAX_TRIES = 8;
+
+    static constexpr std::size_t READER_SLOTS = 32;
+
+    // Unlinked nodes waiting before a grace period is forced
+    static constexpr std::size_t RECLAIM_BATCH = 128;
+
+    link root;
+    std::atomic<std::size_t> sz;
+
+    // odd while the writer is reshaping the tree
+    mutable std::atomic<std::uint64_t> version;
+
+    // readers register on the counters of the current phase
+    mutable ReaderSlot readers[2][READER_SLOTS];
+    mutable std::atomic<unsigned> phase;
+
+    // Writer state
+    mutable std::mutex write_lock;
+    std::vector<Node*> retired;
+    bool changing;
+
+    NodeAlloc alloc;
+    Compare comp;
+
+    // Lookups with other types than Key need a transparent comparator
+    template<typename K>
+    using enable_transparent = std::enable_if_t<detail::is_transparent<Compare>::value, K>;
+
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using value_type = std::pair<const Key, Value>;
+    using key_compare = Compare;
+    using allocator_type = Alloc;
+
+    // constructors block
+    ConcurrentAvlMap()
+        : root{nullptr}, sz{0}, version{0}, phase{0}, changing{false}, alloc{}, comp{} {}
+
+    explicit ConcurrentAvlMap(const Compare& c, const Alloc& a = Alloc())
+        : root{nullptr}, sz{0}, version{0}, phase{0}, changing{false}, alloc{a}, comp{c} {}
+
+    // shared between threads by reference, never copied or moved
+    ConcurrentAvlMap(const ConcurrentAvlMap&) = delete;
+    ConcurrentAvlMap& operator=(const ConcurrentAvlMap&) = delete;
+
+    template<typename Iter>
+    ConcurrentAvlMap(Iter first, Iter last)
+        : ConcurrentAvlMap()
+    {
+        for (auto it = first; it != last; std::advance(it, 1)) {
+            insert(it->first, it->second);
+        }
+    }
+
+    ConcurrentAvlMap(const std::initializer_list<std::pair<const Key, Value>>& lst)
+        : ConcurrentAvlMap(std::begin(lst), std::end(lst)) {}
+
+    // No other thread may be using the map anymore
+    ~ConcurrentAvlMap() noexcept
+    {
+        destroy(root.load(std::memory_order_relaxed));
+        for (Node* n : retired) destroy_node(n);
+    }
+
+    // Member functions block
+    inline bool empty() const noexcept
+    {
+        return size() == 0;
+    }
+
+    std::size_t size() const noexcept
+    {
+        return sz.load(std::memory_order_relaxed);
+    }
+
+    key_compare key_comp() const
+    {
+        return comp;
+    }
+
+    allocator_type get_allocator() const
+    {
+        return allocator_type(alloc);
+    }
+
+    // Readers block, none of these take the lock unless writers keep interfering
+
+    bool search(const Key& x) const
+    {
+        return read(x, [](const Value&) {});
+    }
+
+    template<typename K, typename = enable_transparent<K>>
+    bool search(const K& x) const
+    {
+        return read(x, [](const Value&) {});
+    }
+
+    // copy the value of key x into out, false if there is none
+    bool find(const Key& x, Value& out) const
+    {
+        return read(x, [&](const Value& v) { out = v; });
+    }
+
+    template<typename K, typename = enable_transparent<K>>
+    bool find(const K& x, Value& out) const
+    {
+        return read(x, [&](const Value& v) { out = v; });
+    }
+
+    // copy of the value of key x, with checking
+    Value at(const Key& x) const
+    {
+        Value out {};
+        if (!find(x, out)) throw std::out_of_range("Elem not found error");
+        return out;
+    }
+
+    template<typename K, typename = enable_transparent<K>>
+    Value at(const K& x) const
+    {
+        Value out {};
+        if (!find(x, out)) throw std::out_of_range("Elem not found error");
+        return out;
+    }
+
+    // Call fn on every (key, value) pair in order, writers wait meanwhile
+    template<typename F>
+    void for_each(F&& fn) const
+    {
+        std::lock_guard<std::mutex> lock (write_lock);
+
+        const Node* stack[MAX_DEPTH];
+        std::size_t depth = 0;
+        const Node* t = root.load(std::memory_order_relaxed);
+
+        while (t != nullptr || depth > 0) {
+            while (t != nullptr) {
+                stack[depth++] = t;
+                t = t->left.load(std::memory_order_relaxed);
+            }
+
+            t = stack[--depth];
+            fn(t->data);
+            t = t->right.load(std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Stream the map to os as "{(k, v), ...}", each pair written by
+     * fmt(OutputBuffer&, const value_type&). Output goes through a fixed
+     * buffer in large blocks, writers wait meanwhile.
+     */
+    template<typename F = TextFormat>
+    void write_to(std::ostream& os, F fmt = F()) const
+    {
+        detail::write_list(os, [this](auto& one) { for_each(one); }, fmt);
+    }
+
+    void print() const
+    {
+        write_to(std::cout);
+    }
+
+    // Writers block
+
+    // does nothing if k is already there, true if inserted
+    template<typename K = Key,
+             typename V = Value>
+    bool insert(K&& k, V&& v)
+    {
+        std::lock_guard<std::mutex> lock (write_lock);
+        return insert_util(std::forward<K>(k), std::forward<V>(v), false);
+    }
+
+    // Insert, or give k a new value. True if inserted
+    template<typename K = Key,
+             typename V = Value>
+    bool insert_or_assign(K&& k, V&& v)
+    {
+        std::lock_guard<std::mutex> lock (write_lock);
+        return insert_util(std::forward<K>(k), std::forward<V>(v), true);
+    }
+
+    // true if k was there
+    bool erase(const Key& k)
+    {
+        std::lock_guard<std::mutex> lock (write_lock);
+        return remove_util(k);
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock (write_lock);
+
+        Node* old = root.exchange(nullptr, std::memory_order_release);
+        sz.store(0, std::memory_order_relaxed);
+
+        synchronize();
+        destroy(old);
+        reclaim_now();
+    }
+
+private:
+    // Reader side block
+
+    // slot of the calling thread, spreads the threads over the counters
+    static std::size_t reader_slot() noexcept
+    {
+        static std::atomic<std::size_t> next {0};
+        thread_local std::size_t slot = next.fetch_add(1, std::memory_order_relaxed) % READER_SLOTS;
+        return slot;
+    }
+
+    /**
+     * Registration of a reader, nodes it can reach are not freed meanwhile.
+     * The phase is read again once registered: if a synchronize() flipped
+     * it in between, the counter taken may be one no writer waits on
+     * anymore, so the reader starts over on the new phase.
+     */
+    class ReadScope {
+        std::atomic<std::size_t>* count;
+
+    public:
+        explicit ReadScope(const ConcurrentAvlMap& m) noexcept
+        {
+            std::size_t slot = reader_slot();
+            unsigned p = m.phase.load(std::memory_order_acquire);
+
+            for (;;) {
+                count = &m.readers[p][slot].count;
+                count->fetch_add(1, std::memory_order_seq_cst);
+                // pairs with the fence in synchronize(): either the writer sees
+                // this reader or the reader sees the phase it flipped
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                unsigned now = m.phase.load(std::memory_order_seq_cst);
+                if (now == p) break;
+
+                count->fetch_sub(1, std::memory_order_release);
+                p = now;
+            }
+        }
+
+        ReadScope(const ReadScope&) = delete;
+        ReadScope& operator=(const ReadScope&) = delete;
+
+        ~ReadScope()
+        {
+            count->fetch_sub(1, std::memory_order_release);
+        }
+    };
+
+    // binary search, gives up after MAX_DEPTH steps (only while reshaping)
+    template<typename K>
+    const Node* lookup(const K& x) const noexcept
+    {
+        const Node* t = root.load(std::memory_order_acquire);
+
+        for (std::size_t steps = 0; t != nullptr && steps < MAX_DEPTH; ++steps)
+            if (comp(x, t->data.first))
+                t = t->left.load(std::memory_order_acquire);
+            else if (comp(t->data.first, x))
+                t = t->right.load(std::memory_order_acquire);
+            else
+                return t;
+
+        return nullptr;
+    }
+
+    /**
+     * Optimistic read: look x up and pass its value to fn, then check no
+     * reshaping started or ended meanwhile. fn may run for failed tries.
+     */
+    template<typename K, typename F>
+    bool read(const K& x, F&& fn) const
+    {
+        {
+            ReadScope scope (*this);
+
+            for (int tries = 0; tries < MAX_TRIES; ++tries) {
+                auto v = version.load(std::memory_order_acquire);
+
+                if (v & 1) {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                const Node* n = lookup(x);
+                if (n != nullptr) fn(n->data.second);
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (version.load(std::memory_order_relaxed) == v) return n != nullptr;
+            }
+        }
+
+        // too many writes going on, wait for a turn
+        std::lock_guard<std::mutex> lock (write_lock);
+
+        const Node* n = lookup(x);
+        if (n != nullptr) fn(n->data.second);
+        return n != nullptr;
+    }
+
+    // Writer side block, everything below runs with write_lock held
+
+    // readers walking concurrently have to validate from here on
+    void begin_change() noexcept
+    {
+        if (changing) return;
+
+        version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        changing = true;
+    }
+
+    void end_change() noexcept
+    {
+        if (!changing) return;
+
+        version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        changing = false;
+    }
+
+    /**
+     * Wait until no reader can still be walking a node unlinked before the
+     * call. New readers go to the other phase, so the old one drains.
+     */
+    void synchronize() const noexcept
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        unsigned old = phase.load(std::memory_order_relaxed);
+        phase.store(old ^ 1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        for (auto& slot : readers[old])
+            while (slot.count.load(std::memory_order_acquire) != 0)
+                std::this_thread::yield();
+    }
+
+    // Free the unlinked node later, readers may still be on it
+    void retire(Node* n)
+    {
+        try {
+            retired.push_back(n);
+        }
+        catch (...) {
+            synchronize();
+            destroy_node(n);
+            return;
+        }
+
+        if (retired.size() >= RECLAIM_BATCH) {
+            synchronize();
+            reclaim_now();
+        }
+    }
+
+    void reclaim_now() noexcept
+    {
+        for (Node* n : retired) destroy_node(n);
+        retired.clear();
+    }
+
+    template<typename... Args>
+    Node* create_node(Args&&... args)
+    {
+        Node* p = NodeTraits::allocate(alloc, 1);
+
+        try {
+            NodeTraits::construct(alloc, p, std::forward<Args>(args)...);
+        }
+        catch (...) {
+            NodeTraits::deallocate(alloc, p, 1);
+            throw;
+        }
+
+        return p;
+    }
+
+    void destroy_node(Node* p) noexcept
+    {
+        NodeTraits::destroy(alloc, p);
+        NodeTraits::deallocate(alloc, p, 1);
+    }
+
+    // Iterative teardown, left children are rotated into the right spine
+    void destroy(Node* t) noexcept
+    {
+        while (t != nullptr) {
+            Node* l = t->left.load(std::memory_order_relaxed);
+
+            if (l != nullptr) {
+                t->left.store(l->right.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                l->right.store(t, std::memory_order_relaxed);
+                t = l;
+            }
+            else {
+                Node* r = t->right.load(std::memory_order_relaxed);
+                destroy_node(t);
+                t = r;
+            }
+        }
+    }
+
+    // Returns height of a node
+    static std::int32_t height(const link& l) noexcept
+    {
+        Node* n = l.load(std::memory_order_relaxed);
+        return n == nullptr ? -1 : n->height;
+    }
+
+    /**
+     * Iterative insert method, the search path is recorded in a stack of
+     * links and retraced bottom-up while subtree heights keep changing.
+     * A new leaf is published with a single store, no reshaping needed.
+     */
+    template<typename K, typename V>
+    bool insert_util(K&& k, V&& v, bool assign)
+    {
+        link* path[MAX_DEPTH];
+        std::size_t depth = 0;
+        link* slot = &root;
+
+        while (Node* n = slot->load(std::memory_order_relaxed)) {
+            if (comp(k, n->data.first)) {
+                path[depth++] = slot;
+                slot = &n->left;
+            }
+            else if (comp(n->data.first, k)) {
+                path[depth++] = slot;
+                slot = &n->right;
+            }
+            else { //duplicate key
+                if (!assign) return false;
+
+                // same links, new pair; readers on the old node still see valid ones
+                Node* m = create_node(n->data.first, std::forward<V>(v));
+                m->left.store(n->left.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                m->right.store(n->right.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                m->height = n->height;
+                slot->store(m, std::memory_order_release);
+                retire(n);
+                return false;
+            }
+        }
+
+        slot->store(create_node(std::forward<K>(k), std::forward<V>(v)), std::memory_order_release);
+        sz.fetch_add(1, std::memory_order_relaxed);
+
+        retrace(path, depth);
+        end_change();
+        return true;
+    }
+
+    // Iterative delete method, splices the successor node in for two children
+    bool remove_util(const Key& x)
+    {
+        link* path[MAX_DEPTH];
+        std::size_t depth = 0;
+        link* slot = &root;
+        Node* d;
+
+        while ((d = slot->load(std::memory_order_relaxed)) != nullptr) {
+            if (comp(x, d->data.first)) {
+                path[depth++] = slot;
+                slot = &d->left;
+            }
+            else if (comp(d->data.first, x)) {
+                path[depth++] = slot;
+                slot = &d->right;
+            }
+            else break;
+        }
+
+        if (d == nullptr) return false;   // Item not found; do nothing
+
+        Node* l = d->left.load(std::memory_order_relaxed);
+        Node* r = d->right.load(std::memory_order_relaxed);
+
+        begin_change();
+
+        if (l != nullptr && r != nullptr) { // Two children
+            std::size_t pos = depth;
+            path[depth++] = slot;
+            link* sslot = &d->right;
+            Node* succ = r;
+
+            while (Node* next = succ->left.load(std::memory_order_relaxed)) {
+                path[depth++] = sslot;
+                sslot = &succ->left;
+                succ = next;
+            }
+
+            // unlink succ first so the tree never holds a cycle
+            sslot->store(succ->right.load(std::memory_order_relaxed), std::memory_order_release);
+            succ->left.store(l, std::memory_order_release);
+            succ->right.store(d->right.load(std::memory_order_relaxed), std::memory_order_release);
+            succ->height = d->height;
+            slot->store(succ, std::memory_order_release);
+
+            // the link right below the removed node now belongs to succ
+            if (pos + 1 < depth) path[pos + 1] = &succ->right;
+        }
+        else { // One child
+            slot->store(l != nullptr ? l : r, std::memory_order_release);
+        }
+
+        sz.fetch_sub(1, std::memory_order_relaxed);
+        retrace(path, depth);
+        end_change();
+        retire(d);
+
+        return true;
+    }
+
+    // Rebalance the recorded search path, stops once a height is unchanged
+    void retrace(link** path, std::size_t depth) noexcept
+    {
+        while (depth > 0) {
+            link& t = *path[--depth];
+            auto old_height = t.load(std::memory_order_relaxed)->height;
+
+            balance(t);
+
+            if (t.load(std::memory_order_relaxed)->height == old_height) break;
+        }
+    }
+
+    // Internal method to re-balance the tree
+    void balance(link& slot) noexcept
+    {
+        static const int ALLOWED_IMBALANCE = 1;
+
+        Node* t = slot.load(std::memory_order_relaxed);
+        if (t == nullptr) return;
+
+        if (height(t->left) - height(t->right) > ALLOWED_IMBALANCE) {
+            Node* l = t->left.load(std::memory_order_relaxed);
+
+            if (height(l->left) >= height(l->right))
+                rotateWithLeftChild(slot);
+            else
+                doubleWithLeftChild(slot);
+        }
+        else if (height(t->right) - height(t->left) > ALLOWED_IMBALANCE) {
+            Node* r = t->right.load(std::memory_order_relaxed);
+
+            if (height(r->right) >= height(r->left))
+                rotateWithRightChild(slot);
+            else
+                doubleWithRightChild(slot);
+        }
+
+        t = slot.load(std::memory_order_relaxed);
+        t->height = std::max(height(t->left), height(t->right)) + 1;
+    }
+
+    // Rotations block, links are rewired bottom-up so no cycle ever shows
+
+    /**
+     * Rotate binary tree node with left child.
+     * For AVL trees, this is a single rotation for case 1.
+     * Update heights, then set new root.
+     */
+    void rotateWithLeftChild(link& slot) noexcept
+    {
+        begin_change();
+
+        Node* k2 = slot.load(std::memory_order_relaxed);
+        Node* k1 = k2->left.load(std::memory_order_relaxed);
+
+        k2->left.store(k1->right.load(std::memory_order_relaxed), std::memory_order_release);
+        k2->height = std::max(height(k2->left), height(k2->right)) + 1;
+        k1->right.store(k2, std::memory_order_release);
+        k1->height = std::max(height(k1->left), k2->height) + 1;
+        slot.store(k1, std::memory_order_release);
+    }
+
+    /**
+     * Rotate binary tree node with right child.
+     * For AVL trees, this is a single rotation for case 4.
+     * Update heights, then set new root.
+     */
+    void rotateWithRightChild(link& slot) noexcept
+    {
+        begin_change();
+
+        Node* k1 = slot.load(std::memory_order_relaxed);
+        Node* k2 = k1->right.load(std::memory_order_relaxed);
+
+        k1->right.store(k2->left.load(std::memory_order_relaxed), std::memory_order_release);
+        k1->height = std::max(height(k1->left), height(k1->right)) + 1;
+        k2->left.store(k1, std::memory_order_release);
+        k2->height = std::max(height(k2->right), k1->height) + 1;
+        slot.store(k2, std::memory_order_release);
+    }
+
+    /**
+     * Double rotate binary tree node: first left child.
+     * with its right child; then node k3 with new left child.
+     * For AVL trees, this is a double rotation for case 2.
+     * Update heights, then set new root.
+     */
+    void doubleWithLeftChild(link& k3) noexcept
+    {
+        rotateWithRightChild(k3.load(std::memory_order_relaxed)->left);
+        rotateWithLeftChild(k3);
+    }
+
+    /**
+     * Double rotate binary tree node: first right child.
+     * with its left child; then node k1 with new right child.
+     * For AVL trees, this is a double rotation for case 3.
+     * Update heights, then set new root.
+     */
+    void doubleWithRightChild(link& k1) noexcept
+    {
+        rotateWithLeftChild(k1.load(std::memory_order_relaxed)->right);
+        rotateWithRightChild(k1);
+    }
+
+}; // end of class ConcurrentAvlMap
+
+} // end of namespace Homebrew
+
+#endif // AVL_MAP_CONCURRENT_HEADER_HPP
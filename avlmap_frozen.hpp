@@ -0,0 +1,198 @@
+#ifndef AVL_MAP_FROZEN_HEADER_HPP
+#define AVL_MAP_FROZEN_HEADER_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "avlcommon.hpp"
+
+namespace Homebrew {
+
+/**
+ * Immutable map, usually made by AvlMap::freeze().
+ * Keys sit in one array in Eytzinger (level order) layout, children of
+ * slot i at 2i + 1 and 2i + 2, with the values in a parallel array so a
+ * descent only touches keys. Lookups are branchless: each level is one
+ * comparison whose result is the child offset, and the keys four levels
+ * down are prefetched while the current one is compared.
+ */
+template<typename Key,
+         typename Value,
+         typename Compare = std::less<Key>>
+class FrozenAvlMap {
+    std::vector<Key> keys;
+    std::vector<Value> values;
+
+    // Ordering of the keys
+    Compare comp;
+
+    // Lookups with other types than Key need a transparent comparator
+    template<typename K>
+    using enable_transparent = std::enable_if_t<detail::is_transparent<Compare>::value, K>;
+
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using value_type = std::pair<const Key, Value>;
+    using key_compare = Compare;
+
+    // constructors block
+    FrozenAvlMap() : comp{} {}
+
+    explicit FrozenAvlMap(const Compare& c) : comp{c} {}
+
+    // [first, last) holds (key, value) pairs sorted on key, without duplicates
+    template<typename Iter>
+    FrozenAvlMap(sorted_unique_t, Iter first, Iter last, const Compare& c = Compare())
+        : comp{c}
+    {
+        std::vector<Iter> sorted;
+        for (auto it = first; it != last; ++it) sorted.push_back(it);
+
+        auto n = sorted.size();
+        std::vector<std::size_t> rank (n);
+        std::size_t r = 0;
+        auto number = [&](std::size_t i) { rank[i] = r++; };
+        detail::level_order_inorder(0, n, number);
+
+        keys.reserve(n);
+        values.reserve(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            keys.push_back(sorted[rank[i]]->first);
+            values.push_back(sorted[rank[i]]->second);
+        }
+    }
+
+    // Member functions block
+    inline bool empty() const noexcept
+    {
+        return keys.empty();
+    }
+
+    inline std::size_t size() const noexcept
+    {
+        return keys.size();
+    }
+
+    key_compare key_comp() const
+    {
+        return comp;
+    }
+
+    // Check if conatiner has an specific key
+    bool search(const Key& x) const noexcept
+    {
+        return find_slot(x) != size();
+    }
+
+    template<typename K, typename = enable_transparent<K>>
+    bool search(const K& x) const noexcept
+    {
+        return find_slot(x) != size();
+    }
+
+    // access specified elem with checking
+    const Value& at(const Key& x) const
+    {
+        auto i = find_slot(x);
+        if (i == size()) throw std::out_of_range("Elem not found error");
+        return values[i];
+    }
+
+    template<typename K, typename = enable_transparent<K>>
+    const Value& at(const K& x) const
+    {
+        auto i = find_slot(x);
+        if (i == size()) throw std::out_of_range("Elem not found error");
+        return values[i];
+    }
+
+    // pointer to the value of x, nullptr if x is not there
+    const Value* find(const Key& x) const noexcept
+    {
+        auto i = find_slot(x);
+        return i != size() ? &values[i] : nullptr;
+    }
+
+    template<typename K, typename = enable_transparent<K>>
+    const Value* find(const K& x) const noexcept
+    {
+        auto i = find_slot(x);
+        return i != size() ? &values[i] : nullptr;
+    }
+
+    // Call fn(key, value) on every pair in order
+    template<typename F>
+    void for_each(F&& fn) const
+    {
+        auto visit = [&](std::size_t i) { fn(keys[i], values[i]); };
+        detail::level_order_inorder(0, size(), visit);
+    }
+
+    /**
+     * Stream the map to os as "{(k, v), ...}", each pair written by
+     * fmt(OutputBuffer&, const std::pair<const Key&, const Value&>&).
+     * Output goes through a fixed buffer in large blocks.
+     */
+    template<typename F = TextFormat>
+    void write_to(std::ostream& os, F fmt = F()) const
+    {
+        auto walk = [this](auto& one) {
+            for_each([&one](const Key& k, const Value& v) {
+                one(std::pair<const Key&, const Value&>(k, v));
+            });
+        };
+        detail::write_list(os, walk, fmt);
+    }
+
+    void print() const
+    {
+        write_to(std::cout);
+    }
+
+private:
+    /**
+     * Slot of the first key not less than x, size() if there is none.
+     * The descent always runs to the bottom, going right when the slot's
+     * key is less than x. Seen in 1-based numbering the slot it falls off
+     * at encodes the path: the trailing 1 bits are the right turns after
+     * the last left one, shifting them out (and that left turn) gives the
+     * answer.
+     */
+    template<typename K>
+    std::size_t lower_slot(const K& x) const noexcept
+    {
+        const Key* k = keys.data();
+        const std::size_t n = keys.size();
+        std::size_t i = 0;
+
+        while (i < n) {
+            detail::prefetch(k + std::min(16 * i + 15, n - 1));
+            i = 2 * i + 1 + static_cast<std::size_t>(comp(k[i], x));
+        }
+
+        std::size_t j = i + 1;
+        j >>= detail::trailing_ones(j) + 1;
+
+        return j == 0 ? n : j - 1;
+    }
+
+    template<typename K>
+    std::size_t find_slot(const K& x) const noexcept
+    {
+        auto i = lower_slot(x);
+        return (i != size() && !comp(x, keys[i])) ? i : size();
+    }
+
+}; // end of class FrozenAvlMap
+
+} // end of namespace Homebrew
+
+#endif // AVL_MAP_FROZEN_HEADER_HPP
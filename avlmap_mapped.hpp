@@ -0,0 +1,228 @@
+#ifndef AVL_MAP_MAPPED_HEADER_HPP
+#define AVL_MAP_MAPPED_HEADER_HPP
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "avlcommon.hpp"
+
+namespace Homebrew {
+
+/**
+ * Read-only map over a file written by AvlMap::serialize().
+ * The file is mapped into memory and searched in place as the implicit
+ * level-order tree it holds: no deserialization, the pages are read in
+ * as lookups touch them. Only the header is validated, the records are
+ * trusted. POSIX only (mmap).
+ */
+template<typename Key,
+         typename Value,
+         typename Compare = std::less<Key>>
+class MappedAvlMap {
+    static_assert(std::is_trivially_copyable<Key>::value &&
+                  std::is_trivially_copyable<Value>::value,
+                  "MappedAvlMap needs trivially copyable keys and values");
+
+    using Record = detail::MapRecord<Key, Value>;
+
+    static_assert(alignof(Record) <= sizeof(detail::MapFileHeader),
+                  "Records would be misaligned after the header");
+
+    void* mapping;             // nullptr for views over memory owned elsewhere
+    std::size_t mapped_bytes;
+    const Record* records;
+    std::size_t n;
+    Compare comp;
+
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using key_compare = Compare;
+
+    // Map a whole file, throws std::system_error if it can't be mapped
+    explicit MappedAvlMap(const std::string& path, const Compare& c = Compare())
+        : mapping{nullptr}, mapped_bytes{0}, records{nullptr}, n{0}, comp{c}
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::system_error(errno, std::generic_category(), path);
+
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), path);
+        }
+
+        auto bytes = static_cast<std::size_t>(st.st_size);
+        if (bytes < sizeof(detail::MapFileHeader)) {
+            ::close(fd);
+            throw std::runtime_error("Not a map file for these types");
+        }
+
+        void* p = ::mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+        int err = errno;
+        ::close(fd); // the mapping stays valid on its own
+
+        if (p == MAP_FAILED) throw std::system_error(err, std::generic_category(), path);
+
+        mapping = p;
+        mapped_bytes = bytes;
+
+        try {
+            attach(p, bytes);
+        }
+        catch (...) {
+            ::munmap(mapping, mapped_bytes);
+            throw;
+        }
+    }
+
+    // View over a serialized map already in memory, that must outlive it
+    MappedAvlMap(const void* data, std::size_t bytes, const Compare& c = Compare())
+        : mapping{nullptr}, mapped_bytes{0}, records{nullptr}, n{0}, comp{c}
+    {
+        attach(data, bytes);
+    }
+
+    MappedAvlMap(const MappedAvlMap&) = delete;
+    MappedAvlMap& operator=(const MappedAvlMap&) = delete;
+
+    MappedAvlMap(MappedAvlMap&& other) noexcept
+        : mapping{other.mapping},
+          mapped_bytes{other.mapped_bytes},
+          records{other.records},
+          n{other.n},
+          comp{other.comp}
+    {
+        other.mapping = nullptr;
+        other.records = nullptr;
+        other.n = 0;
+    }
+
+    MappedAvlMap& operator=(MappedAvlMap&& other) noexcept
+    {
+        std::swap(mapping, other.mapping);
+        std::swap(mapped_bytes, other.mapped_bytes);
+        std::swap(records, other.records);
+        std::swap(n, other.n);
+        std::swap(comp, other.comp);
+        return *this;
+    }
+
+    ~MappedAvlMap() noexcept
+    {
+        if (mapping != nullptr) ::munmap(mapping, mapped_bytes);
+    }
+
+    // Member functions block
+    inline bool empty() const noexcept
+    {
+        return n == 0;
+    }
+
+    inline const std::size_t& size() const noexcept
+    {
+        return n;
+    }
+
+    key_compare key_comp() const
+    {
+        return comp;
+    }
+
+    bool search(const Key& x) const noexcept
+    {
+        return find(x) != nullptr;
+    }
+
+    // pointer into the mapping, nullptr if x is not there
+    const Value* find(const Key& x) const noexcept
+    {
+        std::size_t i = 0;
+
+        while (i < n)
+            if (comp(x, records[i].key))
+                i = 2 * i + 1;
+            else if (comp(records[i].key, x))
+                i = 2 * i + 2;
+            else
+                return &records[i].value;
+
+        return nullptr;
+    }
+
+    // access specified elem with checking
+    const Value& at(const Key& x) const
+    {
+        auto ptr = find(x);
+        if (ptr == nullptr) throw std::out_of_range("Elem not found error");
+        return *ptr;
+    }
+
+    // Call fn(key, value) on every pair in order
+    template<typename F>
+    void for_each(F&& fn) const
+    {
+        auto visit = [&](std::size_t i) { fn(records[i].key, records[i].value); };
+        detail::level_order_inorder(0, n, visit);
+    }
+
+    /**
+     * Stream the map to os as "{(k, v), ...}", each pair written by
+     * fmt(OutputBuffer&, const std::pair<const Key&, const Value&>&).
+     * Output goes through a fixed buffer in large blocks.
+     */
+    template<typename F = TextFormat>
+    void write_to(std::ostream& os, F fmt = F()) const
+    {
+        auto walk = [this](auto& one) {
+            for_each([&one](const Key& k, const Value& v) {
+                one(std::pair<const Key&, const Value&>(k, v));
+            });
+        };
+        detail::write_list(os, walk, fmt);
+    }
+
+    void print() const
+    {
+        write_to(std::cout);
+    }
+
+private:
+    void attach(const void* data, std::size_t bytes)
+    {
+        if (bytes < sizeof(detail::MapFileHeader))
+            throw std::runtime_error("Not a map file for these types");
+
+        detail::MapFileHeader header;
+        std::memcpy(&header, data, sizeof(header));
+
+        if (!detail::valid_map_header<Key, Value>(header))
+            throw std::runtime_error("Not a map file for these types");
+
+        auto room = (bytes - sizeof(header)) / sizeof(Record);
+        if (header.count > room) throw std::runtime_error("Truncated map file");
+
+        records = reinterpret_cast<const Record*>(static_cast<const char*>(data) + sizeof(header));
+        n = static_cast<std::size_t>(header.count);
+    }
+
+}; // end of class MappedAvlMap
+
+} // end of namespace Homebrew
+
+#endif // AVL_MAP_MAPPED_HEADER_HPP
@@ -0,0 +1,449 @@
+#ifndef AVL_MAP_PERSISTENT_HEADER_HPP
+#define AVL_MAP_PERSISTENT_HEADER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "avlcommon.hpp"
+
+namespace Homebrew {
+
+/**
+ * Persistent (copy on write) flavour of AvlMap.
+ * Nodes are immutable and shared between maps through atomic reference
+ * counts: copying a map, i.e. taking a snapshot, is O(1) and every later
+ * insert or erase copies only the O(log n) nodes on its search path.
+ * Snapshots may be handed to other threads, each map object itself is
+ * not thread-safe. Keys and values must be copyable, path nodes are
+ * rebuilt by copying their pairs.
+ */
+template<typename Key,
+         typename Value,
+         typename Compare = std::less<Key>,
+         typename Alloc = std::allocator<std::pair<const Key, Value>>>
+class PersistentAvlMap {
+    struct Node;
+
+    // nodes are released by whichever snapshot drops them last
+    using NodeAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<Node>;
+    using NodeTraits = std::allocator_traits<NodeAlloc>;
+
+    static_assert(NodeTraits::is_always_equal::value,
+                  "Persistent nodes need a stateless allocator");
+
+    // Shared owning link to a node
+    class node_ref {
+        const Node* p;
+
+    public:
+        node_ref() noexcept : p{nullptr} {}
+        node_ref(std::nullptr_t) noexcept : p{nullptr} {}
+
+        // adopts a freshly built node
+        explicit node_ref(const Node* n) noexcept : p{n} {}
+
+        node_ref(const node_ref& other) noexcept
+            : p{other.p}
+        {
+            if (p != nullptr) p->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        node_ref(node_ref&& other) noexcept
+            : p{other.p}
+        {
+            other.p = nullptr;
+        }
+
+        node_ref& operator=(node_ref other) noexcept
+        {
+            std::swap(p, other.p);
+            return *this;
+        }
+
+        ~node_ref() noexcept
+        {
+            if (p != nullptr && p->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                destroy_node(p);
+        }
+
+        const Node* get() const noexcept { return p; }
+        const Node* operator->() const noexcept { return p; }
+        explicit operator bool() const noexcept { return p != nullptr; }
+    };
+
+    // node of the tree, never modified once linked
+    struct Node {
+        mutable std::atomic<std::size_t> refs;
+        node_ref left;
+        node_ref right;
+        std::pair<const Key, Value> data;
+        std::int32_t height;
+
+        template<typename... Args>
+        Node(node_ref&& lt, node_ref&& rt, Args&&... args)
+            : refs{1},
+              left{std::move(lt)},
+              right{std::move(rt)},
+              data(std::forward<Args>(args)...),
+              height{std::max(PersistentAvlMap::height(left), PersistentAvlMap::height(right)) + 1} {}
+
+        const Key& key() const {return data.first;}
+    };
+
+    // root of the tree
+    node_ref root;
+
+    // Number of elements
+    std::size_t sz;
+
+    // Longest possible search path, AVL height is below 1.44 * log2(n + 2)
+    static constexpr std::size_t MAX_DEPTH = 96;
+
+    // Ordering of the keys
+    Compare comp;
+
+    // Lookups with other types than Key need a transparent comparator
+    template<typename K>
+    using enable_transparent = std::enable_if_t<detail::is_transparent<Compare>::value, K>;
+
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using value_type = std::pair<const Key, Value>;
+    using key_compare = Compare;
+    using allocator_type = Alloc;
+
+    // constructors block
+    PersistentAvlMap() : root{nullptr}, sz{0}, comp{} {}
+
+    explicit PersistentAvlMap(const Compare& c) : root{nullptr}, sz{0}, comp{c} {}
+
+    // O(1), both maps share every node from now on
+    PersistentAvlMap(const PersistentAvlMap& other) = default;
+    PersistentAvlMap& operator=(const PersistentAvlMap& other) = default;
+
+    PersistentAvlMap(PersistentAvlMap&& other) noexcept
+        : root{std::move(other.root)}, sz{other.sz}, comp{other.comp}
+    {
+        other.sz = 0;
+    }
+
+    PersistentAvlMap& operator=(PersistentAvlMap&& other) noexcept
+    {
+        std::swap(root, other.root);
+        std::swap(sz, other.sz);
+        std::swap(comp, other.comp);
+        return *this;
+    }
+
+    template<typename Iter>
+    PersistentAvlMap(Iter first, Iter last)
+        : PersistentAvlMap()
+    {
+        for (auto it = first; it != last; std::advance(it, 1)) {
+            insert(it->first, it->second);
+        }
+    }
+
+    PersistentAvlMap(const std::initializer_list<std::pair<const Key, Value>>& lst)
+        : PersistentAvlMap(std::begin(lst), std::end(lst)) {}
+
+    // Member functions block
+
+    // Consistent read-only view of the current contents, O(1)
+    PersistentAvlMap snapshot() const noexcept
+    {
+        return *this;
+    }
+
+    inline bool empty() const noexcept
+    {
+        return sz == 0;
+    }
+
+    inline const std::size_t& size() const noexcept
+    {
+        return sz;
+    }
+
+    key_compare key_comp() const
+    {
+        return comp;
+    }
+
+    allocator_type get_allocator() const
+    {
+        return allocator_type();
+    }
+
+    void clear() noexcept
+    {
+        root = nullptr;
+        sz = 0;
+    }
+
+    // does nothing if k is already there, true if inserted
+    template<typename K = Key,
+             typename V = Value>
+    bool insert(K&& k, V&& v)
+    {
+        bool inserted = false;
+        root = insert_util(root, k, std::forward<V>(v), false, inserted);
+        if (inserted) ++sz;
+        return inserted;
+    }
+
+    // Insert, or give k a new value. True if inserted
+    template<typename K = Key,
+             typename V = Value>
+    bool insert_or_assign(K&& k, V&& v)
+    {
+        bool inserted = false;
+        root = insert_util(root, k, std::forward<V>(v), true, inserted);
+        if (inserted) ++sz;
+        return inserted;
+    }
+
+    // true if k was there
+    bool erase(const Key& k)
+    {
+        bool erased = false;
+        root = remove_util(root, k, erased);
+        if (erased) --sz;
+        return erased;
+    }
+
+    // access specified elem with checking
+    const Value& at(const Key& k) const
+    {
+        auto ptr = find_node(k);
+        if (ptr == nullptr) throw std::out_of_range("Elem not found error");
+        return ptr->data.second;
+    }
+
+    template<typename K, typename = enable_transparent<K>>
+    const Value& at(const K& k) const
+    {
+        auto ptr = find_node(k);
+        if (ptr == nullptr) throw std::out_of_range("Elem not found error");
+        return ptr->data.second;
+    }
+
+    // Check if conatiner has an specific key
+    bool search(const Key& x) const noexcept
+    {
+        return find_node(x) != nullptr;
+    }
+
+    template<typename K, typename = enable_transparent<K>>
+    bool search(const K& x) const noexcept
+    {
+        return find_node(x) != nullptr;
+    }
+
+    // pointer to the pair with key x, nullptr if there is none
+    const value_type* find(const Key& x) const noexcept
+    {
+        auto ptr = find_node(x);
+        return ptr != nullptr ? &ptr->data : nullptr;
+    }
+
+    template<typename K, typename = enable_transparent<K>>
+    const value_type* find(const K& x) const noexcept
+    {
+        auto ptr = find_node(x);
+        return ptr != nullptr ? &ptr->data : nullptr;
+    }
+
+    // Call fn on every (key, value) pair in order, without recursion
+    template<typename F>
+    void for_each(F&& fn) const
+    {
+        const Node* stack[MAX_DEPTH];
+        std::size_t depth = 0;
+        const Node* t = root.get();
+
+        while (t != nullptr || depth > 0) {
+            while (t != nullptr) {
+                stack[depth++] = t;
+                t = t->left.get();
+            }
+
+            t = stack[--depth];
+            fn(t->data);
+            t = t->right.get();
+        }
+    }
+
+    /**
+     * Stream the map to os as "{(k, v), ...}", each pair written by
+     * fmt(OutputBuffer&, const value_type&). Output goes through a fixed
+     * buffer in large blocks.
+     */
+    template<typename F = TextFormat>
+    void write_to(std::ostream& os, F fmt = F()) const
+    {
+        detail::write_list(os, [this](auto& one) { for_each(one); }, fmt);
+    }
+
+    void print() const
+    {
+        write_to(std::cout);
+    }
+
+private:
+    // the last reference is gone, children go with it
+    static void destroy_node(const Node* p) noexcept
+    {
+        NodeAlloc a;
+        Node* n = const_cast<Node*>(p);
+        NodeTraits::destroy(a, n);
+        NodeTraits::deallocate(a, n, 1);
+    }
+
+    template<typename... Args>
+    static node_ref make_node(node_ref l, node_ref r, Args&&... args)
+    {
+        NodeAlloc a;
+        Node* p = NodeTraits::allocate(a, 1);
+
+        try {
+            NodeTraits::construct(a, p, std::move(l), std::move(r), std::forward<Args>(args)...);
+        }
+        catch (...) {
+            NodeTraits::deallocate(a, p, 1);
+            throw;
+        }
+
+        return node_ref{p};
+    }
+
+    // Returns height of a node
+    static std::int32_t height(const node_ref& node) noexcept
+    {
+        return node ? node->height : -1;
+    }
+
+    // binary search an element in the tree
+    template<typename K>
+    const Node* find_node(const K& x) const noexcept
+    {
+        auto t = root.get();
+
+        while (t != nullptr)
+            if (comp(x, t->key()))
+                t = t->left.get();
+            else if (comp(t->key(), x))
+                t = t->right.get();
+            else
+                return t;
+
+        return nullptr;
+    }
+
+    /**
+     * New node holding x over l and r, rotated if their heights differ by
+     * two. Only nodes on the rotated path are rebuilt, subtrees are shared.
+     */
+    static node_ref balance(const value_type& x, node_ref l, node_ref r)
+    {
+        static const int ALLOWED_IMBALANCE = 1;
+
+        if (height(l) - height(r) > ALLOWED_IMBALANCE) {
+            if (height(l->left) >= height(l->right)) // single rotation
+                return make_node(l->left, make_node(l->right, std::move(r), x), l->data);
+
+            const Node* lr = l->right.get(); // double rotation
+            return make_node(make_node(l->left, lr->left, l->data),
+                             make_node(lr->right, std::move(r), x),
+                             lr->data);
+        }
+
+        if (height(r) - height(l) > ALLOWED_IMBALANCE) {
+            if (height(r->right) >= height(r->left)) // single rotation
+                return make_node(make_node(std::move(l), r->left, x), r->right, r->data);
+
+            const Node* rl = r->left.get(); // double rotation
+            return make_node(make_node(std::move(l), rl->left, x),
+                             make_node(rl->right, r->right, r->data),
+                             rl->data);
+        }
+
+        return make_node(std::move(l), std::move(r), x);
+    }
+
+    // Path copying insert, returns t itself when nothing changes
+    template<typename K, typename V>
+    node_ref insert_util(const node_ref& t, const K& k, V&& v, bool assign, bool& inserted)
+    {
+        if (!t) {
+            inserted = true;
+            return make_node(nullptr, nullptr, k, std::forward<V>(v));
+        }
+
+        if (comp(k, t->key())) {
+            auto l = insert_util(t->left, k, std::forward<V>(v), assign, inserted);
+            if (l.get() == t->left.get()) return t;
+            return balance(t->data, std::move(l), t->right);
+        }
+
+        if (comp(t->key(), k)) {
+            auto r = insert_util(t->right, k, std::forward<V>(v), assign, inserted);
+            if (r.get() == t->right.get()) return t;
+            return balance(t->data, t->left, std::move(r));
+        }
+
+        //duplicate key
+        if (!assign) return t;
+        return make_node(t->left, t->right, t->key(), std::forward<V>(v));
+    }
+
+    // Path copying delete, the successor's pair takes the removed one's place
+    node_ref remove_util(const node_ref& t, const Key& x, bool& erased)
+    {
+        if (!t) return t;   // Item not found; do nothing
+
+        if (comp(x, t->key())) {
+            auto l = remove_util(t->left, x, erased);
+            if (!erased) return t;
+            return balance(t->data, std::move(l), t->right);
+        }
+
+        if (comp(t->key(), x)) {
+            auto r = remove_util(t->right, x, erased);
+            if (!erased) return t;
+            return balance(t->data, t->left, std::move(r));
+        }
+
+        erased = true;
+
+        if (!t->left) return t->right;
+        if (!t->right) return t->left;
+
+        // Two children
+        const Node* succ = t->right.get();
+        while (succ->left) succ = succ->left.get();
+
+        return balance(succ->data, t->left, remove_min(t->right));
+    }
+
+    static node_ref remove_min(const node_ref& t)
+    {
+        if (!t->left) return t->right;
+        return balance(t->data, remove_min(t->left), t->right);
+    }
+
+}; // end of class PersistentAvlMap
+
+} // end of namespace Homebrew
+
+#endif // AVL_MAP_PERSISTENT_HEADER_HPP
@@ -0,0 +1,289 @@
+#ifndef AVL_MAP_SHARDED_HEADER_HPP
+#define AVL_MAP_SHARDED_HEADER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "avlmap.hpp"
+
+namespace Homebrew {
+
+namespace detail {
+
+// Final mix of murmur3, std::hash of integers is often the identity
+inline std::uint64_t mix_hash(std::uint64_t h) noexcept
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+} // end of namespace detail
+
+/**
+ * Thread-safe map split into N independent AvlMap shards.
+ * A key always lives in the shard picked by its hash, and each shard has
+ * its own reader/writer lock, so threads working on different shards
+ * never wait for each other. Only for_each() (an ordered k-way merge of
+ * the shards) and clear() touch every shard, taking the locks in shard
+ * order. Values are handed out as copies, or to a callback run under the
+ * shard lock (update()).
+ */
+template<typename Key,
+         typename Value,
+         std::size_t N = 16,
+         typename Hash = std::hash<Key>,
+         typename Compare = std::less<Key>>
+class ShardedAvlMap {
+    static_assert(N > 0, "ShardedAvlMap needs at least one shard");
+
+    using map_type = AvlMap<Key, Value, Compare>;
+    using const_iterator = typename map_type::const_iterator;
+
+    // one cache line at least, so locks of neighbour shards don't collide
+    struct alignas(64) Shard {
+        mutable std::shared_timed_mutex lock;
+        map_type map;
+        std::atomic<std::size_t> sz {0}; // size of map, readable without the lock
+    };
+
+    using read_lock = std::shared_lock<std::shared_timed_mutex>;
+    using write_lock = std::unique_lock<std::shared_timed_mutex>;
+
+    Shard shards[N];
+
+    Hash hash;
+    Compare comp;
+
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using value_type = std::pair<const Key, Value>;
+    using key_compare = Compare;
+    using hasher = Hash;
+
+    static constexpr std::size_t shard_count = N;
+
+    // constructors block
+    explicit ShardedAvlMap(const Hash& h = Hash(), const Compare& c = Compare())
+        : hash{h}, comp{c}
+    {
+        for (auto& s : shards) s.map = map_type(c);
+    }
+
+    // shared between threads by reference, never copied or moved
+    ShardedAvlMap(const ShardedAvlMap&) = delete;
+    ShardedAvlMap& operator=(const ShardedAvlMap&) = delete;
+
+    template<typename Iter>
+    ShardedAvlMap(Iter first, Iter last)
+        : ShardedAvlMap()
+    {
+        for (auto it = first; it != last; std::advance(it, 1)) {
+            insert(it->first, it->second);
+        }
+    }
+
+    ShardedAvlMap(const std::initializer_list<std::pair<const Key, Value>>& lst)
+        : ShardedAvlMap(std::begin(lst), std::end(lst)) {}
+
+    // Member functions block
+    inline bool empty() const noexcept
+    {
+        return size() == 0;
+    }
+
+    // Sum of the shard sizes, exact only while no writer is running
+    std::size_t size() const noexcept
+    {
+        std::size_t n = 0;
+        for (const auto& s : shards) n += s.sz.load(std::memory_order_relaxed);
+        return n;
+    }
+
+    key_compare key_comp() const
+    {
+        return comp;
+    }
+
+    hasher hash_function() const
+    {
+        return hash;
+    }
+
+    // Readers block, a shared lock on the key's shard only
+
+    bool search(const Key& x) const
+    {
+        const Shard& s = shard_of(x);
+        read_lock lock (s.lock);
+        return s.map.search(x);
+    }
+
+    // copy the value of key x into out, false if there is none
+    bool find(const Key& x, Value& out) const
+    {
+        const Shard& s = shard_of(x);
+        read_lock lock (s.lock);
+
+        auto it = s.map.find(x);
+        if (it == s.map.end()) return false;
+        out = it->second;
+        return true;
+    }
+
+    // copy of the value of key x, with checking
+    Value at(const Key& x) const
+    {
+        const Shard& s = shard_of(x);
+        read_lock lock (s.lock);
+        return s.map.at(x);
+    }
+
+    // Call fn on every (key, value) pair in order, writers wait meanwhile
+    template<typename F>
+    void for_each(F&& fn) const
+    {
+        std::vector<read_lock> locks;
+        locks.reserve(N);
+        for (const auto& s : shards) locks.emplace_back(s.lock);
+
+        // min-heap of the shard cursors on their current key
+        using cursor = std::pair<const_iterator, const_iterator>;
+        auto later = [this](const cursor& a, const cursor& b) {
+            return comp(b.first->first, a.first->first);
+        };
+
+        std::vector<cursor> heap;
+        heap.reserve(N);
+        for (const auto& s : shards)
+            if (!s.map.empty()) heap.emplace_back(s.map.begin(), s.map.end());
+        std::make_heap(heap.begin(), heap.end(), later);
+
+        while (!heap.empty()) {
+            std::pop_heap(heap.begin(), heap.end(), later);
+            cursor& c = heap.back();
+            fn(*c.first);
+
+            if (++c.first != c.second) std::push_heap(heap.begin(), heap.end(), later);
+            else heap.pop_back();
+        }
+    }
+
+    /**
+     * Stream the map to os as "{(k, v), ...}", each pair written by
+     * fmt(OutputBuffer&, const value_type&). Output goes through a fixed
+     * buffer in large blocks, writers wait meanwhile.
+     */
+    template<typename F = TextFormat>
+    void write_to(std::ostream& os, F fmt = F()) const
+    {
+        detail::write_list(os, [this](auto& one) { for_each(one); }, fmt);
+    }
+
+    void print() const
+    {
+        write_to(std::cout);
+    }
+
+    // Writers block, an exclusive lock on the key's shard only
+
+    // does nothing if k is already there, true if inserted
+    template<typename K = Key,
+             typename V = Value>
+    bool insert(K&& k, V&& v)
+    {
+        Shard& s = shard_of(k);
+        write_lock lock (s.lock);
+
+        bool added = s.map.insert(std::forward<K>(k), std::forward<V>(v)).second;
+        if (added) s.sz.fetch_add(1, std::memory_order_relaxed);
+        return added;
+    }
+
+    // Insert, or give k a new value. True if inserted
+    template<typename K = Key,
+             typename V = Value>
+    bool insert_or_assign(K&& k, V&& v)
+    {
+        Shard& s = shard_of(k);
+        write_lock lock (s.lock);
+
+        bool added = s.map.insert_or_assign(std::forward<K>(k), std::forward<V>(v)).second;
+        if (added) s.sz.fetch_add(1, std::memory_order_relaxed);
+        return added;
+    }
+
+    /**
+     * Read-modify-write of the value of k under its shard lock, e.g.
+     * update(k, [](int& c) { ++c; }) for counters. A value initialized
+     * Value is inserted first when k is absent; true in that case.
+     */
+    template<typename F>
+    bool update(const Key& k, F&& fn)
+    {
+        Shard& s = shard_of(k);
+        write_lock lock (s.lock);
+
+        auto res = s.map.try_emplace(k);
+        if (res.second) s.sz.fetch_add(1, std::memory_order_relaxed);
+        fn(res.first->second);
+        return res.second;
+    }
+
+    // true if k was there
+    bool erase(const Key& k)
+    {
+        Shard& s = shard_of(k);
+        write_lock lock (s.lock);
+
+        if (!s.map.extract(k)) return false;
+        s.sz.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Shards are emptied one at a time, not as a single atomic step
+    void clear()
+    {
+        for (auto& s : shards) {
+            write_lock lock (s.lock);
+            s.map.clear();
+            s.sz.store(0, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    std::size_t shard_index(const Key& k) const
+    {
+        return static_cast<std::size_t>(detail::mix_hash(hash(k)) % N);
+    }
+
+    Shard& shard_of(const Key& k)
+    {
+        return shards[shard_index(k)];
+    }
+
+    const Shard& shard_of(const Key& k) const
+    {
+        return shards[shard_index(k)];
+    }
+
+}; // end of class ShardedAvlMap
+
+} // end of namespace Homebrew
+
+#endif // AVL_MAP_SHARDED_HEADER_HPP
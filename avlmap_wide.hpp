@@ -0,0 +1,754 @@
+#ifndef AVL_MAP_WIDE_HEADER_HPP
+#define AVL_MAP_WIDE_HEADER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "avlcommon.hpp"
+#include "avlmap.hpp"
+
+namespace Homebrew {
+
+namespace detail {
+
+// Keys WideAvlMap takes: arithmetic types under their natural order
+template<typename Key>
+struct is_simd_key
+    : std::integral_constant<bool, std::is_arithmetic<Key>::value &&
+                                   !std::is_same<Key, bool>::value> {};
+
+// Filler of unused key slots, never less than a key searched for
+template<typename Key>
+constexpr Key key_sentinel() noexcept
+{
+    return std::numeric_limits<Key>::has_infinity ? std::numeric_limits<Key>::infinity()
+                                                  : std::numeric_limits<Key>::max();
+}
+
+// How many of the W sorted keys at k are less than x
+template<std::size_t W, typename Key, typename = void>
+struct CountLess {
+    static std::size_t run(const Key* k, Key x) noexcept
+    {
+        std::size_t n = 0;
+        for (std::size_t i = 0; i < W; ++i) n += static_cast<std::size_t>(k[i] < x);
+        return n;
+    }
+};
+
+template<typename Key, std::size_t Bytes>
+using if_signed_int = std::enable_if_t<std::is_integral<Key>::value && std::is_signed<Key>::value &&
+                                       sizeof(Key) == Bytes>;
+
+#if defined(__AVX2__)
+
+template<typename Key>
+struct CountLess<16, Key, if_signed_int<Key, 4>> {
+    static std::size_t run(const Key* k, Key x) noexcept
+    {
+        const __m256i v = _mm256_set1_epi32(static_cast<std::int32_t>(x));
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(k));
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(k + 8));
+        auto lo = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(v, a))));
+        auto hi = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(v, b))));
+        return trailing_ones(lo | hi << 8); // the keys are sorted, so are the bits
+    }
+};
+
+template<typename Key>
+struct CountLess<8, Key, if_signed_int<Key, 8>> {
+    static std::size_t run(const Key* k, Key x) noexcept
+    {
+        const __m256i v = _mm256_set1_epi64x(static_cast<long long>(x));
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(k));
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(k + 4));
+        auto lo = static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(v, a))));
+        auto hi = static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(v, b))));
+        return trailing_ones(lo | hi << 4);
+    }
+};
+
+#elif defined(__SSE2__)
+
+template<typename Key>
+struct CountLess<16, Key, if_signed_int<Key, 4>> {
+    static std::size_t run(const Key* k, Key x) noexcept
+    {
+        const __m128i v = _mm_set1_epi32(static_cast<std::int32_t>(x));
+        unsigned bits = 0;
+        for (int i = 0; i < 4; ++i) {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(k + 4 * i));
+            bits |= static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, a)))) << (4 * i);
+        }
+        return trailing_ones(bits);
+    }
+};
+
+#endif
+
+// Cache line aligned node, which plain new only guarantees from C++17
+template<typename N>
+N* new_aligned_node()
+{
+    void* mem = nullptr;
+#if defined(_MSC_VER)
+    mem = _aligned_malloc(sizeof(N), alignof(N));
+#else
+    if (posix_memalign(&mem, alignof(N), sizeof(N)) != 0) mem = nullptr;
+#endif
+    if (mem == nullptr) throw std::bad_alloc();
+
+    try {
+        return ::new (mem) N();
+    }
+    catch (...) {
+#if defined(_MSC_VER)
+        _aligned_free(mem);
+#else
+        std::free(mem);
+#endif
+        throw;
+    }
+}
+
+template<typename N>
+void delete_aligned_node(N* p) noexcept
+{
+    p->~N();
+#if defined(_MSC_VER)
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+} // end of namespace detail
+
+/**
+ * Map for arithmetic keys with fat, cache line sized nodes.
+ * A node holds 64 / sizeof(Key) keys (8 to 16), so one node stands for
+ * three or four levels of AvlMap and a lookup takes that many fewer
+ * dependent loads. The keys of a node are compared all at once, with
+ * AVX2 / SSE2 for 32 and 64-bit signed integers and an unrolled loop the
+ * compiler can vectorize otherwise. Balance is kept at node granularity
+ * the B+ tree way: full nodes split on the way down, underfull ones
+ * borrow from or merge with a sibling, and every leaf sits at the same
+ * depth. Pairs live in the leaves, which are chained for iteration.
+ *
+ * Values move when nodes split or merge, so there are no iterators and
+ * pointers returned by find() last until the next insert or erase.
+ * Value must be default constructible and movable. NaN keys are not
+ * supported.
+ */
+template<typename Key, typename Value>
+class WideAvlMap {
+    static_assert(detail::is_simd_key<Key>::value, "WideAvlMap needs arithmetic keys");
+
+    // keys per node, a cache line of them
+    static constexpr std::size_t W = 64 / sizeof(Key) < 8 ? 8 : (64 / sizeof(Key) > 16 ? 16 : 64 / sizeof(Key));
+
+    // fewest keys a node other than the root may hold
+    static constexpr std::size_t MIN_LEAF = W / 2;
+    static constexpr std::size_t MIN_INNER = W / 2 - 1;
+
+    using count_less = detail::CountLess<W, Key>;
+
+    struct Leaf {
+        alignas(64) Key keys[W];
+        std::uint32_t n;
+        Leaf* next;        // leaf to the right, for iteration
+        Value values[W];
+
+        Leaf() : n{0}, next{nullptr}, values{}
+        {
+            for (auto& k : keys) k = detail::key_sentinel<Key>();
+        }
+    };
+
+    // child[i] holds keys up to keys[i], child[n] the ones after keys[n - 1]
+    struct Inner {
+        alignas(64) Key keys[W];
+        std::uint32_t n;
+        void* child[W + 1];
+
+        Inner() : n{0}, child{}
+        {
+            for (auto& k : keys) k = detail::key_sentinel<Key>();
+        }
+    };
+
+    // root of the tree, a Leaf when levels == 0
+    void* root;
+
+    // Inner levels above the leaves
+    std::size_t levels;
+
+    // leftmost leaf
+    Leaf* head;
+
+    // Number of elements
+    std::size_t sz;
+
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using value_type = std::pair<const Key, Value>;
+
+    // constructors block
+    WideAvlMap() : root{nullptr}, levels{0}, head{nullptr}, sz{0} {}
+
+    WideAvlMap(const WideAvlMap& other)
+        : WideAvlMap()
+    {
+        if (other.root == nullptr) return;
+
+        Leaf* last = nullptr;
+        root = clone(other.root, other.levels, last);
+        levels = other.levels;
+        sz = other.sz;
+    }
+
+    WideAvlMap& operator=(const WideAvlMap& other)
+    {
+        // copy and swap idiom
+        WideAvlMap tmp (other);
+        swap(tmp);
+        return *this;
+    }
+
+    WideAvlMap(WideAvlMap&& other) noexcept
+        : WideAvlMap()
+    {
+        swap(other);
+    }
+
+    WideAvlMap& operator=(WideAvlMap&& other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    ~WideAvlMap() noexcept
+    {
+        destroy(root, levels);
+    }
+
+    template<typename Iter>
+    WideAvlMap(Iter first, Iter last)
+        : WideAvlMap()
+    {
+        for (auto it = first; it != last; std::advance(it, 1)) {
+            insert(it->first, it->second);
+        }
+    }
+
+    WideAvlMap(const std::initializer_list<std::pair<const Key, Value>>& lst)
+        : WideAvlMap(std::begin(lst), std::end(lst)) {}
+
+    // Member functions block
+    void swap(WideAvlMap& other) noexcept
+    {
+        std::swap(root, other.root);
+        std::swap(levels, other.levels);
+        std::swap(head, other.head);
+        std::swap(sz, other.sz);
+    }
+
+    void clear() noexcept
+    {
+        destroy(root, levels);
+        root = nullptr;
+        levels = 0;
+        head = nullptr;
+        sz = 0;
+    }
+
+    inline bool empty() const noexcept
+    {
+        return sz == 0;
+    }
+
+    inline const std::size_t& size() const noexcept
+    {
+        return sz;
+    }
+
+    // does nothing if k is already there, true if inserted
+    template<typename V = Value>
+    bool insert(Key k, V&& v)
+    {
+        return insert_util(k, std::forward<V>(v), false).second;
+    }
+
+    // Insert, or give k a new value. True if inserted
+    template<typename V = Value>
+    bool insert_or_assign(Key k, V&& v)
+    {
+        return insert_util(k, std::forward<V>(v), true).second;
+    }
+
+    // true if k was there
+    bool erase(Key k)
+    {
+        if (root == nullptr || !erase_util(root, levels, k)) return false;
+
+        --sz;
+
+        if (levels > 0 && static_cast<Inner*>(root)->n == 0) { // one child left
+            auto old = static_cast<Inner*>(root);
+            root = old->child[0];
+            --levels;
+            detail::delete_aligned_node(old);
+        }
+        else if (levels == 0 && static_cast<Leaf*>(root)->n == 0) {
+            detail::delete_aligned_node(static_cast<Leaf*>(root));
+            root = nullptr;
+            head = nullptr;
+        }
+
+        return true;
+    }
+
+    // Check if conatiner has an specific key
+    bool search(Key x) const noexcept
+    {
+        return find(x) != nullptr;
+    }
+
+    // pointer to the value of x, nullptr if x is not there
+    Value* find(Key x) noexcept
+    {
+        return const_cast<Value*>(static_cast<const WideAvlMap*>(this)->find(x));
+    }
+
+    const Value* find(Key x) const noexcept
+    {
+        if (root == nullptr) return nullptr;
+
+        const void* t = root;
+        for (auto h = levels; h > 0; --h) {
+            auto in = static_cast<const Inner*>(t);
+            t = in->child[count_less::run(in->keys, x)];
+        }
+
+        auto leaf = static_cast<const Leaf*>(t);
+        auto i = count_less::run(leaf->keys, x);
+
+        return (i < leaf->n && leaf->keys[i] == x) ? &leaf->values[i] : nullptr;
+    }
+
+    // access specified elem with checking
+    Value& at(Key x)
+    {
+        auto ptr = find(x);
+        if (ptr == nullptr) throw std::out_of_range("Elem not found error");
+        return *ptr;
+    }
+
+    const Value& at(Key x) const
+    {
+        auto ptr = find(x);
+        if (ptr == nullptr) throw std::out_of_range("Elem not found error");
+        return *ptr;
+    }
+
+    // value of x, inserted as Value() if x is not there
+    Value& operator[](Key x)
+    {
+        return *insert_util(x, Value(), false).first;
+    }
+
+    // Call fn(key, value) on every pair in order
+    template<typename F>
+    void for_each(F&& fn) const
+    {
+        for (auto leaf = head; leaf != nullptr; leaf = leaf->next)
+            for (std::size_t i = 0; i < leaf->n; ++i) fn(leaf->keys[i], leaf->values[i]);
+    }
+
+    /**
+     * Stream the map to os as "{(k, v), ...}", each pair written by
+     * fmt(OutputBuffer&, const std::pair<const Key&, const Value&>&).
+     * Output goes through a fixed buffer in large blocks.
+     */
+    template<typename F = TextFormat>
+    void write_to(std::ostream& os, F fmt = F()) const
+    {
+        auto walk = [this](auto& one) {
+            for_each([&one](const Key& k, const Value& v) {
+                one(std::pair<const Key&, const Value&>(k, v));
+            });
+        };
+        detail::write_list(os, walk, fmt);
+    }
+
+    void print() const
+    {
+        write_to(std::cout);
+    }
+
+private:
+    static std::size_t keys_in(const void* t, std::size_t level) noexcept
+    {
+        return level == 0 ? static_cast<const Leaf*>(t)->n : static_cast<const Inner*>(t)->n;
+    }
+
+    static std::size_t min_keys(std::size_t level) noexcept
+    {
+        return level == 0 ? MIN_LEAF : MIN_INNER;
+    }
+
+    static void destroy(void* t, std::size_t level) noexcept
+    {
+        if (t == nullptr) return;
+
+        if (level == 0) {
+            detail::delete_aligned_node(static_cast<Leaf*>(t));
+            return;
+        }
+
+        auto in = static_cast<Inner*>(t);
+        for (std::size_t i = 0; i <= in->n; ++i) destroy(in->child[i], level - 1);
+        detail::delete_aligned_node(in);
+    }
+
+    // Deep copy, leaves are chained in order through last
+    void* clone(const void* t, std::size_t level, Leaf*& last)
+    {
+        if (level == 0) {
+            auto src = static_cast<const Leaf*>(t);
+            auto leaf = detail::new_aligned_node<Leaf>();
+
+            try {
+                for (std::size_t i = 0; i < src->n; ++i) {
+                    leaf->keys[i] = src->keys[i];
+                    leaf->values[i] = src->values[i];
+                }
+            }
+            catch (...) {
+                detail::delete_aligned_node(leaf);
+                throw;
+            }
+
+            leaf->n = src->n;
+            if (last != nullptr) last->next = leaf;
+            else head = leaf;
+            last = leaf;
+
+            return leaf;
+        }
+
+        auto src = static_cast<const Inner*>(t);
+        auto in = detail::new_aligned_node<Inner>();
+
+        try {
+            for (std::size_t i = 0; i <= src->n; ++i) in->child[i] = clone(src->child[i], level - 1, last);
+        }
+        catch (...) {
+            for (auto c : in->child) destroy(c, level - 1);
+            detail::delete_aligned_node(in);
+            throw;
+        }
+
+        for (std::size_t i = 0; i < src->n; ++i) in->keys[i] = src->keys[i];
+        in->n = src->n;
+
+        return in;
+    }
+
+    /**
+     * Insert top-down, splitting every full node met on the way so the
+     * parent of a split always has room. Returns the slot of k's value
+     * and whether k is new.
+     */
+    template<typename V>
+    std::pair<Value*, bool> insert_util(Key k, V&& v, bool assign)
+    {
+        Value tmp (std::forward<V>(v)); // a throwing copy leaves the tree as it was
+
+        if (root == nullptr) {
+            head = detail::new_aligned_node<Leaf>();
+            root = head;
+            levels = 0;
+        }
+
+        if (keys_in(root, levels) == W) {
+            auto top = detail::new_aligned_node<Inner>();
+            top->child[0] = root;
+
+            try {
+                split_child(top, 0, levels);
+            }
+            catch (...) {
+                detail::delete_aligned_node(top);
+                throw;
+            }
+
+            root = top;
+            ++levels;
+        }
+
+        void* t = root;
+        for (auto h = levels; h > 0; --h) {
+            auto in = static_cast<Inner*>(t);
+            auto i = count_less::run(in->keys, k);
+
+            if (keys_in(in->child[i], h - 1) == W) {
+                split_child(in, i, h - 1);
+                if (in->keys[i] < k) ++i;
+            }
+
+            t = in->child[i];
+        }
+
+        auto leaf = static_cast<Leaf*>(t);
+        auto i = count_less::run(leaf->keys, k);
+
+        if (i < leaf->n && leaf->keys[i] == k) { // duplicate key
+            if (assign) leaf->values[i] = std::move(tmp);
+            return {&leaf->values[i], false};
+        }
+
+        for (auto j = leaf->n; j > i; --j) {
+            leaf->keys[j] = leaf->keys[j - 1];
+            leaf->values[j] = std::move(leaf->values[j - 1]);
+        }
+
+        leaf->keys[i] = k;
+        leaf->values[i] = std::move(tmp);
+        ++leaf->n;
+        ++sz;
+
+        return {&leaf->values[i], true};
+    }
+
+    // Put separator key and the new right sibling r after child i of p
+    static void insert_child(Inner* p, std::size_t i, Key key, void* r) noexcept
+    {
+        for (auto j = p->n; j > i; --j) {
+            p->keys[j] = p->keys[j - 1];
+            p->child[j + 1] = p->child[j];
+        }
+
+        p->keys[i] = key;
+        p->child[i + 1] = r;
+        ++p->n;
+    }
+
+    // Split the full child i of p in two halves, p must have room
+    static void split_child(Inner* p, std::size_t i, std::size_t level)
+    {
+        const std::size_t h = W / 2;
+
+        if (level == 0) {
+            auto l = static_cast<Leaf*>(p->child[i]);
+            auto r = detail::new_aligned_node<Leaf>();
+
+            for (std::size_t j = h; j < W; ++j) {
+                r->keys[j - h] = l->keys[j];
+                r->values[j - h] = std::move(l->values[j]);
+                l->keys[j] = detail::key_sentinel<Key>();
+            }
+
+            r->n = W - h;
+            l->n = h;
+            r->next = l->next;
+            l->next = r;
+
+            insert_child(p, i, l->keys[h - 1], r);
+            return;
+        }
+
+        auto l = static_cast<Inner*>(p->child[i]);
+        auto r = detail::new_aligned_node<Inner>();
+        Key up = l->keys[h];
+
+        for (std::size_t j = h + 1; j < W; ++j) r->keys[j - h - 1] = l->keys[j];
+        for (std::size_t j = h + 1; j <= W; ++j) r->child[j - h - 1] = l->child[j];
+        for (std::size_t j = h; j < W; ++j) l->keys[j] = detail::key_sentinel<Key>();
+
+        r->n = W - h - 1;
+        l->n = h;
+
+        insert_child(p, i, up, r);
+    }
+
+    // Remove k below t, then top up the child it came from if it ran low
+    bool erase_util(void* t, std::size_t level, Key k)
+    {
+        if (level == 0) {
+            auto leaf = static_cast<Leaf*>(t);
+            auto i = count_less::run(leaf->keys, k);
+
+            if (i >= leaf->n || leaf->keys[i] != k) return false;
+
+            remove_pair(leaf, i);
+            return true;
+        }
+
+        auto in = static_cast<Inner*>(t);
+        auto i = count_less::run(in->keys, k);
+
+        if (!erase_util(in->child[i], level - 1, k)) return false;
+
+        if (keys_in(in->child[i], level - 1) < min_keys(level - 1)) refill(in, i, level - 1);
+
+        return true;
+    }
+
+    static void remove_pair(Leaf* leaf, std::size_t i)
+    {
+        for (std::size_t j = i + 1; j < leaf->n; ++j) {
+            leaf->keys[j - 1] = leaf->keys[j];
+            leaf->values[j - 1] = std::move(leaf->values[j]);
+        }
+
+        --leaf->n;
+        leaf->keys[leaf->n] = detail::key_sentinel<Key>();
+        leaf->values[leaf->n] = Value(); // let go of what the old value held
+    }
+
+    // Child i of p is one key short: borrow from a sibling or merge with it
+    static void refill(Inner* p, std::size_t i, std::size_t level)
+    {
+        auto min = min_keys(level);
+
+        if (i > 0 && keys_in(p->child[i - 1], level) > min)
+            borrow_from_left(p, i, level);
+        else if (i < p->n && keys_in(p->child[i + 1], level) > min)
+            borrow_from_right(p, i, level);
+        else if (i > 0)
+            merge(p, i - 1, level);
+        else
+            merge(p, i, level);
+    }
+
+    static void borrow_from_left(Inner* p, std::size_t i, std::size_t level)
+    {
+        if (level == 0) {
+            auto l = static_cast<Leaf*>(p->child[i - 1]);
+            auto c = static_cast<Leaf*>(p->child[i]);
+
+            for (auto j = c->n; j > 0; --j) {
+                c->keys[j] = c->keys[j - 1];
+                c->values[j] = std::move(c->values[j - 1]);
+            }
+
+            c->keys[0] = l->keys[l->n - 1];
+            c->values[0] = std::move(l->values[l->n - 1]);
+            ++c->n;
+            remove_pair(l, l->n - 1);
+            p->keys[i - 1] = l->keys[l->n - 1];
+            return;
+        }
+
+        auto l = static_cast<Inner*>(p->child[i - 1]);
+        auto c = static_cast<Inner*>(p->child[i]);
+
+        for (auto j = c->n; j > 0; --j) c->keys[j] = c->keys[j - 1];
+        for (auto j = c->n + 1; j > 0; --j) c->child[j] = c->child[j - 1];
+
+        c->keys[0] = p->keys[i - 1];
+        c->child[0] = l->child[l->n];
+        ++c->n;
+
+        p->keys[i - 1] = l->keys[l->n - 1];
+        --l->n;
+        l->keys[l->n] = detail::key_sentinel<Key>();
+    }
+
+    static void borrow_from_right(Inner* p, std::size_t i, std::size_t level)
+    {
+        if (level == 0) {
+            auto c = static_cast<Leaf*>(p->child[i]);
+            auto r = static_cast<Leaf*>(p->child[i + 1]);
+
+            c->keys[c->n] = r->keys[0];
+            c->values[c->n] = std::move(r->values[0]);
+            ++c->n;
+            remove_pair(r, 0);
+            p->keys[i] = c->keys[c->n - 1];
+            return;
+        }
+
+        auto c = static_cast<Inner*>(p->child[i]);
+        auto r = static_cast<Inner*>(p->child[i + 1]);
+
+        c->keys[c->n] = p->keys[i];
+        c->child[c->n + 1] = r->child[0];
+        ++c->n;
+        p->keys[i] = r->keys[0];
+
+        for (std::size_t j = 1; j < r->n; ++j) r->keys[j - 1] = r->keys[j];
+        for (std::size_t j = 1; j <= r->n; ++j) r->child[j - 1] = r->child[j];
+
+        --r->n;
+        r->keys[r->n] = detail::key_sentinel<Key>();
+    }
+
+    // Fold child i + 1 of p into child i, both are at their minimum
+    static void merge(Inner* p, std::size_t i, std::size_t level)
+    {
+        if (level == 0) {
+            auto l = static_cast<Leaf*>(p->child[i]);
+            auto r = static_cast<Leaf*>(p->child[i + 1]);
+
+            for (std::size_t j = 0; j < r->n; ++j) {
+                l->keys[l->n + j] = r->keys[j];
+                l->values[l->n + j] = std::move(r->values[j]);
+            }
+
+            l->n += r->n;
+            l->next = r->next;
+            detail::delete_aligned_node(r);
+        }
+        else {
+            auto l = static_cast<Inner*>(p->child[i]);
+            auto r = static_cast<Inner*>(p->child[i + 1]);
+
+            l->keys[l->n] = p->keys[i];
+            for (std::size_t j = 0; j < r->n; ++j) l->keys[l->n + 1 + j] = r->keys[j];
+            for (std::size_t j = 0; j <= r->n; ++j) l->child[l->n + 1 + j] = r->child[j];
+
+            l->n += r->n + 1;
+            detail::delete_aligned_node(r);
+        }
+
+        for (std::size_t j = i + 1; j < p->n; ++j) {
+            p->keys[j - 1] = p->keys[j];
+            p->child[j] = p->child[j + 1];
+        }
+
+        --p->n;
+        p->keys[p->n] = detail::key_sentinel<Key>();
+    }
+
+}; // end of class WideAvlMap
+
+/**
+ * WideAvlMap where the key type allows it, AvlMap otherwise. Code using
+ * it should stick to what both offer: insert, insert_or_assign, erase,
+ * search, at, operator[], size, empty and clear.
+ */
+template<typename Key, typename Value>
+using FastAvlMap = std::conditional_t<detail::is_simd_key<Key>::value,
+                                      WideAvlMap<Key, Value>,
+                                      AvlMap<Key, Value>>;
+
+} // end of namespace Homebrew
+
+#endif // AVL_MAP_WIDE_HEADER_HPP
@@ -0,0 +1,355 @@
+#ifndef AVL_NODE_POOL_HPP
+#define AVL_NODE_POOL_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace Homebrew {
+
+namespace detail {
+
+/**
+ * Arena of fixed-size slots carved out of big slabs.
+ * Every slab is aligned to its own size and starts with a header pointing
+ * back to the arena, so a slot can be returned without knowing which
+ * arena (or which tree) it came from: just mask the address.
+ * Not thread-safe: one arena is meant to serve one container.
+ */
+class SlabArena {
+    struct SlabHeader {
+        SlabArena* owner;
+        SlabHeader* next;
+    };
+
+    struct FreeSlot {
+        FreeSlot* next;
+    };
+
+    std::size_t slot_size;
+    std::size_t slab_size;
+    SlabHeader* slabs;     // list of every slab owned
+    FreeSlot* free_list;   // slots given back by deallocate
+    char* cursor;          // bump pointer inside the newest slab
+    char* limit;
+    std::size_t refs;      // allocator handles sharing this arena
+    std::size_t live;      // slots currently handed out
+    std::size_t nslabs;    // length of the slabs list
+
+public:
+    SlabArena(std::size_t slot, std::size_t slab) noexcept
+        : slot_size{slot}, slab_size{slab}, slabs{nullptr},
+          free_list{nullptr}, cursor{nullptr}, limit{nullptr},
+          refs{1}, live{0}, nslabs{0} {}
+
+    SlabArena(const SlabArena&) = delete;
+    SlabArena& operator=(const SlabArena&) = delete;
+
+    ~SlabArena() noexcept
+    {
+        purge();
+    }
+
+    void* allocate()
+    {
+        ++live;
+
+        if (free_list != nullptr) {
+            FreeSlot* slot = free_list;
+            free_list = slot->next;
+            return slot;
+        }
+
+        if (cursor == limit) {
+            try { new_slab(); }
+            catch (...) { --live; throw; }
+        }
+
+        void* slot = cursor;
+        cursor += slot_size;
+        return slot;
+    }
+
+    // Give a slot back to the arena that handed it out
+    static void deallocate(void* p, std::size_t slab) noexcept
+    {
+        auto base = reinterpret_cast<std::uintptr_t>(p) & ~(std::uintptr_t(slab) - 1);
+        SlabArena* arena = reinterpret_cast<SlabHeader*>(base)->owner;
+
+        FreeSlot* slot = static_cast<FreeSlot*>(p);
+        slot->next = arena->free_list;
+        arena->free_list = slot;
+
+        if (--arena->live == 0 && arena->refs == 0) delete arena;
+    }
+
+    // Drop every slab at once, all the slots handed out are gone after this
+    void purge() noexcept
+    {
+        while (slabs != nullptr) {
+            SlabHeader* next = slabs->next;
+            free_slab(slabs);
+            slabs = next;
+        }
+        
+        nslabs = 0;
+        free_list = nullptr;
+        cursor = limit = nullptr;
+        live = 0;
+    }
+    
+    std::size_t in_use() const noexcept { return live; }
+    
+    // Bytes of every slab, headers and free slots included
+    std::size_t reserved() const noexcept { return nslabs * slab_size; }
+    
+    void retain() noexcept { ++refs; }
+
+    void release() noexcept
+    {
+        if (--refs == 0 && live == 0) delete this;
+    }
+
+private:
+    static std::size_t header_size(std::size_t slot) noexcept
+    {
+        // first slot starts on a slot boundary so alignment is preserved
+        return (sizeof(SlabHeader) + slot - 1) / slot * slot;
+    }
+
+    void new_slab()
+    {
+        void* mem = nullptr;
+#if defined(_MSC_VER)
+        mem = _aligned_malloc(slab_size, slab_size);
+#else
+        if (posix_memalign(&mem, slab_size, slab_size) != 0) mem = nullptr;
+#endif
+        if (mem == nullptr) throw std::bad_alloc();
+
+        SlabHeader* header = static_cast<SlabHeader*>(mem);
+        header->owner = this;
+        header->next = slabs;
+        slabs = header;
+        ++nslabs;
+
+        char* first = static_cast<char*>(mem) + header_size(slot_size);
+        cursor = first;
+        limit = first + (slab_size - header_size(slot_size)) / slot_size * slot_size;
+    }
+
+    static void free_slab(SlabHeader* slab) noexcept
+    {
+#if defined(_MSC_VER)
+        _aligned_free(slab);
+#else
+        std::free(slab);
+#endif
+    }
+};
+
+} // end of namespace detail
+
+/**
+ * Slab allocator for tree nodes.
+ * Single objects are handed out from contiguous slabs of SlabSize bytes
+ * and freed slots are reused by later allocations. Copies share the same
+ * arena; copying a container gets a fresh one. Requests for more than one
+ * object fall back to the global operator new.
+ */
+template<typename T, std::size_t SlabSize = 64 * 1024>
+class NodePool {
+    static_assert((SlabSize & (SlabSize - 1)) == 0, "SlabSize must be a power of two");
+
+    template<typename U, std::size_t S> friend class NodePool;
+
+    detail::SlabArena* arena;
+
+    static constexpr std::size_t slot_size() noexcept
+    {
+        // big enough for a free-list link, multiple of the alignment
+        return (std::max(sizeof(T), sizeof(void*)) + alignof(T) - 1) / alignof(T) * alignof(T);
+    }
+
+    detail::SlabArena* make_arena() const
+    {
+        static_assert(slot_size() * 8 <= SlabSize, "SlabSize too small for this type");
+        return new detail::SlabArena(slot_size(), SlabSize);
+    }
+
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+    using is_always_equal = std::false_type;
+
+    template<typename U>
+    struct rebind {
+        using other = NodePool<U, SlabSize>;
+    };
+
+    NodePool() : arena{nullptr} {}
+
+    NodePool(const NodePool& other) noexcept
+        : arena{other.arena}
+    {
+        if (arena != nullptr) arena->retain();
+    }
+
+    // rebinding changes the slot size, so it cannot share the arena
+    template<typename U>
+    NodePool(const NodePool<U, SlabSize>&) noexcept : NodePool() {}
+
+    NodePool(NodePool&& other) noexcept
+        : arena{other.arena}
+    {
+        other.arena = nullptr;
+    }
+
+    NodePool& operator=(NodePool other) noexcept
+    {
+        std::swap(arena, other.arena);
+        return *this;
+    }
+
+    ~NodePool() noexcept
+    {
+        if (arena != nullptr) arena->release();
+    }
+
+    NodePool select_on_container_copy_construction() const
+    {
+        return NodePool();
+    }
+
+    T* allocate(std::size_t n)
+    {
+        if (n != 1) return static_cast<T*>(::operator new(n * sizeof(T)));
+        if (arena == nullptr) arena = make_arena();
+        return static_cast<T*>(arena->allocate());
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        if (n != 1) ::operator delete(p);
+        else deallocate_slot(p);
+    }
+
+    // Stateless release of a single object, used by the node deleters
+    static void deallocate_slot(T* p) noexcept
+    {
+        detail::SlabArena::deallocate(p, SlabSize);
+    }
+
+    /**
+     * Release the whole arena in one go when the n objects the caller is
+     * about to abandon are the only ones alive in it. Their destructors are
+     * not run. Returns false (and does nothing) otherwise.
+     */
+    bool release_all(std::size_t n) noexcept
+    {
+        if (arena == nullptr || arena->in_use() != n) return false;
+        arena->purge();
+        return true;
+    }
+    
+    // Bytes of the slabs behind this pool, shared with its copies
+    std::size_t reserved_bytes() const noexcept
+    {
+        return arena == nullptr ? 0 : arena->reserved();
+    }
+    
+    friend void swap(NodePool& a, NodePool& b) noexcept
+    {
+        std::swap(a.arena, b.arena);
+    }
+
+    template<typename U>
+    bool operator==(const NodePool<U, SlabSize>& other) const noexcept
+    {
+        return static_cast<const void*>(arena) == static_cast<const void*>(other.arena);
+    }
+
+    template<typename U>
+    bool operator!=(const NodePool<U, SlabSize>& other) const noexcept
+    {
+        return !(*this == other);
+    }
+};
+
+namespace detail {
+
+/**
+ * Deleter of the owning child links.
+ * Stateless so the links stay as small as a plain pointer: allocators
+ * without state are rebuilt on the spot, pool slots find their own arena.
+ */
+template<typename NodeAlloc>
+struct NodeDeleter {
+    using traits = std::allocator_traits<NodeAlloc>;
+    using node_type = typename traits::value_type;
+
+    void operator()(node_type* p) const noexcept
+    {
+        static_assert(traits::is_always_equal::value,
+                      "Stateful allocators other than NodePool are not supported");
+        NodeAlloc a;
+        traits::destroy(a, p);
+        traits::deallocate(a, p, 1);
+    }
+};
+
+template<typename T, std::size_t SlabSize>
+struct NodeDeleter<NodePool<T, SlabSize>> {
+    void operator()(T* p) const noexcept
+    {
+        p->~T();
+        NodePool<T, SlabSize>::deallocate_slot(p);
+    }
+};
+
+/**
+ * Bulk teardown hook used by clear() and the destructors: only pools can
+ * drop all their nodes at once, any other allocator frees one by one.
+ */
+template<typename NodeAlloc>
+inline bool release_all(NodeAlloc&, std::size_t) noexcept
+{
+    return false;
+}
+
+template<typename T, std::size_t SlabSize>
+inline bool release_all(NodePool<T, SlabSize>& pool, std::size_t n) noexcept
+{
+    return pool.release_all(n);
+}
+
+/**
+ * Memory taken for n nodes, hook of memory_usage(). Other allocators are
+ * assumed to go to a malloc like heap: a size word in front of each
+ * block, rounded up to 16 bytes.
+ */
+template<typename NodeAlloc>
+inline std::size_t allocated_bytes(const NodeAlloc&, std::size_t n) noexcept
+{
+    using node_type = typename std::allocator_traits<NodeAlloc>::value_type;
+    return n * ((sizeof(node_type) + sizeof(std::size_t) + 15) / 16 * 16);
+}
+
+template<typename T, std::size_t SlabSize>
+inline std::size_t allocated_bytes(const NodePool<T, SlabSize>& pool, std::size_t) noexcept
+{
+    return pool.reserved_bytes();
+}
+
+} // end of namespace detail
+
+} // end of namespace Homebrew
+
+#endif // AVL_NODE_POOL_HPP
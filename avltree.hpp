@@ -5,6 +5,7 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <functional>
 #include <initializer_list>
 #include <iostream>
 #include <iterator>
@@ -12,27 +13,55 @@
 #include <stdexcept>
 #include <type_traits>
 #include <utility>
+#include <vector>
+
+#include "avlcommon.hpp"
+#include "avlnodepool.hpp"
 
 namespace Homebrew {
 
-template<typename T>
-class AvlTree {
+/**
+ * OrderStats keeps the size of every subtree in its root node, which
+ * enables nth(), rank() and count_range() in O(log n).
+ * Stats counts lookup comparisons, rotations, retraces and allocations,
+ * see stats(). Off, it adds neither space nor work.
+ */
+template<typename T, 
+         typename Compare = std::less<T>,
+         typename Alloc = std::allocator<T>,
+         bool OrderStats = false,
+         bool Stats = false>
+class AvlTree : private detail::StatsCounters<Stats> {
+    struct Node;
+    
+    // nodes are obtained through the (rebound) allocator
+    using NodeAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<Node>;
+    using NodeTraits = std::allocator_traits<NodeAlloc>;
+    using node_ptr = std::unique_ptr<Node, detail::NodeDeleter<NodeAlloc>>;
+    
     // node of the tree
-    struct Node {
-        std::unique_ptr<Node> left;
-        std::unique_ptr<Node> right;
+    struct Node : detail::SubtreeSize<OrderStats> {
+        node_ptr left;
+        node_ptr right;
+        Node* parent; // non owning, used by the iterators
         T data;
         std::int32_t height;
 
         template<typename X = T>
         Node(X&& ele,
-             std::unique_ptr<Node>&& lt,
-             std::unique_ptr<Node>&& rt,
+             node_ptr&& lt,
+             node_ptr&& rt,
              std::int32_t h = 0)
                 : left{std::move(lt)},
                   right{std::move(rt)},
+                  parent{nullptr},
                   data{std::forward<X>(ele)},
-                  height{h} {}
+                  height{h} 
+        {
+            if (left != nullptr) left->parent = this;
+            if (right != nullptr) right->parent = this;
+            update_size(*this);
+        }
                   
         operator T& () {return data;}
         operator const T& () const {return data;}
@@ -41,16 +70,160 @@ class AvlTree {
     };
     
     // top of the tree
-    std::unique_ptr<Node> root;
+    node_ptr root;
     
     // Number of elements
     std::size_t sz;
     
+    // Longest possible search path, AVL height is below 1.44 * log2(n + 2)
+    static constexpr std::size_t MAX_DEPTH = 96;
+    
+    // Set operations spawn a thread only for subtrees at least this high
+    static constexpr std::int32_t FORK_HEIGHT = 10;
+    
+    // Source of the nodes
+    NodeAlloc alloc;
+    
+    // Ordering of the elements
+    Compare comp;
+    
+    // Lookups with other types than T need a transparent comparator
+    template<typename K>
+    using enable_transparent = std::enable_if_t<detail::is_transparent<Compare>::value, K>;
+    
 public:
+    using value_type = T;
+    using key_compare = Compare;
+    using allocator_type = Alloc;
+    
+    /**
+     * Bidirectional iterator, walks the tree in order through the parent
+     * links: no allocation, amortized O(1) increment. Elements can't be
+     * modified in place as that would break the ordering.
+     */
+    class const_iterator {
+        friend class AvlTree;
+        
+        const Node* node;
+        const AvlTree* tree; // needed to step back from end()
+        
+        const_iterator(const Node* n, const AvlTree* t) noexcept
+            : node{n}, tree{t} {}
+        
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+        
+        const_iterator() noexcept : node{nullptr}, tree{nullptr} {}
+        
+        reference operator*() const noexcept { return node->data; }
+        pointer operator->() const noexcept { return &node->data; }
+        
+        const_iterator& operator++() noexcept
+        {
+            node = next(node);
+            return *this;
+        }
+        
+        const_iterator operator++(int) noexcept
+        {
+            auto tmp = *this;
+            ++*this;
+            return tmp;
+        }
+        
+        const_iterator& operator--() noexcept
+        {
+            node = (node == nullptr) ? tree->findMax(tree->root) : prev(node);
+            return *this;
+        }
+        
+        const_iterator operator--(int) noexcept
+        {
+            auto tmp = *this;
+            --*this;
+            return tmp;
+        }
+        
+        bool operator==(const const_iterator& other) const noexcept
+        {
+            return node == other.node;
+        }
+        
+        bool operator!=(const const_iterator& other) const noexcept
+        {
+            return node != other.node;
+        }
+    };
+    
+    using iterator = const_iterator;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+    using reverse_iterator = const_reverse_iterator;
+    
+    /**
+     * Owner of an element taken out with extract(), as in C++17.
+     * insert() links the node itself into a tree of the same type, nothing
+     * is allocated, copied or moved; the value can be changed in between.
+     */
+    class node_type {
+        friend class AvlTree;
+        
+        node_ptr node;
+        NodeAlloc alloc; // the one the node came from
+        
+        node_type(node_ptr n, const NodeAlloc& a) noexcept
+            : node{std::move(n)}, alloc{a} {}
+        
+    public:
+        using value_type = T;
+        using allocator_type = Alloc;
+        
+        node_type() noexcept : node{nullptr}, alloc{} {}
+        
+        node_type(node_type&&) noexcept = default;
+        node_type& operator=(node_type&&) noexcept = default;
+        
+        bool empty() const noexcept { return node == nullptr; }
+        explicit operator bool() const noexcept { return node != nullptr; }
+        
+        T& value() const noexcept { return node->data; }
+        
+        allocator_type get_allocator() const { return allocator_type(alloc); }
+        
+        friend void swap(node_type& a, node_type& b) noexcept
+        {
+            using std::swap;
+            swap(a.node, b.node);
+            swap(a.alloc, b.alloc);
+        }
+    };
+    
+    // Result of insert(node_type&&), node is given back if the value was there
+    struct insert_return_type {
+        iterator position;
+        bool inserted;
+        node_type node;
+    };
+    
     // constructors block
-    AvlTree() : root{nullptr}, sz{0} {}
+    AvlTree() : root{nullptr}, sz{0}, alloc{}, comp{} {}
+    
+    explicit AvlTree(const Compare& c, const Alloc& a = Alloc()) 
+        : root{nullptr}, sz{0}, alloc{a}, comp{c} {}
+    
+    explicit AvlTree(const Alloc& a) : root{nullptr}, sz{0}, alloc{a}, comp{} {}
+    
     AvlTree(const AvlTree& other)
-        : root{clone(other.root)}, sz{other.sz} {}
+        : root{nullptr}, 
+          sz{other.sz},
+          alloc{NodeTraits::select_on_container_copy_construction(other.alloc)},
+          comp{other.comp}
+    {
+        root = clone(other.root);
+    }
         
     AvlTree& operator=(const AvlTree& other) 
     {
@@ -58,25 +231,34 @@ public:
         AvlTree tmp (other);
         std::swap(root, tmp.root);
         std::swap(sz, tmp.sz);
+        std::swap(alloc, tmp.alloc);
+        std::swap(comp, tmp.comp);
 
         return *this;
     }
     
     AvlTree(AvlTree&& other) noexcept
-        : AvlTree()
+        : root{std::move(other.root)}, 
+          sz{other.sz}, 
+          alloc{std::move(other.alloc)},
+          comp{other.comp}
     {
-        std::swap(root, other.root);
-        std::swap(sz, other.sz);
+        other.sz = 0;
     }
     
     AvlTree& operator=(AvlTree&& other) noexcept
     {
         std::swap(root, other.root);
         std::swap(sz, other.sz);
+        std::swap(alloc, other.alloc);
+        std::swap(comp, other.comp);
         return *this;
     }
     
-    ~AvlTree() noexcept = default;
+    ~AvlTree() noexcept
+    {
+        destroy(std::move(root));
+    }
 
     template<typename Iter>
     AvlTree(Iter first, Iter last)
@@ -89,6 +271,25 @@ public:
             insert(*it);
         }
     }
+    
+    // O(n) bulk load, [first, last) must be sorted and free of duplicates
+    template<typename Iter>
+    AvlTree(sorted_unique_t, Iter first, Iter last)
+        : AvlTree()
+    {
+        using c_tp = typename std::iterator_traits<Iter>::value_type;
+        static_assert(std::is_constructible<T, c_tp>::value, "Type mismatch");
+        
+        auto n = static_cast<std::size_t>(std::distance(first, last));
+        root = build_sorted(first, n);
+        sz = n;
+    }
+    
+    template<typename Iter>
+    static AvlTree from_sorted(Iter first, Iter last)
+    {
+        return AvlTree(sorted_unique, first, last);
+    }
 
     AvlTree(const std::initializer_list<T>& lst)
         : AvlTree(std::begin(lst), std::end(lst)) {}
@@ -104,6 +305,8 @@ public:
         AvlTree tmp (std::forward<X>(lst));
         std::swap(root, tmp.root);
         std::swap(sz, tmp.sz);
+        std::swap(alloc, tmp.alloc);
+        std::swap(comp, tmp.comp);
 
         return *this;
     }
@@ -119,6 +322,53 @@ public:
         return sz;
     }
     
+    allocator_type get_allocator() const
+    {
+        return allocator_type(alloc);
+    }
+    
+    // Bytes held by the nodes and by the allocator around them
+    AvlMemoryUsage memory_usage() const noexcept
+    {
+        return {sz, sizeof(Node), sz * sizeof(Node), detail::allocated_bytes(alloc, sz)};
+    }
+    
+    /**
+     * Copy every node into fresh memory, laid out in the given order, and
+     * free the old one. Nodes come from a new allocator as for a copy, so
+     * a NodePool starts a new arena and the old one, holes left by erase
+     * included, is released whole. The shape of the tree is kept.
+     * Invalidates iterators and references. Strong exception guarantee.
+     */
+    void compact(NodeLayout layout = NodeLayout::in_order)
+    {
+        AvlTree tmp (comp, get_allocator());
+        tmp.alloc = NodeTraits::select_on_container_copy_construction(alloc);
+        
+        if (layout == NodeLayout::van_emde_boas) tmp.root = tmp.clone_veb(root);
+        else tmp.root = tmp.clone_in_order(root);
+        tmp.sz = sz;
+        
+        std::swap(root, tmp.root);
+        std::swap(alloc, tmp.alloc);
+    }
+    
+    key_compare key_comp() const
+    {
+        return comp;
+    }
+    
+    // Counters since construction or the last reset_stats(), all 0 without Stats
+    const AvlStats& stats() const noexcept
+    {
+        return this->counters();
+    }
+    
+    void reset_stats() noexcept
+    {
+        this->reset_counters();
+    }
+    
     template<typename X = T,
              typename... Args>
     void insert(X&& first, Args&&... args)
@@ -135,6 +385,29 @@ public:
         ++sz;
     }
     
+    /**
+     * Link an extracted node unless its value is already there.
+     * Nodes of an allocator comparing unequal to this one cannot be
+     * adopted, their element is moved into a new node instead.
+     */
+    insert_return_type insert(node_type&& nh)
+    {
+        if (nh.empty()) return {end(), false, node_type()};
+        
+        std::pair<Node*, bool> res;
+        
+        if (nh.alloc == alloc)
+            res = link_util(nh.value(), root, [&nh]() { return std::move(nh.node); });
+        else
+            res = link_util(nh.value(), root, [&nh, this]() {
+                return create_node(std::move(nh.value()), nullptr, nullptr);
+            });
+        ++sz;
+        
+        if (!res.second) return {const_iterator(res.first, this), false, std::move(nh)};
+        return {const_iterator(res.first, this), true, node_type()};
+    }
+    
     template<typename X = T,
              typename... Args>
     void remove(const X& first, Args&&... args) noexcept
@@ -150,6 +423,22 @@ public:
         --sz;
     }
     
+    // Unlink x and hand it over, empty if x is absent
+    node_type extract(const T& x) noexcept
+    {
+        node_type nh (remove_util(x, root), alloc);
+        --sz;
+        return nh;
+    }
+    
+    // Unlink the element at pos, found without a search
+    node_type extract(const_iterator pos) noexcept
+    {
+        node_type nh (remove_node(const_cast<Node*>(pos.node)), alloc);
+        --sz;
+        return nh;
+    }
+    
     const T& min_element() const
     {
         if (empty()) throw std::logic_error("Empty container");
@@ -164,156 +453,1168 @@ public:
     
     void clear() noexcept
     {
-        root.reset(nullptr);
+        destroy(std::move(root));
+        sz = 0;
+    }
+    
+    // Call fn on every element in order, without recursion
+    template<typename F>
+    void visit(F&& fn) const
+    {
+        detail::inorder<MAX_DEPTH>(static_cast<const Node*>(root.get()), fn);
+    }
+    
+    /**
+     * Stream the tree to os as "{a, b, ...}", each element written by
+     * fmt(OutputBuffer&, const T&). Output goes through a fixed buffer
+     * in large blocks, and the walk is a loop over a fixed stack.
+     */
+    template<typename F = TextFormat>
+    void write_to(std::ostream& os, F fmt = F()) const
+    {
+        detail::write_tree<MAX_DEPTH>(os, static_cast<const Node*>(root.get()), fmt);
     }
     
     void print() const noexcept
     {
-        if (empty()) std::cout << "{}\n";
-        else {
-            std::cout << "{";
-            print(root);
-            std::cout << "\b\b}\n";
-        }
+        write_to(std::cout);
     }
     
     bool search(const T& x) const noexcept
     {
         return search(x, root) != nullptr;
     }
+    
+    template<typename K, typename = enable_transparent<K>>
+    bool search(const K& x) const noexcept
+    {
+        return search(x, root) != nullptr;
+    }
+    
+    // iterator to the element equivalent to x, end() if there is none
+    const_iterator find(const T& x) const noexcept
+    {
+        return const_iterator(search(x, root), this);
+    }
+    
+    template<typename K, typename = enable_transparent<K>>
+    const_iterator find(const K& x) const noexcept
+    {
+        return const_iterator(search(x, root), this);
+    }
+    
+    // first element not less than x
+    const_iterator lower_bound(const T& x) const noexcept
+    {
+        return const_iterator(lower_node(x), this);
+    }
+    
+    template<typename K, typename = enable_transparent<K>>
+    const_iterator lower_bound(const K& x) const noexcept
+    {
+        return const_iterator(lower_node(x), this);
+    }
+    
+    // first element greater than x
+    const_iterator upper_bound(const T& x) const noexcept
+    {
+        return const_iterator(upper_node(x), this);
+    }
+    
+    template<typename K, typename = enable_transparent<K>>
+    const_iterator upper_bound(const K& x) const noexcept
+    {
+        return const_iterator(upper_node(x), this);
+    }
+    
+    std::pair<const_iterator, const_iterator> equal_range(const T& x) const noexcept
+    {
+        return {lower_bound(x), upper_bound(x)};
+    }
+    
+    template<typename K, typename = enable_transparent<K>>
+    std::pair<const_iterator, const_iterator> equal_range(const K& x) const noexcept
+    {
+        return {lower_bound(x), upper_bound(x)};
+    }
+    
+    /**
+     * Call fn on every element in [lo, hi), in order.
+     * One descent to the first element, then successor steps until hi:
+     * nothing outside the range is visited but the path to it.
+     */
+    template<typename F>
+    void for_each_in_range(const T& lo, const T& hi, F&& fn) const
+    {
+        for_each_util(lo, hi, fn);
+    }
+    
+    template<typename K, typename F, typename = enable_transparent<K>>
+    void for_each_in_range(const K& lo, const K& hi, F&& fn) const
+    {
+        for_each_util(lo, hi, fn);
+    }
+    
+    /**
+     * Insert a whole (forward) range at once. Iterators to the elements
+     * are sorted first, a recursive pass over the tree finds those already
+     * there and the others get a node, merged into the tree in a second
+     * pass; both only touch the subtrees the elements land in, so
+     * O(k log(n/k + 1)) after the O(k log k) sort. Elements already
+     * present are left alone and cost no allocation.
+     */
+    template<typename Iter>
+    void insert_batch(Iter first, Iter last)
+    {
+        std::vector<Iter> items;
+        for (auto it = first; it != last; std::advance(it, 1))
+            items.push_back(it);
+        sort_batch(items);
         
-private:
-    // recursive method to clone a tree
-    std::unique_ptr<Node> clone(const std::unique_ptr<Node>& node) const
+        // only the elements not in the tree yet get a node
+        std::vector<char> present (items.size(), 0);
+        Iter* base = items.data();
+        find_sorted(root.get(), base, base + items.size(), base, present);
+        
+        std::vector<node_ptr> batch;
+        batch.reserve(items.size());
+        for (std::size_t i = 0; i < items.size(); ++i)
+            if (!present[i]) batch.push_back(create_node(*items[i], nullptr, nullptr));
+        
+        // everything that can throw is above, the tree is untouched until here
+        std::size_t added = 0;
+        root = insert_sorted(std::move(root), batch.data(), batch.data() + batch.size(), added);
+        finish(sz + added);
+    }
+    
+    // Remove every element equivalent to one in the range, in a single pass
+    template<typename Iter>
+    void erase_batch(Iter first, Iter last)
     {
-        if (!node) return nullptr;
-        else
-            return std::make_unique<Node>(node->data, 
-                                          clone(node->left), 
-                                          clone(node->right), 
-                                          node->height);
+        std::vector<T> keys (first, last);
+        std::sort(keys.begin(), keys.end(), comp);
+        
+        std::size_t dropped = 0;
+        root = erase_sorted(std::move(root), keys.cbegin(), keys.cend(), dropped);
+        finish(sz - dropped);
     }
     
-    // Returns height of a node
-    inline std::int32_t height(const std::unique_ptr<Node>& node) const noexcept
+    // Set operations block
+    
+    /**
+     * Split and join rebuild balanced trees out of whole subtrees in
+     * O(log n), the set operations below recurse on them. Nodes are moved,
+     * never copied, unless the two trees use pools that don't compare equal.
+     */
+    
+    // Move the elements not less than x into the returned tree
+    // O(log n) with OrderStats, otherwise the part split off is counted
+    AvlTree split(const T& x)
     {
-        return node == nullptr ? -1 : node->height;
+        AvlTree res (comp);
+        res.alloc = alloc;
+        
+        SplitResult s;
+        try { s = split_util(std::move(root), x); }
+        catch (...) { finish(0); throw; }
+        
+        if (s.mid != nullptr) 
+            s.right = join_util(nullptr, std::move(s.mid), std::move(s.right));
+        
+        root = std::move(s.left);
+        res.root = std::move(s.right);
+        if (res.root != nullptr) res.root->parent = nullptr; // before walking it
+        res.finish(count_nodes(res.root));
+        finish(sz - res.sz);
+        
+        return res;
     }
     
-    // print tree inorder
-    void print(const std::unique_ptr<Node>& t) const noexcept
-    { 
-        if (t != nullptr) {
-            print(t->left);
-            std::cout << t->data << ", ";
-            print(t->right);
-        }
+    // Append other, all its elements must be greater than ours. O(log n)
+    void join(AvlTree& other)
+    {
+        if (this == &other) return;
+        
+        std::size_t n = sz + other.sz;
+        node_ptr r = take_nodes(other);
+        root = join2(std::move(root), std::move(r));
+        finish(n);
     }
     
-    // binary search an element in the tree
-    Node* search(const T& x, const std::unique_ptr<Node>& node) const noexcept
+    // Move the elements of other into this tree, duplicates are dropped
+    void merge(AvlTree& other)
     {
-        auto t = node.get();        
+        if (this == &other) return;
         
-        while(t != nullptr)
-            if(x < t->data)
-                t = t->left.get();
-            else if(t->data < x)
-                t = t->right.get();
-            else
-                return t;
-
-        return nullptr;
+        std::size_t n = sz + other.sz, dropped = 0;
+        node_ptr b = take_nodes(other);
+        try { root = union_util(std::move(root), std::move(b), fork_budget(), dropped); }
+        catch (...) { finish(0); throw; }
+        finish(n - dropped);
     }
     
-    // Recursive insert method 
-    template<typename X = T>
-    void insert_util(X&& x, std::unique_ptr<Node>& t)
-    {
-        if (t == nullptr)
-            t = std::make_unique<Node>(std::forward<X>(x), nullptr, nullptr);
-        else if (x < t->data)
-            insert_util(std::forward<X>(x), t->left);
-        else if (t->data < x)
-            insert_util(std::forward<X>(x), t->right);
-        else //duplicate key
-            --sz;
-            
-        balance(t);
+    /**
+     * Work-efficient divide and conquer: split one tree by the root of the
+     * other and recurse on both halves, on separate threads near the top.
+     * O(m log(n/m + 1)) work for sizes m <= n. Pass the operands with
+     * std::move to spare the copies. Should the comparator throw, the
+     * exception is passed on once every thread is done and the elements
+     * in flight are freed: merge() leaves both trees empty then, and
+     * split() the tree it was called on.
+     */
+    friend AvlTree set_union(AvlTree a, AvlTree b)
+    {
+        a.merge(b);
+        return a;
     }
     
-    // Recursive delete method
-    void remove_util(const T& x, std::unique_ptr<Node>& t) noexcept
+    friend AvlTree set_intersection(AvlTree a, AvlTree b)
     {
-        if(t == nullptr){
-            ++sz;
-            return;   // Item not found; do nothing
-        } 
+        std::size_t n = a.sz + b.sz, dropped = 0;
+        node_ptr t = a.take_nodes(b);
+        a.root = a.intersection_util(std::move(a.root), std::move(t), fork_budget(), dropped);
+        a.finish(n - dropped);
+        return a;
+    }
+    
+    // elements of a that are not in b
+    friend AvlTree set_difference(AvlTree a, AvlTree b)
+    {
+        std::size_t n = a.sz + b.sz, dropped = 0;
+        node_ptr t = a.take_nodes(b);
+        a.root = a.difference_util(std::move(a.root), std::move(t), fork_budget(), dropped);
+        a.finish(n - dropped);
+        return a;
+    }
+    
+    // Iterators block
+    const_iterator begin() const noexcept
+    {
+        return const_iterator(findMin(root), this);
+    }
+    
+    const_iterator end() const noexcept
+    {
+        return const_iterator(nullptr, this);
+    }
+    
+    const_iterator cbegin() const noexcept { return begin(); }
+    const_iterator cend() const noexcept { return end(); }
+    
+    const_reverse_iterator rbegin() const noexcept
+    {
+        return const_reverse_iterator(end());
+    }
+    
+    const_reverse_iterator rend() const noexcept
+    {
+        return const_reverse_iterator(begin());
+    }
+    
+    const_reverse_iterator crbegin() const noexcept { return rbegin(); }
+    const_reverse_iterator crend() const noexcept { return rend(); }
+    
+    // Order statistics block, needs OrderStats
+    
+    // k-th smallest element counting from 0, end() if k >= size()
+    const_iterator nth(std::size_t k) const noexcept
+    {
+        static_assert(OrderStats, "nth() needs the OrderStats parameter");
         
-        if(x < t->data)
-            remove_util(x, t->left);
-        else if(t->data < x)
-            remove_util(x, t->right);
-        else if(t->left != nullptr && t->right != nullptr) { // Two children
-            t->data = *findMin(t->right);
-            remove_util(t->data, t->right);
-        }
-        else { // One child
-            std::unique_ptr<Node> oldNode {std::move(t)};
-            t = (oldNode->left != nullptr) ? std::move(oldNode->left) : 
-                                             std::move(oldNode->right);
+        auto t = root.get();
+        
+        while (t != nullptr) {
+            auto l = subtree_size(t->left);
             
-            // oldNode.reset(nullptr); -> unneeded, auto delete when go out of scope
+            if (k < l)
+                t = t->left.get();
+            else if (k > l) {
+                k -= l + 1;
+                t = t->right.get();
+            }
+            else break;
         }
         
-        balance(t);
+        return const_iterator(t, this);
     }
     
-    // Find smallest elem in a tree
-    Node* findMin(const std::unique_ptr<Node>& node) const noexcept
+    // Number of elements smaller than x
+    std::size_t rank(const T& x) const noexcept
     {
-        auto t = node.get();
-
-        if(t != nullptr)
-            while (t->left != nullptr)
-                t = t->left.get();
-
-        return t;
+        return rank_util(x);
     }
-
-    // Find largest elem in a tree
-    Node* findMax(const std::unique_ptr<Node>& node) const noexcept
+    
+    template<typename K, typename = enable_transparent<K>>
+    std::size_t rank(const K& x) const noexcept
     {
-        auto t = node.get();
-
-        if(t != nullptr)
-            while (t->right != nullptr)
-                t = t->right.get();
-
-        return t;
+        return rank_util(x);
     }
-
-    // Internal method to re-balance the tree
-    void balance(std::unique_ptr<Node>& t) noexcept
+    
+    // Number of elements in [lo, hi)
+    std::size_t count_range(const T& lo, const T& hi) const noexcept
     {
-        static const int ALLOWED_IMBALANCE = 1;
+        return comp(lo, hi) ? rank_util(hi) - rank_util(lo) : 0;
+    }
+    
+    template<typename K, typename = enable_transparent<K>>
+    std::size_t count_range(const K& lo, const K& hi) const noexcept
+    {
+        return comp(lo, hi) ? rank_util(hi) - rank_util(lo) : 0;
+    }
         
-        if(t == nullptr) return;
+private:
+    // allocate and construct a node, the node_ptr takes care of the rest
+    template<typename... Args>
+    node_ptr create_node(Args&&... args)
+    {
+        Node* p = NodeTraits::allocate(alloc, 1);
+        this->count_allocation();
         
-        if(height(t->left) - height(t->right) > ALLOWED_IMBALANCE) {
-            if(height(t->left->left) >= height(t->left->right))
-                rotateWithLeftChild(t);
+        try {
+            NodeTraits::construct(alloc, p, std::forward<Args>(args)...);
+        }
+        catch (...) {
+            NodeTraits::deallocate(alloc, p, 1);
+            throw;
+        }
+        
+        return node_ptr{p};
+    }
+    
+    /**
+     * Iterative teardown of a whole tree with O(1) extra space.
+     * Left children are rotated up into the right spine, so every node is
+     * freed once it has no left child, no recursion involved. When the node
+     * pool holds nothing but this tree it is dropped in one go instead.
+     */
+    void destroy(node_ptr t) noexcept
+    {
+        if (t == nullptr) return;
+        
+        if (std::is_trivially_destructible<T>::value &&
+            detail::release_all(alloc, sz)) {
+            t.release();
+            return;
+        }
+        
+        while (t != nullptr) {
+            if (t->left != nullptr) {
+                node_ptr l = std::move(t->left);
+                t->left = std::move(l->right);
+                l->right = std::move(t);
+                t = std::move(l);
+            }
+            else {
+                t = std::move(t->right);
+            }
+        }
+    }
+    
+    /**
+     * Build a perfectly balanced tree out of the next n elements of a
+     * sorted range, consumed in order. O(n), recursion depth is log n.
+     */
+    template<typename Iter>
+    node_ptr build_sorted(Iter& it, std::size_t n)
+    {
+        if (n == 0) return nullptr;
+        
+        auto left = build_sorted(it, (n - 1) / 2);
+        auto t = create_node(*it, std::move(left), nullptr);
+        ++it;
+        
+        t->right = build_sorted(it, n - 1 - (n - 1) / 2);
+        if (t->right != nullptr) t->right->parent = t.get();
+        t->height = std::max(height(t->left), height(t->right)) + 1;
+        update_size(*t);
+        
+        return t;
+    }
+    
+    // recursive method to clone a tree
+    node_ptr clone(const node_ptr& node)
+    {
+        if (!node) return nullptr;
+        else
+            return create_node(node->data, 
+                               clone(node->left), 
+                               clone(node->right), 
+                               node->height);
+    }
+    
+    // Clone allocating the nodes in key order
+    node_ptr clone_in_order(const node_ptr& node)
+    {
+        if (!node) return nullptr;
+        
+        auto left = clone_in_order(node->left);
+        auto t = create_node(node->data, std::move(left), nullptr, node->height);
+        
+        t->right = clone_in_order(node->right);
+        if (t->right != nullptr) t->right->parent = t.get();
+        update_size(*t);
+        
+        return t;
+    }
+    
+    // Link of a node copied by clone_veb() still to be filled
+    struct Hanging {
+        Node* parent;
+        node_ptr Node::* side;
+        const Node* source;
+    };
+    
+    node_ptr clone_veb(const node_ptr& node)
+    {
+        if (!node) return nullptr;
+        
+        std::vector<Hanging> below;
+        return clone_veb(node.get(), height(node) + 1, below);
+    }
+    
+    /**
+     * Clone of the top levels of t in van Emde Boas order: the upper half
+     * of them first, then each subtree hanging below it. Children past the
+     * last level are left empty and queued in below, left to right.
+     */
+    node_ptr clone_veb(const Node* t, std::int32_t levels, std::vector<Hanging>& below)
+    {
+        if (levels == 1) {
+            auto n = create_node(t->data, nullptr, nullptr, t->height);
+            n->set_subtree_size(t->subtree_size());
+            
+            if (t->left != nullptr) below.push_back({n.get(), &Node::left, t->left.get()});
+            if (t->right != nullptr) below.push_back({n.get(), &Node::right, t->right.get()});
+            return n;
+        }
+        
+        std::int32_t lower = levels / 2;
+        std::vector<Hanging> middle;
+        auto top = clone_veb(t, levels - lower, middle);
+        
+        for (const Hanging& h : middle) {
+            node_ptr& link = h.parent->*h.side;
+            link = clone_veb(h.source, lower, below);
+            link->parent = h.parent;
+        }
+        
+        return top;
+    }
+    
+    // Returns height of a node
+    inline std::int32_t height(const node_ptr& node) const noexcept
+    {
+        return node == nullptr ? -1 : node->height;
+    }
+    
+    // Returns element count of a subtree, 0 without OrderStats
+    static std::size_t subtree_size(const node_ptr& node) noexcept
+    {
+        return node == nullptr ? 0 : node->subtree_size();
+    }
+    
+    static void update_size(Node& t) noexcept
+    {
+        if (OrderStats) t.set_subtree_size(subtree_size(t.left) + subtree_size(t.right) + 1);
+    }
+    
+    // Count the elements below x in a single descent
+    template<typename K>
+    std::size_t rank_util(const K& x) const noexcept
+    {
+        static_assert(OrderStats, "rank() needs the OrderStats parameter");
+        
+        std::size_t r = 0;
+        auto t = root.get();
+        
+        while (t != nullptr)
+            if (comp(t->data, x)) {
+                r += subtree_size(t->left) + 1;
+                t = t->right.get();
+            }
             else
+                t = t->left.get();
+        
+        return r;
+    }
+    
+    // binary search an element in the tree
+    template<typename K>
+    Node* search(const K& x, const node_ptr& node) const noexcept
+    {
+        auto t = node.get();        
+        std::uint64_t comparisons = 0; // dead code without Stats
+        auto less = [&](const auto& a, const auto& b) { ++comparisons; return comp(a, b); };
+        
+        while(t != nullptr)
+            if(less(x, t->data))
+                t = t->left.get();
+            else if(less(t->data, x))
+                t = t->right.get();
+            else
+                break;
+
+        this->count_search(comparisons);
+        return t;
+    }
+    
+    // lowest node not less than x
+    template<typename K>
+    Node* lower_node(const K& x) const noexcept
+    {
+        Node* res = nullptr;
+        auto t = root.get();
+        
+        while (t != nullptr)
+            if (comp(t->data, x))
+                t = t->right.get();
+            else {
+                res = t;
+                t = t->left.get();
+            }
+            
+        return res;
+    }
+    
+    // lowest node greater than x
+    template<typename K>
+    Node* upper_node(const K& x) const noexcept
+    {
+        Node* res = nullptr;
+        auto t = root.get();
+        
+        while (t != nullptr)
+            if (comp(x, t->data)) {
+                res = t;
+                t = t->left.get();
+            }
+            else
+                t = t->right.get();
+            
+        return res;
+    }
+    
+    template<typename K, typename F>
+    void for_each_util(const K& lo, const K& hi, F& fn) const
+    {
+        for (const Node* t = lower_node(lo); t != nullptr && comp(t->data, hi); t = next(t))
+            fn(t->data);
+    }
+    
+    // Insert x unless it is already there
+    template<typename X = T>
+    void insert_util(X&& x, node_ptr& t)
+    {
+        link_util(x, t, [&]() { return create_node(std::forward<X>(x), nullptr, nullptr); });
+    }
+    
+    /**
+     * Iterative insert method, single descent looking for x.
+     * Only when x is absent make_node() is called and its node linked
+     * in the empty slot. Returns the node holding x and whether it is new.
+     * The search path is recorded in a fixed-size stack of slots, then
+     * retraced bottom-up only as long as subtree heights keep changing.
+     */
+    template<typename K, typename F>
+    std::pair<Node*, bool> link_util(const K& x, node_ptr& t, F&& make_node)
+    {
+        node_ptr* path[MAX_DEPTH];
+        std::size_t depth = 0;
+        node_ptr* slot = &t;
+        Node* parent = nullptr;
+        
+        while (*slot != nullptr) {
+            parent = slot->get();
+            path[depth++] = slot;
+            
+            if (comp(x, parent->data))
+                slot = &parent->left;
+            else if (comp(parent->data, x))
+                slot = &parent->right;
+            else { //duplicate key
+                --sz;
+                return {parent, false};
+            }
+        }
+        
+        *slot = make_node();
+        (*slot)->parent = parent;
+        Node* ret = slot->get();
+        
+        retrace(path, depth);
+        return {ret, true};
+    }
+    
+    // Iterative delete method, returns the unlinked node as a lone leaf
+    node_ptr remove_util(const T& x, node_ptr& t) noexcept
+    {
+        node_ptr* path[MAX_DEPTH];
+        std::size_t depth = 0;
+        node_ptr* slot = &t;
+        
+        while (*slot != nullptr) {
+            Node* n = slot->get();
+            
+            if (comp(x, n->data)) {
+                path[depth++] = slot;
+                slot = &n->left;
+            }
+            else if (comp(n->data, x)) {
+                path[depth++] = slot;
+                slot = &n->right;
+            }
+            else break;
+        }
+        
+        if (*slot == nullptr) {
+            ++sz;
+            return nullptr;   // Item not found; do nothing
+        }
+        
+        return unlink_at(slot, path, depth);
+    }
+    
+    // remove_util() of the node t itself, its path rebuilt from the parent links
+    node_ptr remove_node(Node* t) noexcept
+    {
+        node_ptr* path[MAX_DEPTH];
+        std::size_t depth = 0;
+        
+        for (Node* p = t->parent; p != nullptr; p = p->parent)
+            path[depth++] = &slot_of(p);
+        std::reverse(path, path + depth);
+        
+        return unlink_at(&slot_of(t), path, depth);
+    }
+    
+    /**
+     * Unlink the node in *slot, found through the slots in path (root
+     * first), and rebalance; no comparisons. Returns it as a lone leaf.
+     */
+    node_ptr unlink_at(node_ptr* slot, node_ptr** path, std::size_t depth) noexcept
+    {
+        node_ptr oldNode {std::move(*slot)};
+        
+        if (oldNode->left != nullptr && oldNode->right != nullptr) { // Two children
+            // the successor node takes the place of *slot, data is not touched
+            std::size_t pos = depth;
+            path[depth++] = slot;
+            node_ptr* sslot = &oldNode->right;
+            
+            while ((*sslot)->left != nullptr) {
+                path[depth++] = sslot;
+                sslot = &(*sslot)->left;
+            }
+            
+            node_ptr succ {std::move(*sslot)};
+            *sslot = std::move(succ->right);
+            if (*sslot != nullptr) (*sslot)->parent = succ->parent;
+            
+            succ->parent = oldNode->parent;
+            succ->height = oldNode->height;
+            succ->left = std::move(oldNode->left);
+            succ->left->parent = succ.get();
+            succ->right = std::move(oldNode->right);
+            if (succ->right != nullptr) succ->right->parent = succ.get();
+            *slot = std::move(succ);
+            
+            // the slot right below the removed node now belongs to succ
+            if (pos + 1 < depth) path[pos + 1] = &(*slot)->right;
+        }
+        else { // One child
+            *slot = (oldNode->left != nullptr) ? std::move(oldNode->left) : 
+                                                 std::move(oldNode->right);
+            if (*slot != nullptr) (*slot)->parent = oldNode->parent;
+        }
+        
+        retrace(path, depth);
+        
+        // dropped by the caller unless extract() keeps it
+        oldNode->parent = nullptr;
+        oldNode->height = 0;
+        update_size(*oldNode);
+        return oldNode;
+    }
+    
+    /**
+     * Rebalance the recorded search path from the bottom up.
+     * Once a subtree ends up with the height it had before the update
+     * nothing above it can change, so the walk stops there; only subtree
+     * sizes (with OrderStats) still need fixing up to the root.
+     */
+    void retrace(node_ptr** path, std::size_t depth) noexcept
+    {
+        std::uint64_t steps = 0;
+        
+        while (depth > 0) {
+            node_ptr& t = *path[--depth];
+            auto old_height = t->height;
+            
+            balance(t);
+            ++steps;
+            
+            if (t->height == old_height) break;
+        }
+        
+        this->count_retrace(steps);
+        
+        if (OrderStats)
+            while (depth > 0) update_size(**path[--depth]);
+    }
+    
+    // The link owning t: its parent's left or right, or root
+    node_ptr& slot_of(Node* t) noexcept
+    {
+        Node* p = t->parent;
+        if (p == nullptr) return root;
+        return (p->left.get() == t) ? p->left : p->right;
+    }
+    
+    // Split and join block
+    
+    struct SplitResult {
+        node_ptr left;  // elements less than the key
+        node_ptr mid;   // lone node equivalent to the key, if any
+        node_ptr right; // elements greater than the key
+    };
+    
+    // Detach the children of t, leaving a lone node
+    static void unlink(Node& t, node_ptr& l, node_ptr& r) noexcept
+    {
+        l = std::move(t.left);
+        r = std::move(t.right);
+        t.height = 0;
+        update_size(t);
+    }
+    
+    // AVL join: everything in l is before k, everything in r after it
+    node_ptr join_util(node_ptr l, node_ptr k, node_ptr r) noexcept
+    {
+        if (height(l) > height(r) + 1) 
+            return join_right(std::move(l), std::move(k), std::move(r));
+        if (height(r) > height(l) + 1) 
+            return join_left(std::move(l), std::move(k), std::move(r));
+        
+        k->left = std::move(l);
+        k->right = std::move(r);
+        if (k->left != nullptr) k->left->parent = k.get();
+        if (k->right != nullptr) k->right->parent = k.get();
+        balance(k);
+        
+        return k;
+    }
+    
+    // l is the taller one: walk down its right spine to r's height
+    node_ptr join_right(node_ptr l, node_ptr k, node_ptr r) noexcept
+    {
+        if (height(l->right) <= height(r) + 1) {
+            k->left = std::move(l->right);
+            k->right = std::move(r);
+            if (k->left != nullptr) k->left->parent = k.get();
+            if (k->right != nullptr) k->right->parent = k.get();
+            balance(k);
+        }
+        else k = join_right(std::move(l->right), std::move(k), std::move(r));
+        
+        l->right = std::move(k);
+        l->right->parent = l.get();
+        balance(l);
+        
+        return l;
+    }
+    
+    node_ptr join_left(node_ptr l, node_ptr k, node_ptr r) noexcept
+    {
+        if (height(r->left) <= height(l) + 1) {
+            k->left = std::move(l);
+            k->right = std::move(r->left);
+            if (k->left != nullptr) k->left->parent = k.get();
+            if (k->right != nullptr) k->right->parent = k.get();
+            balance(k);
+        }
+        else k = join_left(std::move(l), std::move(k), std::move(r->left));
+        
+        r->left = std::move(k);
+        r->left->parent = r.get();
+        balance(r);
+        
+        return r;
+    }
+    
+    // join without a middle node: the largest one of l takes that role
+    node_ptr join2(node_ptr l, node_ptr r) noexcept
+    {
+        if (l == nullptr) return r;
+        
+        node_ptr k = extract_max(l);
+        return join_util(std::move(l), std::move(k), std::move(r));
+    }
+    
+    node_ptr extract_max(node_ptr& t) noexcept
+    {
+        if (t->right == nullptr) {
+            node_ptr k {std::move(t)};
+            t = std::move(k->left);
+            if (t != nullptr) t->parent = k->parent;
+            k->height = 0;
+            update_size(*k);
+            return k;
+        }
+        
+        node_ptr k = extract_max(t->right);
+        balance(t);
+        return k;
+    }
+    
+    template<typename K>
+    SplitResult split_util(node_ptr t, const K& x)
+    {
+        if (t == nullptr) return {};
+        
+        node_ptr l, r;
+        unlink(*t, l, r);
+        
+        if (comp(x, t->data)) {
+            auto s = split_util(std::move(l), x);
+            s.right = join_util(std::move(s.right), std::move(t), std::move(r));
+            return s;
+        }
+        if (comp(t->data, x)) {
+            auto s = split_util(std::move(r), x);
+            s.left = join_util(std::move(l), std::move(t), std::move(s.left));
+            return s;
+        }
+        
+        return {std::move(l), std::move(t), std::move(r)};
+    }
+    
+    // Sort iterators to the new elements keeping the first of equivalent ones
+    template<typename Iter>
+    void sort_batch(std::vector<Iter>& items)
+    {
+        auto less = [&](const Iter& a, const Iter& b) { return comp(*a, *b); };
+        auto same = [&](const Iter& a, const Iter& b) { return !comp(*a, *b); };
+        
+        std::stable_sort(items.begin(), items.end(), less);
+        items.erase(std::unique(items.begin(), items.end(), same), items.end());
+    }
+    
+    // Flag in present the elements of the sorted [first, last) already under t
+    template<typename Iter>
+    void find_sorted(const Node* t, Iter* first, Iter* last, Iter* base, std::vector<char>& present) const
+    {
+        if (t == nullptr || first == last) return;
+        
+        auto mid = std::lower_bound(first, last, t->data,
+                                    [&](const Iter& i, const T& x) { return comp(*i, x); });
+        auto after = mid;
+        
+        if (mid != last && !comp(t->data, **mid)) {
+            present[static_cast<std::size_t>(mid - base)] = 1;
+            ++after;
+        }
+        
+        find_sorted(t->left.get(), first, mid, base, present);
+        find_sorted(t->right.get(), after, last, base, present);
+    }
+    
+    // Balanced tree out of n sorted lone nodes, no allocation
+    node_ptr link_sorted(node_ptr* first, std::size_t n) noexcept
+    {
+        if (n == 0) return nullptr;
+        
+        std::size_t half = (n - 1) / 2;
+        node_ptr t {std::move(first[half])};
+        
+        t->left = link_sorted(first, half);
+        t->right = link_sorted(first + half + 1, n - 1 - half);
+        if (t->left != nullptr) t->left->parent = t.get();
+        if (t->right != nullptr) t->right->parent = t.get();
+        balance(t);
+        
+        return t;
+    }
+    
+    // Merge sorted lone nodes into t, the ones already there are dropped
+    node_ptr insert_sorted(node_ptr t, node_ptr* first, node_ptr* last, std::size_t& added) noexcept
+    {
+        if (first == last) return t;
+        
+        if (t == nullptr) {
+            added += static_cast<std::size_t>(last - first);
+            return link_sorted(first, static_cast<std::size_t>(last - first));
+        }
+        
+        node_ptr l, r;
+        unlink(*t, l, r);
+        
+        auto mid = std::lower_bound(first, last, t->data, 
+                                    [&](const node_ptr& n, const T& x) { return comp(n->data, x); });
+        auto after = mid;
+        
+        if (mid != last && !comp(t->data, (*mid)->data)) { // duplicate
+            mid->reset();
+            ++after;
+        }
+        
+        l = insert_sorted(std::move(l), first, mid, added);
+        r = insert_sorted(std::move(r), after, last, added);
+        
+        return join_util(std::move(l), std::move(t), std::move(r));
+    }
+    
+    // Drop from t every element found in the sorted range [first, last)
+    template<typename Iter>
+    node_ptr erase_sorted(node_ptr t, Iter first, Iter last, std::size_t& dropped) noexcept
+    {
+        if (t == nullptr || first == last) return t;
+        
+        node_ptr l, r;
+        unlink(*t, l, r);
+        
+        auto mid = std::lower_bound(first, last, t->data, comp);
+        bool found = (mid != last && !comp(t->data, *mid));
+        
+        l = erase_sorted(std::move(l), first, mid, dropped);
+        r = erase_sorted(std::move(r), found ? std::next(mid) : mid, last, dropped);
+        
+        if (found) {
+            t.reset();
+            ++dropped;
+            return join2(std::move(l), std::move(r));
+        }
+        
+        return join_util(std::move(l), std::move(t), std::move(r));
+    }
+    
+    // Root of the result of a split or join
+    void finish(std::size_t n) noexcept
+    {
+        sz = n;
+        if (root != nullptr) root->parent = nullptr;
+    }
+    
+    std::size_t count_nodes(const node_ptr& t) const noexcept
+    {
+        if (OrderStats) return subtree_size(t);
+        
+        std::size_t n = 0;
+        for (const Node* p = findMin(t); p != nullptr; p = next(p)) ++n;
+        return n;
+    }
+    
+    // Free a whole subtree and tell how many nodes it had
+    static std::size_t discard(node_ptr t) noexcept
+    {
+        std::size_t n = 0;
+        
+        while (t != nullptr) {
+            if (t->left != nullptr) {
+                node_ptr l = std::move(t->left);
+                t->left = std::move(l->right);
+                l->right = std::move(t);
+                t = std::move(l);
+            }
+            else {
+                t = std::move(t->right);
+                ++n;
+            }
+        }
+        
+        return n;
+    }
+    
+    // All the nodes of other, copied if they can't be freed by our pool
+    node_ptr take_nodes(AvlTree& other)
+    {
+        if (alloc == other.alloc) {
+            other.sz = 0;
+            return std::move(other.root);
+        }
+        
+        auto it = other.begin();
+        node_ptr t = build_sorted(it, other.sz);
+        other.clear();
+        
+        return t;
+    }
+    
+    /**
+     * Levels of the set operations that may run on two threads. None when
+     * the nodes come from a pool, as the arenas are not thread-safe, nor
+     * with Stats, whose counters aren't either.
+     */
+    static int fork_budget() noexcept
+    {
+        if (!NodeTraits::is_always_equal::value || Stats) return 0;
+        return detail::fork_depth();
+    }
+    
+    node_ptr union_util(node_ptr a, node_ptr b, int budget, std::size_t& dropped)
+    {
+        if (a == nullptr) return b;
+        if (b == nullptr) return a;
+        
+        bool parallel = budget > 0 && std::max(height(a), height(b)) >= FORK_HEIGHT;
+        node_ptr l, r;
+        unlink(*a, l, r);
+        
+        auto s = split_util(std::move(b), a->data);
+        if (s.mid != nullptr) {
+            s.mid.reset();
+            ++dropped;
+        }
+        
+        std::size_t dl = 0, dr = 0;
+        auto left = [&] { l = union_util(std::move(l), std::move(s.left), budget - 1, dl); };
+        auto right = [&] { r = union_util(std::move(r), std::move(s.right), budget - 1, dr); };
+        detail::fork2(parallel, left, right);
+        dropped += dl + dr;
+        
+        return join_util(std::move(l), std::move(a), std::move(r));
+    }
+    
+    node_ptr intersection_util(node_ptr a, node_ptr b, int budget, std::size_t& dropped)
+    {
+        if (a == nullptr || b == nullptr) {
+            dropped += discard(std::move(a)) + discard(std::move(b));
+            return nullptr;
+        }
+        
+        bool parallel = budget > 0 && std::max(height(a), height(b)) >= FORK_HEIGHT;
+        node_ptr l, r;
+        unlink(*a, l, r);
+        
+        auto s = split_util(std::move(b), a->data);
+        
+        std::size_t dl = 0, dr = 0;
+        auto left = [&] { l = intersection_util(std::move(l), std::move(s.left), budget - 1, dl); };
+        auto right = [&] { r = intersection_util(std::move(r), std::move(s.right), budget - 1, dr); };
+        detail::fork2(parallel, left, right);
+        dropped += dl + dr + 1;
+        
+        if (s.mid != nullptr) {
+            s.mid.reset();
+            return join_util(std::move(l), std::move(a), std::move(r));
+        }
+        
+        a.reset();
+        return join2(std::move(l), std::move(r));
+    }
+    
+    node_ptr difference_util(node_ptr a, node_ptr b, int budget, std::size_t& dropped)
+    {
+        if (a == nullptr) {
+            dropped += discard(std::move(b));
+            return nullptr;
+        }
+        if (b == nullptr) return a;
+        
+        bool parallel = budget > 0 && std::max(height(a), height(b)) >= FORK_HEIGHT;
+        node_ptr l, r;
+        unlink(*b, l, r);
+        
+        auto s = split_util(std::move(a), b->data);
+        b.reset();
+        ++dropped;
+        if (s.mid != nullptr) {
+            s.mid.reset();
+            ++dropped;
+        }
+        
+        std::size_t dl = 0, dr = 0;
+        auto left = [&] { s.left = difference_util(std::move(s.left), std::move(l), budget - 1, dl); };
+        auto right = [&] { s.right = difference_util(std::move(s.right), std::move(r), budget - 1, dr); };
+        detail::fork2(parallel, left, right);
+        dropped += dl + dr;
+        
+        return join2(std::move(s.left), std::move(s.right));
+    }
+    
+    // Find smallest elem in a tree
+    Node* findMin(const node_ptr& node) const noexcept
+    {
+        auto t = node.get();
+
+        if(t != nullptr)
+            while (t->left != nullptr)
+                t = t->left.get();
+
+        return t;
+    }
+
+    // Find largest elem in a tree
+    Node* findMax(const node_ptr& node) const noexcept
+    {
+        auto t = node.get();
+
+        if(t != nullptr)
+            while (t->right != nullptr)
+                t = t->right.get();
+
+        return t;
+    }
+
+    // In order successor of t, nullptr past the largest one
+    static const Node* next(const Node* t) noexcept
+    {
+        if (t->right != nullptr) {
+            t = t->right.get();
+            while (t->left != nullptr) t = t->left.get();
+            return t;
+        }
+        
+        while (t->parent != nullptr && t == t->parent->right.get())
+            t = t->parent;
+            
+        return t->parent;
+    }
+    
+    // In order predecessor of t, nullptr before the smallest one
+    static const Node* prev(const Node* t) noexcept
+    {
+        if (t->left != nullptr) {
+            t = t->left.get();
+            while (t->right != nullptr) t = t->right.get();
+            return t;
+        }
+        
+        while (t->parent != nullptr && t == t->parent->left.get())
+            t = t->parent;
+            
+        return t->parent;
+    }
+    
+    // Internal method to re-balance the tree
+    void balance(node_ptr& t) noexcept
+    {
+        static const int ALLOWED_IMBALANCE = 1;
+        
+        if(t == nullptr) return;
+        
+        if(height(t->left) - height(t->right) > ALLOWED_IMBALANCE) {
+            if(height(t->left->left) >= height(t->left->right)) {
+                rotateWithLeftChild(t);
+                this->count_rotation(&AvlStats::rotate_with_left_child);
+            }
+            else {
                 doubleWithLeftChild(t);
+                this->count_rotation(&AvlStats::double_with_left_child);
+            }
         }
         else if(height(t->right) - height(t->left) > ALLOWED_IMBALANCE) {
-            if(height(t->right->right) >= height(t->right->left))
+            if(height(t->right->right) >= height(t->right->left)) {
                 rotateWithRightChild(t);
-            else
+                this->count_rotation(&AvlStats::rotate_with_right_child);
+            }
+            else {
                 doubleWithRightChild(t);
+                this->count_rotation(&AvlStats::double_with_right_child);
+            }
         }
         
         t->height = std::max(height(t->left), height(t->right)) + 1;
+        update_size(*t);
     }
     
     // Rotations block
@@ -323,12 +1624,17 @@ private:
      * For AVL trees, this is a single rotation for case 1.
      * Update heights, then set new root.
      */
-    void rotateWithLeftChild(std::unique_ptr<Node>& k2) noexcept
+    void rotateWithLeftChild(node_ptr& k2) noexcept
     {
         auto k1 = std::move(k2->left);
         k2->left = std::move(k1->right);
+        if (k2->left != nullptr) k2->left->parent = k2.get();
+        k1->parent = k2->parent;
+        k2->parent = k1.get();
         k2->height = std::max(height(k2->left), height(k2->right)) + 1;
         k1->height = std::max(height(k1->left), k2->height) + 1;
+        k1->set_subtree_size(k2->subtree_size());
+        update_size(*k2);
         k1->right = std::move(k2);
         k2 = std::move(k1);
     }
@@ -338,12 +1644,17 @@ private:
      * For AVL trees, this is a single rotation for case 4.
      * Update heights, then set new root.
      */
-    void rotateWithRightChild(std::unique_ptr<Node>& k1) noexcept
+    void rotateWithRightChild(node_ptr& k1) noexcept
     {
         auto k2 = std::move(k1->right);
         k1->right = std::move(k2->left);
+        if (k1->right != nullptr) k1->right->parent = k1.get();
+        k2->parent = k1->parent;
+        k1->parent = k2.get();
         k1->height = std::max(height(k1->left), height(k1->right)) + 1;
         k2->height = std::max(height(k2->right), k1->height) + 1;
+        k2->set_subtree_size(k1->subtree_size());
+        update_size(*k1);
         k2->left = std::move(k1);
         k1 = std::move(k2);
     }
@@ -354,7 +1665,7 @@ private:
      * For AVL trees, this is a double rotation for case 2.
      * Update heights, then set new root.
      */
-    void doubleWithLeftChild(std::unique_ptr<Node>& k3) noexcept
+    void doubleWithLeftChild(node_ptr& k3) noexcept
     {
         rotateWithRightChild(k3->left);
         rotateWithLeftChild(k3);
@@ -366,7 +1677,7 @@ private:
      * For AVL trees, this is a double rotation for case 3.
      * Update heights, then set new root.
      */
-    void doubleWithRightChild(std::unique_ptr<Node>& k1) noexcept
+    void doubleWithRightChild(node_ptr& k1) noexcept
     {
         rotateWithLeftChild(k1->right);
         rotateWithRightChild(k1);
@@ -4,49 +4,149 @@
 #define AVL_TREE_HEADER_RAW
 
 #include <algorithm>
+#include <functional>
 #include <initializer_list>
 #include <iostream>
 #include <iterator>
+#include <memory>
 #include <stdexcept>
 #include <type_traits>
 #include <utility>
 
+#include "avlcommon.hpp"
+
 namespace Homebrew {
     
-template<typename T>
+template<typename T, 
+         typename Compare = std::less<T>,
+         typename Alloc = std::allocator<T>>
 class AvlTree {
     // node of the tree -> http://www.catb.org/esr/structure-packing/
     struct Node {
         Node* left; // owning left and right pointers
         Node* right;
+        Node* parent; // non owning, used by the iterators
         T data;
         int height;
         
         template<typename X = T>
         Node(X&& ele, Node* lt, Node* rt, int h = 0)
-            :  left{lt}, right{rt}, data{std::forward<X>(ele)}, height{h} {}
+            :  left{lt}, right{rt}, parent{nullptr}, data{std::forward<X>(ele)}, height{h} 
+        {
+            if (left  != nullptr) left->parent = this;
+            if (right != nullptr) right->parent = this;
+        }
                 
         Node(const Node&) = delete; // must use clone method
         Node& operator=(const Node&) = delete;
-                
-        ~Node() noexcept
-        {
-            if (left  != nullptr) delete left;
-            if (right != nullptr) delete right;
-        }
     };
     
+    using NodeAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<Node>;
+    using NodeTraits = std::allocator_traits<NodeAlloc>;
+    
     // top of the tree
     Node* root;
     
     // Number of elements
     std::size_t sz;
+    
+    // Longest possible search path, AVL height is below 1.44 * log2(n + 2)
+    static constexpr std::size_t MAX_DEPTH = 96;
+    
+    // Source of the nodes
+    NodeAlloc alloc;
+    
+    // Ordering of the elements
+    Compare comp;
        
 public:
+    using value_type = T;
+    using key_compare = Compare;
+    using allocator_type = Alloc;
+    
+    /**
+     * Bidirectional iterator, walks the tree in order through the parent
+     * links: no allocation, amortized O(1) increment. Elements can't be
+     * modified in place as that would break the ordering.
+     */
+    class const_iterator {
+        friend class AvlTree;
+        
+        const Node* node;
+        const AvlTree* tree; // needed to step back from end()
+        
+        const_iterator(const Node* n, const AvlTree* t) noexcept
+            : node{n}, tree{t} {}
+        
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+        
+        const_iterator() noexcept : node{nullptr}, tree{nullptr} {}
+        
+        reference operator*() const noexcept { return node->data; }
+        pointer operator->() const noexcept { return &node->data; }
+        
+        const_iterator& operator++() noexcept
+        {
+            node = next(node);
+            return *this;
+        }
+        
+        const_iterator operator++(int) noexcept
+        {
+            auto tmp = *this;
+            ++*this;
+            return tmp;
+        }
+        
+        const_iterator& operator--() noexcept
+        {
+            node = (node == nullptr) ? tree->findMax(tree->root) : prev(node);
+            return *this;
+        }
+        
+        const_iterator operator--(int) noexcept
+        {
+            auto tmp = *this;
+            --*this;
+            return tmp;
+        }
+        
+        bool operator==(const const_iterator& other) const noexcept
+        {
+            return node == other.node;
+        }
+        
+        bool operator!=(const const_iterator& other) const noexcept
+        {
+            return node != other.node;
+        }
+    };
+    
+    using iterator = const_iterator;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+    using reverse_iterator = const_reverse_iterator;
+    
     // constructors block
-    AvlTree() : root{nullptr}, sz{0} {}
+    AvlTree() : root{nullptr}, sz{0}, alloc{}, comp{} {}
+    
+    explicit AvlTree(const Compare& c, const Alloc& a = Alloc()) 
+        : root{nullptr}, sz{0}, alloc{a}, comp{c} {}
+    
+    explicit AvlTree(const Alloc& a) : root{nullptr}, sz{0}, alloc{a}, comp{} {}
+    
     AvlTree(const AvlTree& other)
-        : root{clone(other.root)}, sz{other.sz} {}
+        : root{nullptr}, 
+          sz{other.sz},
+          alloc{NodeTraits::select_on_container_copy_construction(other.alloc)},
+          comp{other.comp}
+    {
+        root = clone(other.root);
+    }
         
     AvlTree& operator=(const AvlTree& other) 
     {
@@ -54,27 +154,31 @@ public:
         AvlTree tmp (other);
         std::swap(root, tmp.root);
         std::swap(sz, tmp.sz);
+        std::swap(alloc, tmp.alloc);
+        std::swap(comp, tmp.comp);
 
         return *this;
     }
     
     AvlTree(AvlTree&& other) noexcept
-        : AvlTree()
+        : root{other.root}, sz{other.sz}, alloc{std::move(other.alloc)}, comp{other.comp}
     {
-        std::swap(root, other.root);
-        std::swap(sz, other.sz);
+        other.root = nullptr;
+        other.sz = 0;
     }
     
     AvlTree& operator=(AvlTree&& other) noexcept
     {
         std::swap(root, other.root);
         std::swap(sz, other.sz);
+        std::swap(alloc, other.alloc);
+        std::swap(comp, other.comp);
         return *this;
     }
     
     ~AvlTree() noexcept
     {
-        if (root != nullptr) delete root;
+        destroy(root);
     }
     
     template<typename Iter>
@@ -89,6 +193,25 @@ public:
         }
     }
     
+    // O(n) bulk load, [first, last) must be sorted and free of duplicates
+    template<typename Iter>
+    AvlTree(sorted_unique_t, Iter first, Iter last)
+        : AvlTree()
+    {
+        using c_tp = typename std::iterator_traits<Iter>::value_type;
+        static_assert(std::is_constructible<T, c_tp>::value, "Type mismatch");
+        
+        auto n = static_cast<std::size_t>(std::distance(first, last));
+        root = build_sorted(first, n);
+        sz = n;
+    }
+    
+    template<typename Iter>
+    static AvlTree from_sorted(Iter first, Iter last)
+    {
+        return AvlTree(sorted_unique, first, last);
+    }
+    
     AvlTree(const std::initializer_list<T>& lst)
         : AvlTree(std::begin(lst), std::end(lst)) {}
         
@@ -106,6 +229,8 @@ public:
         AvlTree tmp (lst);
         std::swap(root, tmp.root);
         std::swap(sz, tmp.sz);
+        std::swap(alloc, tmp.alloc);
+        std::swap(comp, tmp.comp);
 
         return *this;
     }
@@ -121,6 +246,16 @@ public:
         return sz;
     }
     
+    allocator_type get_allocator() const
+    {
+        return allocator_type(alloc);
+    }
+    
+    key_compare key_comp() const
+    {
+        return comp;
+    }
+    
     template<typename X = T,
              typename... Args>
     void insert(X&& first, Args&&... args)
@@ -166,18 +301,32 @@ public:
     
     void clear() noexcept
     {
-        if (root != nullptr) delete root;
+        destroy(root);
         root = nullptr;
+        sz = 0;
+    }
+    
+    // Call fn on every element in order, without recursion
+    template<typename F>
+    void visit(F&& fn) const
+    {
+        detail::inorder<MAX_DEPTH>(static_cast<const Node*>(root), fn);
+    }
+    
+    /**
+     * Stream the tree to os as "{a, b, ...}", each element written by
+     * fmt(OutputBuffer&, const T&). Output goes through a fixed buffer
+     * in large blocks, and the walk is a loop over a fixed stack.
+     */
+    template<typename F = TextFormat>
+    void write_to(std::ostream& os, F fmt = F()) const
+    {
+        detail::write_tree<MAX_DEPTH>(os, static_cast<const Node*>(root), fmt);
     }
     
     void print() const noexcept
     {
-        if (empty()) std::cout << "{}\n";
-        else {
-            std::cout << "{";
-            print(root);
-            std::cout << "\b\b}\n";
-        }
+        write_to(std::cout);
     }
     
     bool search(const T& x) const noexcept
@@ -185,12 +334,120 @@ public:
         return search(x, root);
     }
     
+    // iterators block
+    const_iterator begin() const noexcept
+    {
+        return const_iterator(findMin(root), this);
+    }
+    
+    const_iterator end() const noexcept
+    {
+        return const_iterator(nullptr, this);
+    }
+    
+    const_iterator cbegin() const noexcept { return begin(); }
+    const_iterator cend() const noexcept { return end(); }
+    
+    const_reverse_iterator rbegin() const noexcept
+    {
+        return const_reverse_iterator(end());
+    }
+    
+    const_reverse_iterator rend() const noexcept
+    {
+        return const_reverse_iterator(begin());
+    }
+    
+    const_reverse_iterator crbegin() const noexcept { return rbegin(); }
+    const_reverse_iterator crend() const noexcept { return rend(); }
+    
 private:
-    Node* clone(Node* t) const
+    template<typename... Args>
+    Node* create_node(Args&&... args)
+    {
+        Node* p = NodeTraits::allocate(alloc, 1);
+        
+        try {
+            NodeTraits::construct(alloc, p, std::forward<Args>(args)...);
+        }
+        catch (...) {
+            NodeTraits::deallocate(alloc, p, 1);
+            throw;
+        }
+        
+        return p;
+    }
+    
+    // release a single node, children are left alone
+    void destroy_node(Node* t) noexcept
+    {
+        NodeTraits::destroy(alloc, t);
+        NodeTraits::deallocate(alloc, t, 1);
+    }
+    
+    /**
+     * Release a whole subtree with O(1) extra space.
+     * Left children are rotated up into the right spine, so every node is
+     * freed once it has no left child, no recursion involved.
+     */
+    void destroy(Node* t) noexcept
+    {
+        while (t != nullptr) {
+            if (t->left != nullptr) {
+                Node* l = t->left;
+                t->left = l->right;
+                l->right = t;
+                t = l;
+            }
+            else {
+                Node* r = t->right;
+                destroy_node(t);
+                t = r;
+            }
+        }
+    }
+    
+    /**
+     * Internal method to build a perfectly balanced tree out of the next
+     * n elements of a sorted range, consumed in order.
+     * O(n), recursion depth is log n.
+     */
+    template<typename Iter>
+    Node* build_sorted(Iter& it, std::size_t n)
+    {
+        if (n == 0) return nullptr;
+        
+        Node* left = build_sorted(it, (n - 1) / 2);
+        Node* t;
+        
+        try {
+            t = create_node(*it, left, nullptr);
+        }
+        catch (...) {
+            destroy(left);
+            throw;
+        }
+        ++it;
+        
+        try {
+            t->right = build_sorted(it, n - 1 - (n - 1) / 2);
+        }
+        catch (...) {
+            destroy(t);
+            throw;
+        }
+        
+        if (t->right != nullptr) t->right->parent = t;
+        t->height = std::max(height(t->left), height(t->right)) + 1;
+        
+        return t;
+    }
+    
+    Node* clone(Node* t)
     {
         if (t == nullptr) return nullptr;
         else {
-            return new Node(t->data, clone(t->left), clone(t->right), t->height);
+            return create_node(t->data, clone(t->left), clone(t->right), t->height);
         }
     }
     
@@ -199,23 +456,13 @@ private:
         return t == nullptr ? -1 : t->height;
     }
     
-    // print tree inorder
-    void print(Node* t) const noexcept
-    { 
-        if (t != nullptr) {
-            print(t->left);
-            std::cout << t->data << ", ";
-            print(t->right);
-        }
-    }
-    
     // binary search an element in the tree
     bool search(const T& x, Node* t) const noexcept
     {
         while( t != nullptr )
-            if( x < t->data )
+            if( comp(x, t->data) )
                 t = t->left;
-            else if( t->data < x )
+            else if( comp(t->data, x) )
                 t = t->right;
             else
                 return true;    // Match
@@ -227,56 +474,119 @@ private:
      * Internal method to insert into a subtree.
      * x is the item to insert.
      * t is the node that roots the subtree.
-     * Set the new root of the subtree.
+     * The search path is kept in a fixed-size stack and retraced only
+     * while subtree heights keep changing.
      */
     template<typename X = T>
     void insert_util(X&& x, Node*& t)
     {
-        if (t == nullptr)
-            t = new Node(std::forward<X>(x), nullptr, nullptr);
-        else if (x < t->data)
-            insert_util(std::forward<X>(x), t->left);
-        else if (x > t->data)
-            insert_util(std::forward<X>(x), t->right);
-        else //duplicate key
-            --sz;
+        Node** path[MAX_DEPTH];
+        std::size_t depth = 0;
+        Node** slot = &t;
+        Node* parent = nullptr;
+        
+        while (*slot != nullptr) {
+            parent = *slot;
+            path[depth++] = slot;
             
-        balance(t);
+            if (comp(x, parent->data))
+                slot = &parent->left;
+            else if (comp(parent->data, x))
+                slot = &parent->right;
+            else { //duplicate key
+                --sz;
+                return;
+            }
+        }
+        
+        *slot = create_node(std::forward<X>(x), nullptr, nullptr);
+        (*slot)->parent = parent;
+        
+        retrace(path, depth);
     }
     
     /**
      * Internal method to remove from a subtree.
      * x is the item to remove.
      * t is the node that roots the subtree.
-     * Set the new root of the subtree.
+     * Same path stack and early exit as insert_util.
      */
     void remove_util(const T& x, Node*& t) noexcept
     {
-        if(t == nullptr){
+        Node** path[MAX_DEPTH];
+        std::size_t depth = 0;
+        Node** slot = &t;
+        
+        while (*slot != nullptr) {
+            if (comp(x, (*slot)->data)) {
+                path[depth++] = slot;
+                slot = &(*slot)->left;
+            }
+            else if (comp((*slot)->data, x)) {
+                path[depth++] = slot;
+                slot = &(*slot)->right;
+            }
+            else break;
+        }
+        
+        if (*slot == nullptr) {
             ++sz;
             return;   // Item not found; do nothing
-        } 
-        
-        if(x < t->data)
-            remove_util(x, t->left);
-        else if(t->data < x)
-            remove_util(x, t->right);
-        else if(t->left != nullptr && t->right != nullptr) { // Two children
-            t->data = findMin(t->right)->data;
-            remove_util(t->data, t->right);
         }
-        else { // One child
-            Node *oldNode = t;
-            t = (t->left != nullptr) ? t->left : t->right;
+        
+        Node *oldNode = *slot;
+        
+        if (oldNode->left != nullptr && oldNode->right != nullptr) { // Two children
+            // relink the successor node in place of oldNode, data is not copied
+            std::size_t pos = depth;
+            path[depth++] = slot;
+            Node** sslot = &oldNode->right;
+            
+            while ((*sslot)->left != nullptr) {
+                path[depth++] = sslot;
+                sslot = &(*sslot)->left;
+            }
+            
+            Node* succ = *sslot;
+            *sslot = succ->right;
+            if (*sslot != nullptr) (*sslot)->parent = succ->parent;
             
-            // Avoid propagation of destructors setting nullptr
-            oldNode->left = nullptr;
-            oldNode->right = nullptr;
+            succ->parent = oldNode->parent;
+            succ->height = oldNode->height;
+            succ->left = oldNode->left;
+            succ->left->parent = succ;
+            succ->right = oldNode->right;
+            if (succ->right != nullptr) succ->right->parent = succ;
+            *slot = succ;
             
-            delete oldNode;
+            // the slot right below oldNode now belongs to succ
+            if (pos + 1 < depth) path[pos + 1] = &succ->right;
+        }
+        else { // One child
+            *slot = (oldNode->left != nullptr) ? oldNode->left : oldNode->right;
+            if (*slot != nullptr) (*slot)->parent = oldNode->parent;
         }
         
-        balance(t);
+        destroy_node(oldNode);
+        
+        retrace(path, depth);
+    }
+    
+    /**
+     * Internal method to rebalance a recorded search path bottom-up.
+     * Stops at the first subtree whose height did not change, as nothing
+     * above it can be affected.
+     */
+    void retrace(Node*** path, std::size_t depth) noexcept
+    {
+        while (depth > 0) {
+            Node*& t = *path[--depth];
+            int old_height = t->height;
+            
+            balance(t);
+            
+            if (t->height == old_height) break;
+        }
     }
     
     /**
@@ -305,6 +615,42 @@ private:
         return t;
     }
     
+    /**
+     * Internal method to find the in order successor of t.
+     * Return nullptr past the largest item.
+     */
+    static const Node* next(const Node* t) noexcept
+    {
+        if (t->right != nullptr) {
+            t = t->right;
+            while (t->left != nullptr) t = t->left;
+            return t;
+        }
+        
+        while (t->parent != nullptr && t == t->parent->right)
+            t = t->parent;
+            
+        return t->parent;
+    }
+    
+    /**
+     * Internal method to find the in order predecessor of t.
+     * Return nullptr before the smallest item.
+     */
+    static const Node* prev(const Node* t) noexcept
+    {
+        if (t->left != nullptr) {
+            t = t->left;
+            while (t->right != nullptr) t = t->right;
+            return t;
+        }
+        
+        while (t->parent != nullptr && t == t->parent->left)
+            t = t->parent;
+            
+        return t->parent;
+    }
+    
     void balance(Node*& t) noexcept
     {
         static const int ALLOWED_IMBALANCE = 1;
@@ -339,7 +685,10 @@ private:
     {
         Node *k1 = k2->left;
         k2->left = k1->right;
+        if (k2->left != nullptr) k2->left->parent = k2;
         k1->right = k2;
+        k1->parent = k2->parent;
+        k2->parent = k1;
         k2->height = std::max(height(k2->left), height(k2->right)) + 1;
         k1->height = std::max(height(k1->left), k2->height) + 1;
         k2 = k1;
@@ -354,7 +703,10 @@ private:
     {
         Node *k2 = k1->right;
         k1->right = k2->left;
+        if (k1->right != nullptr) k1->right->parent = k1;
         k2->left = k1;
+        k2->parent = k1->parent;
+        k1->parent = k2;
         k1->height = std::max(height(k1->left), height(k1->right)) + 1;
         k2->height = std::max(height(k2->right), k1->height) + 1;
         k1 = k2;
@@ -0,0 +1,241 @@
+#ifndef AVL_BENCH_COMMON_HPP
+#define AVL_BENCH_COMMON_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+/**
+ * Workloads shared by every benchmark translation unit.
+ * Each container gets a Ops<C> specialization with static insert, erase,
+ * contains and for_each (plus copy when it can be copied), the workloads
+ * below only talk to it through those. The two AvlTree headers define the
+ * same class name, so each of them is benchmarked by its own executable.
+ */
+namespace bench {
+
+template<typename C>
+struct Ops;
+
+// Keys present are built from even numbers, misses from odd ones
+template<typename K>
+K make_key(std::uint64_t i);
+
+template<>
+inline int make_key<int>(std::uint64_t i)
+{
+    return static_cast<int>(i);
+}
+
+template<>
+inline std::uint64_t make_key<std::uint64_t>(std::uint64_t i)
+{
+    return i * 0x9E3779B97F4A7C15ull; // spread out, still distinct
+}
+
+// Long enough to stay out of the small string buffer
+template<>
+inline std::string make_key<std::string>(std::uint64_t i)
+{
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "key:%020llu", static_cast<unsigned long long>(i));
+    return buf;
+}
+
+// n distinct keys in random order, hits or misses for the same n
+template<typename K>
+std::vector<K> make_keys(std::size_t n, bool hits = true, unsigned seed = 42)
+{
+    std::vector<std::uint64_t> ids(n);
+    for (std::size_t i = 0; i < n; ++i) ids[i] = 2 * i + (hits ? 0 : 1);
+
+    std::shuffle(ids.begin(), ids.end(), std::mt19937_64{seed});
+
+    std::vector<K> keys;
+    keys.reserve(n);
+    for (auto id : ids) keys.push_back(make_key<K>(id));
+    return keys;
+}
+
+template<typename C, typename K>
+void fill(C& c, const std::vector<K>& keys)
+{
+    for (const auto& k : keys) Ops<C>::insert(c, k);
+}
+
+// Build from empty in random order, teardown is not timed
+template<typename C>
+void BM_Insert(benchmark::State& state)
+{
+    auto n = static_cast<std::size_t>(state.range(0));
+    auto keys = make_keys<typename Ops<C>::key_type>(n);
+
+    for (auto _ : state) {
+        auto c = Ops<C>::make();
+        fill(*c, keys);
+        benchmark::DoNotOptimize(c.get());
+
+        state.PauseTiming();
+        c.reset();
+        state.ResumeTiming();
+    }
+
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+template<typename C>
+void lookup(benchmark::State& state, bool hits)
+{
+    using K = typename Ops<C>::key_type;
+
+    auto n = static_cast<std::size_t>(state.range(0));
+    auto c = Ops<C>::make();
+    fill(*c, make_keys<K>(n));
+
+    // same keys in another order, or keys falling between them
+    auto probes = hits ? make_keys<K>(n, true, 7) : make_keys<K>(n, false);
+
+    for (auto _ : state) {
+        std::size_t found = 0;
+        for (const auto& k : probes) found += Ops<C>::contains(*c, k);
+        benchmark::DoNotOptimize(found);
+    }
+
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+template<typename C>
+void BM_LookupHit(benchmark::State& state)
+{
+    lookup<C>(state, true);
+}
+
+template<typename C>
+void BM_LookupMiss(benchmark::State& state)
+{
+    lookup<C>(state, false);
+}
+
+// Empty a full container in random order, building it is not timed
+template<typename C>
+void BM_Erase(benchmark::State& state)
+{
+    auto n = static_cast<std::size_t>(state.range(0));
+    auto keys = make_keys<typename Ops<C>::key_type>(n);
+    auto order = make_keys<typename Ops<C>::key_type>(n, true, 7);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto c = Ops<C>::make();
+        fill(*c, keys);
+        state.ResumeTiming();
+
+        for (const auto& k : order) Ops<C>::erase(*c, k);
+        benchmark::DoNotOptimize(c.get());
+    }
+
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+template<typename C>
+void BM_Iterate(benchmark::State& state)
+{
+    auto n = static_cast<std::size_t>(state.range(0));
+    auto c = Ops<C>::make();
+    fill(*c, make_keys<typename Ops<C>::key_type>(n));
+
+    for (auto _ : state) {
+        std::size_t visited = 0;
+        Ops<C>::for_each(*c, [&](const typename Ops<C>::key_type& k) {
+            benchmark::DoNotOptimize(&k);
+            ++visited;
+        });
+        benchmark::DoNotOptimize(visited);
+    }
+
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+// Deep copy (or snapshot, for the persistent map), teardown is not timed
+template<typename C>
+void BM_Copy(benchmark::State& state)
+{
+    auto n = static_cast<std::size_t>(state.range(0));
+    auto c = Ops<C>::make();
+    fill(*c, make_keys<typename Ops<C>::key_type>(n));
+
+    for (auto _ : state) {
+        auto copy = Ops<C>::copy(*c);
+        benchmark::DoNotOptimize(copy.get());
+
+        state.PauseTiming();
+        copy.reset();
+        state.ResumeTiming();
+    }
+
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+// Steady state size n: 90% lookups, 10% erase of a key plus insert of another
+template<typename C>
+void BM_Mixed(benchmark::State& state)
+{
+    using K = typename Ops<C>::key_type;
+
+    auto n = static_cast<std::size_t>(state.range(0));
+    auto present = make_keys<K>(n);
+    auto absent = make_keys<K>(n, false);
+    auto c = Ops<C>::make();
+    fill(*c, present);
+
+    std::mt19937 gen{1};
+    std::vector<std::uint8_t> op(4096);
+    for (auto& o : op) o = static_cast<std::uint8_t>(gen() % 10);
+
+    std::size_t i = 0, j = 0, found = 0;
+
+    for (auto _ : state) {
+        for (std::size_t s = 0; s < op.size(); ++s, ++i) {
+            const auto& k = present[i % n];
+
+            if (op[s] == 0) { // swap one present key for one absent key
+                Ops<C>::erase(*c, k);
+                Ops<C>::insert(*c, absent[j % n]);
+                std::swap(present[i % n], absent[j++ % n]);
+            }
+            else found += Ops<C>::contains(*c, k);
+        }
+    }
+
+    benchmark::DoNotOptimize(found);
+    state.SetItemsProcessed(state.iterations() * op.size());
+}
+
+} // end of namespace bench
+
+#define AVL_BENCH_SIZES RangeMultiplier(16)->Range(1 << 10, 1 << 20)
+
+// Registration, to be used inside namespace bench.
+// Read only workloads, for containers that are built once
+#define AVL_BENCH_LOOKUPS(C)                                    \
+    BENCHMARK_TEMPLATE(BM_LookupHit, C)->AVL_BENCH_SIZES;       \
+    BENCHMARK_TEMPLATE(BM_LookupMiss, C)->AVL_BENCH_SIZES;      \
+    BENCHMARK_TEMPLATE(BM_Iterate, C)->AVL_BENCH_SIZES
+
+#define AVL_BENCH_UPDATES(C)                                    \
+    AVL_BENCH_LOOKUPS(C);                                       \
+    BENCHMARK_TEMPLATE(BM_Insert, C)->AVL_BENCH_SIZES;          \
+    BENCHMARK_TEMPLATE(BM_Erase, C)->AVL_BENCH_SIZES;           \
+    BENCHMARK_TEMPLATE(BM_Mixed, C)->AVL_BENCH_SIZES
+
+#define AVL_BENCH_ALL(C)                                        \
+    AVL_BENCH_UPDATES(C);                                       \
+    BENCHMARK_TEMPLATE(BM_Copy, C)->AVL_BENCH_SIZES
+
+#endif // AVL_BENCH_COMMON_HPP
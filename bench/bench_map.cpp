@@ -0,0 +1,307 @@
+/* Benchmarks of the map flavours against std::map */
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../avlmap.hpp"
+#include "../avlmap_buffered.hpp"
+#include "../avlmap_compact.hpp"
+#include "../avlmap_concurrent.hpp"
+#include "../avlmap_mapped.hpp"
+#include "../avlmap_persistent.hpp"
+#include "../avlmap_sharded.hpp"
+#include "../avlmap_wide.hpp"
+#include "../avlnodepool.hpp"
+#include "bench_common.hpp"
+
+namespace bench {
+
+// The usual std::map shaped interface, values are all zero
+template<typename C>
+struct MapOps {
+    using key_type = typename C::key_type;
+
+    static std::unique_ptr<C> make() { return std::make_unique<C>(); }
+    static std::unique_ptr<C> copy(const C& c) { return std::make_unique<C>(c); }
+    static void insert(C& c, const key_type& k) { c.insert(k, 0); }
+    static void erase(C& c, const key_type& k) { c.erase(k); }
+    static bool contains(const C& c, const key_type& k) { return c.search(k); }
+
+    template<typename F>
+    static void for_each(const C& c, F&& fn) { for (const auto& kv : c) fn(kv.first); }
+};
+
+template<typename K, typename V, typename Alloc>
+struct Ops<Homebrew::AvlMap<K, V, std::less<K>, Alloc>>
+    : MapOps<Homebrew::AvlMap<K, V, std::less<K>, Alloc>> {};
+
+// writes go through the buffer, iteration flushes it
+template<typename K, typename V>
+struct Ops<Homebrew::BufferedAvlMap<K, V>> : MapOps<Homebrew::BufferedAvlMap<K, V>> {};
+
+template<typename K, typename V>
+struct Ops<Homebrew::CompactAvlMap<K, V>> : MapOps<Homebrew::CompactAvlMap<K, V>> {};
+
+template<typename K, typename V>
+struct Ops<std::map<K, V>> : MapOps<std::map<K, V>> {
+    static void insert(std::map<K, V>& c, const K& k) { c.emplace(k, 0); }
+    static bool contains(const std::map<K, V>& c, const K& k) { return c.count(k) != 0; }
+};
+
+// copies are snapshots sharing every node
+template<typename K, typename V>
+struct Ops<Homebrew::PersistentAvlMap<K, V>> : MapOps<Homebrew::PersistentAvlMap<K, V>> {
+    template<typename F>
+    static void for_each(const Homebrew::PersistentAvlMap<K, V>& c, F&& fn)
+    {
+        c.for_each([&](const std::pair<const K, V>& kv) { fn(kv.first); });
+    }
+};
+
+// single threaded cost of the optimistic reads and the writer lock
+template<typename K, typename V>
+struct Ops<Homebrew::ConcurrentAvlMap<K, V>> : MapOps<Homebrew::ConcurrentAvlMap<K, V>> {
+    template<typename F>
+    static void for_each(const Homebrew::ConcurrentAvlMap<K, V>& c, F&& fn)
+    {
+        c.for_each([&](const std::pair<const K, V>& kv) { fn(kv.first); });
+    }
+};
+
+template<typename K, typename V>
+struct Ops<Homebrew::ShardedAvlMap<K, V>> : MapOps<Homebrew::ShardedAvlMap<K, V>> {
+    template<typename F>
+    static void for_each(const Homebrew::ShardedAvlMap<K, V>& c, F&& fn)
+    {
+        c.for_each([&](const std::pair<const K, V>& kv) { fn(kv.first); });
+    }
+};
+
+template<typename K, typename V>
+struct Ops<Homebrew::WideAvlMap<K, V>> : MapOps<Homebrew::WideAvlMap<K, V>> {
+    template<typename F>
+    static void for_each(const Homebrew::WideAvlMap<K, V>& c, F&& fn)
+    {
+        c.for_each([&](const K& k, const V&) { fn(k); });
+    }
+};
+
+// Serialized AvlMap read through MappedAvlMap, built once on first lookup
+template<typename K, typename V>
+struct MappedBench {
+    using key_type = K;
+
+    Homebrew::AvlMap<K, V> builder;
+    std::string bytes;
+    std::unique_ptr<Homebrew::MappedAvlMap<K, V>> view;
+
+    const Homebrew::MappedAvlMap<K, V>& get()
+    {
+        if (!view) {
+            std::ostringstream os;
+            builder.serialize(os);
+            bytes = os.str();
+            view = std::make_unique<Homebrew::MappedAvlMap<K, V>>(bytes.data(), bytes.size());
+        }
+        return *view;
+    }
+};
+
+template<typename K, typename V>
+struct Ops<MappedBench<K, V>> {
+    using C = MappedBench<K, V>;
+    using key_type = K;
+
+    static std::unique_ptr<C> make() { return std::make_unique<C>(); }
+    static void insert(C& c, const K& k) { c.builder.insert(k, 0); }
+    static bool contains(C& c, const K& k) { return c.get().search(k); }
+
+    template<typename F>
+    static void for_each(C& c, F&& fn)
+    {
+        c.get().for_each([&](const K& k, const V&) { fn(k); });
+    }
+};
+
+// AvlMap::freeze() result, frozen on first lookup
+template<typename K, typename V>
+struct FrozenBench {
+    using key_type = K;
+
+    Homebrew::AvlMap<K, V> builder;
+    std::unique_ptr<Homebrew::FrozenAvlMap<K, V>> view;
+
+    const Homebrew::FrozenAvlMap<K, V>& get()
+    {
+        if (!view) view = std::make_unique<Homebrew::FrozenAvlMap<K, V>>(builder.freeze());
+        return *view;
+    }
+};
+
+template<typename K, typename V>
+struct Ops<FrozenBench<K, V>> {
+    using C = FrozenBench<K, V>;
+    using key_type = K;
+
+    static std::unique_ptr<C> make() { return std::make_unique<C>(); }
+    static void insert(C& c, const K& k) { c.builder.insert(k, 0); }
+    static bool contains(C& c, const K& k) { return c.get().search(k); }
+
+    template<typename F>
+    static void for_each(C& c, F&& fn)
+    {
+        c.get().for_each([&](const K& k, const V&) { fn(k); });
+    }
+};
+
+// search_many() on hits or misses, against BM_LookupHit / BM_LookupMiss
+template<typename C>
+void BM_SearchMany(benchmark::State& state, bool hits)
+{
+    using K = typename C::key_type;
+
+    auto n = static_cast<std::size_t>(state.range(0));
+    C c;
+    for (const auto& k : make_keys<K>(n)) c.insert(k, 0);
+
+    auto probes = hits ? make_keys<K>(n, true, 7) : make_keys<K>(n, false);
+    std::vector<unsigned char> found(n);
+
+    for (auto _ : state) {
+        c.search_many(probes.cbegin(), probes.cend(), found.begin());
+        benchmark::DoNotOptimize(found.data());
+    }
+
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+template<typename C>
+void BM_SearchManyHit(benchmark::State& state)
+{
+    BM_SearchMany<C>(state, true);
+}
+
+template<typename C>
+void BM_SearchManyMiss(benchmark::State& state)
+{
+    BM_SearchMany<C>(state, false);
+}
+
+// Next insert point of a hinted insert
+template<typename K, typename V, typename Alloc>
+typename Homebrew::AvlMap<K, V, std::less<K>, Alloc>::iterator
+insert_hint(Homebrew::AvlMap<K, V, std::less<K>, Alloc>& c,
+            typename Homebrew::AvlMap<K, V, std::less<K>, Alloc>::iterator hint, const K& k)
+{
+    return c.insert(hint, k, 0);
+}
+
+template<typename K, typename V>
+typename std::map<K, V>::iterator
+insert_hint(std::map<K, V>& c, typename std::map<K, V>::iterator hint, const K& k)
+{
+    return c.emplace_hint(hint, k, 0);
+}
+
+// Build from sorted keys with local jitter, each hinted by the last insert or not
+template<typename C, bool Hint>
+void BM_InsertNearlySorted(benchmark::State& state)
+{
+    auto n = static_cast<std::size_t>(state.range(0));
+    std::vector<int> keys(n);
+    for (std::size_t i = 0; i < n; ++i) keys[i] = static_cast<int>(i);
+
+    std::mt19937 gen{3};
+    for (std::size_t i = 0; i + 1 < n; ++i)
+        std::swap(keys[i], keys[std::min(n - 1, i + gen() % 16)]);
+
+    for (auto _ : state) {
+        auto c = std::make_unique<C>();
+        auto hint = c->end();
+
+        for (int k : keys) {
+            if (Hint) hint = insert_hint(*c, hint, k);
+            else Ops<C>::insert(*c, k);
+        }
+        benchmark::DoNotOptimize(c.get());
+
+        state.PauseTiming();
+        c.reset();
+        state.ResumeTiming();
+    }
+
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+// Threads bumping range(0) shared counters through update()
+template<typename C>
+void BM_Counters(benchmark::State& state)
+{
+    static C counters; // one map for all the threads, kept between runs
+    
+    auto n = static_cast<std::size_t>(state.range(0));
+    auto keys = make_keys<int>(n, true, static_cast<unsigned>(state.thread_index()));
+    std::size_t i = 0;
+    
+    for (auto _ : state) {
+        counters.update(keys[i], [](int& v) { ++v; });
+        if (++i == n) i = 0;
+    }
+    
+    state.SetItemsProcessed(state.iterations());
+}
+
+} // end of namespace bench
+
+using AvlMapInt = Homebrew::AvlMap<int, int>;
+using AvlMapString = Homebrew::AvlMap<std::string, int>;
+using AvlMapPoolInt = Homebrew::AvlMap<int, int, std::less<int>,
+                                       Homebrew::NodePool<std::pair<const int, int>>>;
+using BufferedAvlMapInt = Homebrew::BufferedAvlMap<int, int>;
+using BufferedAvlMapString = Homebrew::BufferedAvlMap<std::string, int>;
+using WideAvlMapInt = Homebrew::WideAvlMap<int, int>;
+using WideAvlMapU64 = Homebrew::WideAvlMap<std::uint64_t, int>;
+using CompactAvlMapInt = Homebrew::CompactAvlMap<int, int>;
+using CompactAvlMapString = Homebrew::CompactAvlMap<std::string, int>;
+using PersistentAvlMapInt = Homebrew::PersistentAvlMap<int, int>;
+using ConcurrentAvlMapInt = Homebrew::ConcurrentAvlMap<int, int>;
+using ShardedAvlMapInt = Homebrew::ShardedAvlMap<int, int>;
+using MappedAvlMapInt = bench::MappedBench<int, int>;
+using FrozenAvlMapInt = bench::FrozenBench<int, int>;
+using FrozenAvlMapString = bench::FrozenBench<std::string, int>;
+using StdMapInt = std::map<int, int>;
+using StdMapString = std::map<std::string, int>;
+
+namespace bench {
+
+AVL_BENCH_ALL(AvlMapInt);
+AVL_BENCH_ALL(AvlMapString);
+BENCHMARK_TEMPLATE(BM_InsertNearlySorted, AvlMapInt, false)->AVL_BENCH_SIZES;
+BENCHMARK_TEMPLATE(BM_InsertNearlySorted, AvlMapInt, true)->AVL_BENCH_SIZES;
+BENCHMARK_TEMPLATE(BM_InsertNearlySorted, AvlMapPoolInt, false)->AVL_BENCH_SIZES;
+BENCHMARK_TEMPLATE(BM_InsertNearlySorted, AvlMapPoolInt, true)->AVL_BENCH_SIZES;
+BENCHMARK_TEMPLATE(BM_InsertNearlySorted, StdMapInt, true)->AVL_BENCH_SIZES;
+BENCHMARK_TEMPLATE(BM_SearchManyHit, AvlMapInt)->AVL_BENCH_SIZES;
+BENCHMARK_TEMPLATE(BM_SearchManyMiss, AvlMapInt)->AVL_BENCH_SIZES;
+BENCHMARK_TEMPLATE(BM_SearchManyMiss, AvlMapString)->AVL_BENCH_SIZES;
+AVL_BENCH_ALL(AvlMapPoolInt);
+AVL_BENCH_ALL(BufferedAvlMapInt);
+AVL_BENCH_ALL(BufferedAvlMapString);
+AVL_BENCH_ALL(WideAvlMapInt);
+AVL_BENCH_ALL(WideAvlMapU64);
+AVL_BENCH_ALL(CompactAvlMapInt);
+AVL_BENCH_ALL(CompactAvlMapString);
+AVL_BENCH_ALL(PersistentAvlMapInt);
+AVL_BENCH_UPDATES(ConcurrentAvlMapInt);
+AVL_BENCH_UPDATES(ShardedAvlMapInt);
+BENCHMARK_TEMPLATE(BM_Counters, ShardedAvlMapInt)->Arg(1 << 16)->ThreadRange(1, 8)->UseRealTime();
+AVL_BENCH_LOOKUPS(MappedAvlMapInt);
+AVL_BENCH_LOOKUPS(FrozenAvlMapInt);
+AVL_BENCH_LOOKUPS(FrozenAvlMapString);
+AVL_BENCH_ALL(StdMapInt);
+AVL_BENCH_ALL(StdMapString);
+
+} // end of namespace bench
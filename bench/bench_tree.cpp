@@ -0,0 +1,62 @@
+/* Benchmarks of the smart pointer AvlTree against std::set */
+#include <memory>
+#include <set>
+#include <string>
+
+#include "../avltree.hpp"
+#include "../avlnodepool.hpp"
+#include "bench_common.hpp"
+
+namespace bench {
+
+template<typename T, typename Alloc>
+struct Ops<Homebrew::AvlTree<T, std::less<T>, Alloc>> {
+    using C = Homebrew::AvlTree<T, std::less<T>, Alloc>;
+    using key_type = T;
+
+    static std::unique_ptr<C> make() { return std::make_unique<C>(); }
+    static std::unique_ptr<C> copy(const C& c) { return std::make_unique<C>(c); }
+    static void insert(C& c, const T& x) { c.insert(x); }
+    static void erase(C& c, const T& x) { c.remove(x); }
+    static bool contains(const C& c, const T& x) { return c.search(x); }
+
+    template<typename F>
+    static void for_each(const C& c, F&& fn) { for (const auto& x : c) fn(x); }
+};
+
+template<typename T>
+struct Ops<std::set<T>> {
+    using C = std::set<T>;
+    using key_type = T;
+
+    static std::unique_ptr<C> make() { return std::make_unique<C>(); }
+    static std::unique_ptr<C> copy(const C& c) { return std::make_unique<C>(c); }
+    static void insert(C& c, const T& x) { c.insert(x); }
+    static void erase(C& c, const T& x) { c.erase(x); }
+    static bool contains(const C& c, const T& x) { return c.count(x) != 0; }
+
+    template<typename F>
+    static void for_each(const C& c, F&& fn) { for (const auto& x : c) fn(x); }
+};
+
+} // end of namespace bench
+
+using AvlTreeInt = Homebrew::AvlTree<int>;
+using AvlTreeU64 = Homebrew::AvlTree<std::uint64_t>;
+using AvlTreeString = Homebrew::AvlTree<std::string>;
+using AvlTreePoolInt = Homebrew::AvlTree<int, std::less<int>, Homebrew::NodePool<int>>;
+using StdSetInt = std::set<int>;
+using StdSetU64 = std::set<std::uint64_t>;
+using StdSetString = std::set<std::string>;
+
+namespace bench {
+
+AVL_BENCH_ALL(AvlTreeInt);
+AVL_BENCH_ALL(AvlTreeU64);
+AVL_BENCH_ALL(AvlTreeString);
+AVL_BENCH_ALL(AvlTreePoolInt);
+AVL_BENCH_ALL(StdSetInt);
+AVL_BENCH_ALL(StdSetU64);
+AVL_BENCH_ALL(StdSetString);
+
+} // end of namespace bench
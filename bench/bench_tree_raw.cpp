@@ -0,0 +1,40 @@
+/* Benchmarks of the raw pointer AvlTree, std::set numbers come from bench_tree.cpp */
+#include <memory>
+#include <string>
+
+#include "../avltree_raw_pointers.hpp"
+#include "../avlnodepool.hpp"
+#include "bench_common.hpp"
+
+namespace bench {
+
+template<typename T, typename Alloc>
+struct Ops<Homebrew::AvlTree<T, std::less<T>, Alloc>> {
+    using C = Homebrew::AvlTree<T, std::less<T>, Alloc>;
+    using key_type = T;
+
+    static std::unique_ptr<C> make() { return std::make_unique<C>(); }
+    static std::unique_ptr<C> copy(const C& c) { return std::make_unique<C>(c); }
+    static void insert(C& c, const T& x) { c.insert(x); }
+    static void erase(C& c, const T& x) { c.remove(x); }
+    static bool contains(const C& c, const T& x) { return c.search(x); }
+
+    template<typename F>
+    static void for_each(const C& c, F&& fn) { for (const auto& x : c) fn(x); }
+};
+
+} // end of namespace bench
+
+using RawAvlTreeInt = Homebrew::AvlTree<int>;
+using RawAvlTreeU64 = Homebrew::AvlTree<std::uint64_t>;
+using RawAvlTreeString = Homebrew::AvlTree<std::string>;
+using RawAvlTreePoolInt = Homebrew::AvlTree<int, std::less<int>, Homebrew::NodePool<int>>;
+
+namespace bench {
+
+AVL_BENCH_ALL(RawAvlTreeInt);
+AVL_BENCH_ALL(RawAvlTreeU64);
+AVL_BENCH_ALL(RawAvlTreeString);
+AVL_BENCH_ALL(RawAvlTreePoolInt);
+
+} // end of namespace bench
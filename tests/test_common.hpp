@@ -0,0 +1,81 @@
+#ifndef AVL_TEST_COMMON_HPP
+#define AVL_TEST_COMMON_HPP
+
+#include <cstdio>
+#include <initializer_list>
+#include <random>
+#include <utility>
+#include <vector>
+
+/**
+ * Minimal harness shared by the test executables, registered with CTest.
+ * The containers are checked against std::set / std::map fed the same
+ * operations: CHECK records a failure and carries on, so one run lists
+ * every mismatch, and the executable exits non-zero if there was any.
+ * As for the benchmarks, the two AvlTree headers define the same class
+ * name, so each of them gets its own executable.
+ */
+namespace test {
+
+inline int& failures()
+{
+    static int n = 0;
+    return n;
+}
+
+inline bool check(bool ok, const char* what, const char* file, int line)
+{
+    if (!ok) {
+        std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", file, line, what);
+        ++failures();
+    }
+    return ok;
+}
+
+#define CHECK(cond) ::test::check(static_cast<bool>(cond), #cond, __FILE__, __LINE__)
+
+// Same random streams on every run
+inline std::mt19937& rng()
+{
+    static std::mt19937 gen {12345};
+    return gen;
+}
+
+inline int random_int(int lo, int hi)
+{
+    return std::uniform_int_distribution<int>{lo, hi}(rng());
+}
+
+// Every element of a range visited in order, as a vector
+template<typename C>
+auto as_vector(const C& c) -> std::vector<typename C::value_type>
+{
+    return std::vector<typename C::value_type>(c.begin(), c.end());
+}
+
+// Pairs of a map without the const on the key, comparable across types
+template<typename C>
+std::vector<std::pair<typename C::key_type, typename C::mapped_type>> pairs_of(const C& c)
+{
+    std::vector<std::pair<typename C::key_type, typename C::mapped_type>> v;
+    for (const auto& kv : c) v.emplace_back(kv.first, kv.second);
+    return v;
+}
+
+using test_fn = void (*)();
+
+// Run every test, report and give the exit status
+inline int run(std::initializer_list<std::pair<const char*, test_fn>> tests)
+{
+    for (const auto& t : tests) {
+        int before = failures();
+        t.second();
+        std::printf("%-32s %s\n", t.first, failures() == before ? "ok" : "FAILED");
+    }
+
+    return failures() == 0 ? 0 : 1;
+}
+
+} // end of namespace test
+
+#endif // AVL_TEST_COMMON_HPP
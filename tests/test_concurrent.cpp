@@ -0,0 +1,109 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "avlmap_concurrent.hpp"
+#include "test_common.hpp"
+
+/**
+ * Readers race writers that insert, reassign, erase and clear all the
+ * time, so nodes are retired and freed while lookups walk the tree. Meant
+ * to run under AVL_SANITIZE=address or thread: a node freed before the
+ * last reader on it left shows up as a use after free there, plain runs
+ * only check the values read.
+ */
+
+using Map = Homebrew::ConcurrentAvlMap<int, long>;
+
+constexpr int KEYS = 2048;
+constexpr int READERS = 6;
+constexpr int WRITERS = 2;
+constexpr int WRITES = 50000;
+
+// Every value ever stored under k, so readers can tell a torn or freed one
+static long value_of(int k)
+{
+    return 3L * k + 1;
+}
+
+static void readers_and_writers()
+{
+    Map m;
+    std::atomic<bool> done {false};
+    std::atomic<int> bad {0};
+    std::atomic<long> hits {0};
+
+    std::vector<std::thread> threads;
+
+    for (int r = 0; r < READERS; ++r) {
+        threads.emplace_back([&, r] {
+            unsigned x = 2463534242u + r;
+            long found = 0;
+
+            while (!done.load(std::memory_order_relaxed)) {
+                x ^= x << 13; x ^= x >> 17; x ^= x << 5; // xorshift
+                int k = static_cast<int>(x % KEYS);
+
+                long v = 0;
+                if (m.find(k, v)) {
+                    ++found;
+                    if (v != value_of(k)) bad.fetch_add(1);
+                }
+                if (m.search(k + KEYS)) bad.fetch_add(1); // never inserted
+            }
+
+            hits.fetch_add(found);
+        });
+    }
+
+    std::vector<std::thread> writers;
+
+    for (int w = 0; w < WRITERS; ++w) {
+        writers.emplace_back([&, w] {
+            unsigned x = 88172645u + w;
+
+            for (int i = 0; i < WRITES; ++i) {
+                x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+                int k = static_cast<int>(x % KEYS);
+
+                switch (x % 16) {
+                case 0:
+                    if (i % 1024 == 0) m.clear();
+                    break;
+                case 1: case 2: case 3: case 4: case 5: case 6:
+                    m.erase(k);
+                    break;
+                case 7: case 8: case 9:
+                    m.insert_or_assign(k, value_of(k));
+                    break;
+                default:
+                    m.insert(k, value_of(k));
+                }
+            }
+        });
+    }
+
+    for (auto& t : writers) t.join();
+    done.store(true);
+    for (auto& t : threads) t.join();
+
+    CHECK(bad.load() == 0);
+    CHECK(hits.load() > 0);
+
+    std::size_t n = 0;
+    bool sorted = true;
+    int last = -1;
+    m.for_each([&](const std::pair<const int, long>& kv) {
+        sorted = sorted && kv.first > last && kv.second == value_of(kv.first);
+        last = kv.first;
+        ++n;
+    });
+    CHECK(sorted && n == m.size());
+}
+
+int main()
+{
+    return test::run({
+        {"ConcurrentAvlMap stress", readers_and_writers},
+    });
+}
@@ -0,0 +1,446 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "avlmap.hpp"
+#include "test_common.hpp"
+
+using Map = Homebrew::AvlMap<int, int>;
+using RankedMap = Homebrew::AvlMap<int, int, std::less<int>, std::allocator<std::pair<const int, int>>, true>;
+using PoolMap = Homebrew::AvlMap<int, std::string, std::less<int>,
+                                 Homebrew::NodePool<std::pair<const int, std::string>>>;
+
+template<typename M>
+std::map<int, int> random_map(M& m, int n, int range)
+{
+    std::map<int, int> ref;
+    for (int i = 0; i < n; ++i) {
+        int k = test::random_int(0, range);
+        m.insert(k, i);
+        ref.emplace(k, i);
+    }
+    return ref;
+}
+
+static void insert_erase()
+{
+    Map m;
+    PoolMap p;
+    std::map<int, int> ref;
+
+    for (int i = 0; i < 20000; ++i) {
+        int k = test::random_int(0, 5000);
+        switch (test::random_int(0, 3)) {
+        case 0:
+            m.erase(k);
+            p.erase(k);
+            ref.erase(k);
+            break;
+        case 1:
+            m.insert_or_assign(k, i);
+            p.insert_or_assign(k, std::to_string(i));
+            ref[k] = i;
+            break;
+        default:
+            m.try_emplace(k, i);
+            p.try_emplace(k, std::to_string(i));
+            ref.emplace(k, i);
+        }
+    }
+
+    CHECK(m.size() == ref.size() && p.size() == ref.size());
+    CHECK(test::pairs_of(m) == test::pairs_of(ref));
+    CHECK(std::equal(m.rbegin(), m.rend(), ref.rbegin(), ref.rend()));
+
+    bool same = true;
+    for (const auto& kv : p) same = same && kv.second == std::to_string(ref[kv.first]);
+    CHECK(same);
+
+    for (int k = -1; k <= 5001; ++k) {
+        CHECK(m.search(k) == (ref.count(k) == 1));
+        if (ref.count(k) == 1) CHECK(m.at(k) == ref[k]);
+    }
+
+    m[-5] += 3;
+    ref[-5] += 3;
+    CHECK(m.at(-5) == 3);
+
+    Map copy (m);
+    m.clear();
+    CHECK(m.empty() && m.begin() == m.end());
+    CHECK(test::pairs_of(copy) == test::pairs_of(ref));
+}
+
+static void bounds()
+{
+    Map m;
+    auto ref = random_map(m, 2000, 4000);
+
+    for (int x = -1; x <= 4001; x += 3) {
+        auto lb = m.lower_bound(x);
+        auto rlb = ref.lower_bound(x);
+        CHECK((lb == m.end()) == (rlb == ref.end()));
+        if (lb != m.end() && rlb != ref.end()) CHECK(lb->first == rlb->first);
+
+        auto ub = m.upper_bound(x);
+        auto rub = ref.upper_bound(x);
+        CHECK((ub == m.end()) == (rub == ref.end()));
+        if (ub != m.end() && rub != ref.end()) CHECK(ub->first == rub->first);
+    }
+
+    std::vector<int> keys {5, 100, 4001, 17, -3};
+    std::vector<bool> found;
+    m.search_many(keys.begin(), keys.end(), std::back_inserter(found));
+    for (std::size_t i = 0; i < keys.size(); ++i) CHECK(found[i] == (ref.count(keys[i]) == 1));
+}
+
+static void hinted_insert()
+{
+    Map m;
+    std::map<int, int> ref;
+
+    // appends, the case hints are for
+    for (int i = 0; i < 5000; ++i) {
+        auto it = m.insert(m.end(), i * 2, i);
+        ref.emplace(i * 2, i);
+        CHECK(it->first == i * 2);
+    }
+
+    // right and wrong hints, duplicates included
+    for (int i = 0; i < 5000; ++i) {
+        int k = test::random_int(-10, 10010);
+        auto hint = m.lower_bound(test::random_int(-10, 10010));
+        auto it = m.emplace_hint(hint, k, -i);
+        ref.emplace(k, -i);
+        CHECK(it->first == k && it->second == ref[k]);
+    }
+
+    CHECK(test::pairs_of(m) == test::pairs_of(ref));
+    CHECK(m.size() == ref.size());
+
+    // the largest key keeps changing under end() hints and --end()
+    for (int i = 0; i < 5000; ++i) {
+        int k = ref.rbegin()->first + test::random_int(-3, 3);
+        switch (test::random_int(0, 2)) {
+        case 0:
+            m.erase(ref.rbegin()->first);
+            ref.erase(std::prev(ref.end()));
+            break;
+        case 1:
+            m.insert(std::prev(m.end()), k, i);
+            ref.emplace(k, i);
+            break;
+        default:
+            m.insert(m.end(), k, i);
+            ref.emplace(k, i);
+        }
+        CHECK(std::prev(m.end())->first == ref.rbegin()->first);
+    }
+    CHECK(test::pairs_of(m) == test::pairs_of(ref));
+
+    Map moved (std::move(m));
+    moved.insert(moved.end(), 1 << 20, 0);
+    CHECK(std::prev(moved.end())->first == 1 << 20);
+    CHECK(m.end() == m.begin());
+
+    moved.clear();
+    moved.insert(moved.end(), 7, 0);
+    moved.insert(moved.end(), 3, 0);
+    CHECK(std::prev(moved.end())->first == 7 && moved.begin()->first == 3);
+}
+
+static void node_handles()
+{
+    Map a, b;
+    auto ref = random_map(a, 1000, 3000);
+
+    for (int k = 0; k < 3000; k += 7) {
+        auto nh = a.extract(k);
+        CHECK(nh.empty() == (ref.count(k) == 0));
+        if (nh.empty()) continue;
+
+        CHECK(nh.key() == k && nh.mapped() == ref[k]);
+        ref.erase(k);
+        nh.key() = k + 100000;
+
+        auto res = b.insert(std::move(nh));
+        CHECK(res.inserted && res.position->first == k + 100000);
+    }
+
+    CHECK(test::pairs_of(a) == test::pairs_of(ref));
+
+    a.insert(5, 0);
+    auto nh = b.extract(b.begin());
+    nh.key() = 5;
+    auto res = a.insert(std::move(nh));
+    CHECK(!res.inserted && !res.node.empty() && res.position->first == 5);
+
+    // by position: no comparisons, sizes and the largest key kept up
+    int compares = 0;
+    auto counting = [&compares](int x, int y) { ++compares; return x < y; };
+    Homebrew::AvlMap<int, int, decltype(counting), std::allocator<std::pair<const int, int>>, true> r (counting);
+    std::map<int, int> rref;
+    for (int i = 0; i < 3000; ++i) {
+        int k = test::random_int(0, 6000);
+        r.insert(k, i);
+        rref.emplace(k, i);
+    }
+
+    bool same = true;
+    while (!rref.empty()) {
+        auto i = static_cast<std::size_t>(test::random_int(0, static_cast<int>(rref.size()) - 1));
+        auto pos = r.nth(i);
+        int k = pos->first;
+
+        compares = 0;
+        auto taken = r.extract(pos);
+        same = same && compares == 0 && taken.key() == k && taken.mapped() == rref[k];
+        rref.erase(k);
+
+        same = same && r.size() == rref.size();
+        if (!rref.empty()) same = same && std::prev(r.end())->first == rref.rbegin()->first;
+        if (rref.size() % 500 == 0) same = same && test::pairs_of(r) == test::pairs_of(rref);
+    }
+    CHECK(same && r.empty());
+}
+
+static void batches()
+{
+    Map m;
+    auto ref = random_map(m, 3000, 10000);
+
+    std::vector<std::pair<int, int>> add;
+    std::vector<int> drop;
+    for (int i = 0; i < 5000; ++i) add.emplace_back(test::random_int(0, 20000), -i);
+    for (int i = 0; i < 5000; ++i) drop.push_back(test::random_int(0, 20000));
+
+    m.insert_batch(add.begin(), add.end());
+    ref.insert(add.begin(), add.end());
+    CHECK(test::pairs_of(m) == test::pairs_of(ref));
+    CHECK(m.size() == ref.size());
+
+    m.erase_batch(drop.begin(), drop.end());
+    for (int k : drop) ref.erase(k);
+    CHECK(test::pairs_of(m) == test::pairs_of(ref));
+    CHECK(m.size() == ref.size());
+
+    // keys already there cost no node
+    Homebrew::AvlMap<int, int, std::less<int>, std::allocator<std::pair<const int, int>>, false, true> counted;
+    counted.insert_batch(add.begin(), add.end());
+    counted.reset_stats();
+    counted.insert_batch(add.begin(), add.end());
+    CHECK(counted.stats().allocations == 0);
+
+    auto par = Map::build_parallel(add.begin(), add.end(), 4);
+    std::map<int, int> first;
+    first.insert(add.begin(), add.end());
+    CHECK(test::pairs_of(par) == test::pairs_of(first));
+
+    // the comparator given is the one the map keeps
+    using Desc = Homebrew::AvlMap<int, int, std::greater<int>>;
+    auto desc = Desc::build_parallel(add.begin(), add.end(), 4, std::greater<int>());
+    std::map<int, int, std::greater<int>> rfirst (add.begin(), add.end());
+    CHECK(test::pairs_of(desc) == test::pairs_of(rfirst));
+    desc.insert(-1, 0);
+    CHECK(std::prev(desc.end())->first == -1);
+
+    PoolMap::allocator_type pool;
+    std::vector<std::pair<int, std::string>> named {{3, "c"}, {1, "a"}, {2, "b"}};
+    auto pooled = PoolMap::build_parallel(named.begin(), named.end(), 0, std::less<int>(), pool);
+    CHECK(pooled.size() == 3 && pooled.begin()->second == "a");
+
+    // big enough for the sort to fork, the nodes still come from one thread
+    std::vector<std::pair<int, std::string>> many;
+    std::map<int, std::string> rmany;
+    for (int i = 0; i < 20000; ++i) {
+        int k = test::random_int(0, 50000);
+        many.emplace_back(k, std::to_string(i));
+        rmany.emplace(k, std::to_string(i));
+    }
+    auto big = PoolMap::build_parallel(many.begin(), many.end(), 4);
+    bool same = big.size() == rmany.size();
+    auto it = big.begin();
+    for (const auto& kv : rmany) same = same && it != big.end() && (it++)->second == kv.second;
+    CHECK(same);
+
+    std::vector<std::pair<int, int>> sorted (ref.begin(), ref.end());
+    Map bulk (Homebrew::sorted_unique, sorted.begin(), sorted.end());
+    CHECK(test::pairs_of(bulk) == sorted);
+}
+
+static void order_statistics()
+{
+    RankedMap m;
+    auto ref = random_map(m, 5000, 20000);
+    for (int k = 0; k < 20000; k += 5) {
+        m.erase(k);
+        ref.erase(k);
+    }
+
+    std::vector<std::pair<int, int>> v (ref.begin(), ref.end());
+    for (std::size_t i = 0; i < v.size(); i += 13) CHECK(m.nth(i)->first == v[i].first);
+
+    for (int x = -1; x < 20001; x += 11) {
+        std::size_t r = std::distance(ref.begin(), ref.lower_bound(x));
+        CHECK(m.rank(x) == r);
+    }
+}
+
+static void serialization()
+{
+    Map m;
+    auto ref = random_map(m, 5000, 100000);
+
+    std::stringstream ss;
+    m.serialize(ss);
+    auto back = Map::deserialize(ss);
+    CHECK(test::pairs_of(back) == test::pairs_of(ref));
+
+    // into a given pool
+    using IntPool = Homebrew::AvlMap<int, int, std::less<int>,
+                                     Homebrew::NodePool<std::pair<const int, int>>>;
+    IntPool::allocator_type pool;
+    std::stringstream again;
+    m.serialize(again);
+    auto pooled = IntPool::deserialize(again, std::less<int>(), pool);
+    CHECK(test::pairs_of(pooled) == test::pairs_of(ref));
+    CHECK(pooled.get_allocator() == pool);
+
+    std::stringstream empty;
+    Map().serialize(empty);
+    CHECK(Map::deserialize(empty).empty());
+
+    // a header promising far more records than follow
+    std::stringstream one;
+    Map {{1, 1}}.serialize(one);
+    std::string bytes = one.str();
+
+    Homebrew::detail::MapFileHeader header;
+    std::memcpy(&header, bytes.data(), sizeof header);
+    header.count = std::uint64_t(1) << 40;
+    std::memcpy(&bytes[0], &header, sizeof header);
+
+    std::stringstream truncated (bytes);
+    bool threw = false;
+    try { Map::deserialize(truncated); }
+    catch (const std::runtime_error&) { threw = true; }
+    CHECK(threw);
+
+    // records out of order
+    std::stringstream two;
+    Map {{1, 1}, {2, 2}}.serialize(two);
+    bytes = two.str();
+    std::swap_ranges(bytes.end() - 16, bytes.end() - 8, bytes.end() - 8);
+
+    std::stringstream unsorted (bytes);
+    threw = false;
+    try { Map::deserialize(unsorted); }
+    catch (const std::runtime_error&) { threw = true; }
+    CHECK(threw);
+}
+
+static void frozen_and_compact()
+{
+    PoolMap m;
+    std::map<int, std::string> ref;
+    for (int i = 0; i < 10000; ++i) {
+        m.insert(i, std::to_string(i));
+        ref.emplace(i, std::to_string(i));
+    }
+    for (int i = 0; i < 10000; i += 3) {
+        m.erase(i);
+        ref.erase(i);
+    }
+
+    m.compact(Homebrew::NodeLayout::van_emde_boas);
+    CHECK(test::pairs_of(m) == test::pairs_of(ref));
+    m.compact();
+    CHECK(test::pairs_of(m) == test::pairs_of(ref));
+    CHECK(m.memory_usage().nodes == ref.size());
+
+    auto frozen = m.freeze();
+    CHECK(frozen.size() == ref.size());
+    for (int k = -1; k < 10001; ++k) {
+        const std::string* v = frozen.find(k);
+        CHECK((v != nullptr) == (ref.count(k) == 1));
+        if (v != nullptr) CHECK(*v == ref[k]);
+    }
+
+    Map small {{2, 20}, {1, 10}};
+    std::ostringstream os;
+    small.write_to(os);
+    CHECK(os.str() == "{(1, 10), (2, 20)}\n");
+}
+
+// write_to() prints what the stream would, whatever its flags
+static void print_flags()
+{
+    Homebrew::AvlMap<int, double> m {{10, 0.5}, {255, 1.0 / 3}};
+    Homebrew::AvlMap<bool, std::string> b {{true, "x"}};
+
+    auto both = [&](std::ios_base& (*manip)(std::ios_base&)) {
+        std::ostringstream got, want;
+        got << manip;
+        want << manip;
+        m.write_to(got);
+
+        want << '{';
+        bool first = true;
+        for (const auto& kv : m) {
+            if (!first) want << ", ";
+            first = false;
+            want << '(' << kv.first << ", " << kv.second << ')';
+        }
+        want << "}\n";
+        CHECK(got.str() == want.str());
+    };
+
+    both(std::dec);
+    both(std::hex);
+    both(std::fixed);
+    both(std::scientific);
+    both(std::showpos);
+    both(std::uppercase);
+
+    // a width set by a formatter applies to the next field only
+    std::ostringstream padded;
+    m.write_to(padded, [](Homebrew::OutputBuffer& out, const std::pair<const int, double>& kv) {
+        out.stream() << std::setw(5);
+        out << kv.first;
+    });
+    CHECK(padded.str() == "{   10,   255}\n");
+
+    std::ostringstream os;
+    os << std::boolalpha;
+    b.write_to(os);
+    CHECK(os.str() == "{(true, x)}\n");
+
+    std::ostringstream prec;
+    prec.precision(3);
+    m.write_to(prec);
+    CHECK(prec.str() == "{(10, 0.5), (255, 0.333)}\n");
+}
+
+int main()
+{
+    return test::run({
+        {"map insert/erase", insert_erase},
+        {"map bounds", bounds},
+        {"map hinted insert", hinted_insert},
+        {"map node handles", node_handles},
+        {"map batches", batches},
+        {"map order statistics", order_statistics},
+        {"map serialization", serialization},
+        {"map frozen and compact", frozen_and_compact},
+        {"map print flags", print_flags},
+    });
+}
@@ -0,0 +1,282 @@
+#include <algorithm>
+#include <iterator>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "avltree.hpp"
+#include "test_common.hpp"
+
+using Tree = Homebrew::AvlTree<int>;
+using RankedTree = Homebrew::AvlTree<int, std::less<int>, std::allocator<int>, true>;
+using PoolTree = Homebrew::AvlTree<int, std::less<int>, Homebrew::NodePool<int>>;
+
+template<typename T>
+std::set<int> random_set(T& tree, int n, int range)
+{
+    std::set<int> ref;
+    for (int i = 0; i < n; ++i) {
+        int x = test::random_int(0, range);
+        tree.insert(x);
+        ref.insert(x);
+    }
+    return ref;
+}
+
+static void insert_erase()
+{
+    Tree t;
+    PoolTree p;
+    std::set<int> ref;
+
+    for (int i = 0; i < 20000; ++i) {
+        int x = test::random_int(0, 5000);
+        if (test::random_int(0, 2) == 0) {
+            t.remove(x);
+            p.remove(x);
+            ref.erase(x);
+        }
+        else {
+            t.insert(x);
+            p.insert(x);
+            ref.insert(x);
+        }
+    }
+
+    CHECK(t.size() == ref.size());
+    CHECK(test::as_vector(t) == test::as_vector(ref));
+    CHECK(test::as_vector(p) == test::as_vector(ref));
+    CHECK(std::equal(t.rbegin(), t.rend(), ref.rbegin(), ref.rend()));
+
+    for (int x = -1; x <= 5001; ++x) CHECK(t.search(x) == (ref.count(x) == 1));
+
+    CHECK(t.min_element() == *ref.begin());
+    CHECK(t.max_element() == *ref.rbegin());
+
+    Tree copy (t);
+    t.clear();
+    CHECK(t.empty() && t.begin() == t.end());
+    CHECK(test::as_vector(copy) == test::as_vector(ref));
+}
+
+static void bounds()
+{
+    Tree t;
+    auto ref = random_set(t, 2000, 4000);
+
+    for (int x = -1; x <= 4001; x += 3) {
+        auto lb = t.lower_bound(x);
+        auto rlb = ref.lower_bound(x);
+        CHECK((lb == t.end()) == (rlb == ref.end()));
+        if (lb != t.end() && rlb != ref.end()) CHECK(*lb == *rlb);
+
+        auto ub = t.upper_bound(x);
+        auto rub = ref.upper_bound(x);
+        CHECK((ub == t.end()) == (rub == ref.end()));
+        if (ub != t.end() && rub != ref.end()) CHECK(*ub == *rub);
+    }
+
+    std::vector<int> seen;
+    t.for_each_in_range(100, 900, [&](int x) { seen.push_back(x); });
+    CHECK(seen == std::vector<int>(ref.lower_bound(100), ref.lower_bound(900)));
+}
+
+static void node_handles()
+{
+    Tree a, b;
+    auto ref = random_set(a, 1000, 3000);
+
+    for (int x = 0; x < 3000; x += 7) {
+        auto nh = a.extract(x);
+        CHECK(nh.empty() == (ref.count(x) == 0));
+        if (nh.empty()) continue;
+
+        ref.erase(x);
+        CHECK(nh.value() == x);
+        nh.value() = x + 100000;
+
+        auto res = b.insert(std::move(nh));
+        CHECK(res.inserted && *res.position == x + 100000);
+    }
+
+    CHECK(test::as_vector(a) == test::as_vector(ref));
+    CHECK(b.size() > 0 && *b.begin() >= 100000);
+
+    // a value already there gives the node back
+    a.insert(5);
+    auto nh = b.extract(b.begin());
+    nh.value() = 5;
+    auto res = a.insert(std::move(nh));
+    CHECK(!res.inserted && !res.node.empty() && *res.position == 5);
+
+    // by position: no comparisons, subtree sizes kept up
+    int compares = 0;
+    auto counting = [&compares](int x, int y) { ++compares; return x < y; };
+    Homebrew::AvlTree<int, decltype(counting), std::allocator<int>, true> r (counting);
+    std::set<int> rref = random_set(r, 3000, 6000);
+
+    bool same = true;
+    while (!rref.empty()) {
+        auto i = static_cast<std::size_t>(test::random_int(0, static_cast<int>(rref.size()) - 1));
+        auto pos = r.nth(i);
+        int x = *pos;
+
+        compares = 0;
+        auto taken = r.extract(pos);
+        same = same && compares == 0 && taken.value() == x;
+        rref.erase(x);
+
+        same = same && r.size() == rref.size();
+        if (rref.size() % 500 == 0) same = same && test::as_vector(r) == test::as_vector(rref);
+    }
+    CHECK(same && r.empty());
+}
+
+static void batches()
+{
+    Tree t;
+    auto ref = random_set(t, 3000, 10000);
+
+    std::vector<int> add, drop;
+    for (int i = 0; i < 5000; ++i) add.push_back(test::random_int(0, 20000));
+    for (int i = 0; i < 5000; ++i) drop.push_back(test::random_int(0, 20000));
+
+    t.insert_batch(add.begin(), add.end());
+    ref.insert(add.begin(), add.end());
+    CHECK(test::as_vector(t) == test::as_vector(ref));
+    CHECK(t.size() == ref.size());
+
+    t.erase_batch(drop.begin(), drop.end());
+    for (int x : drop) ref.erase(x);
+    CHECK(test::as_vector(t) == test::as_vector(ref));
+    CHECK(t.size() == ref.size());
+
+    std::vector<int> sorted (ref.begin(), ref.end());
+    Tree bulk (Homebrew::sorted_unique, sorted.begin(), sorted.end());
+    CHECK(test::as_vector(bulk) == sorted);
+}
+
+static void set_operations()
+{
+    for (int round = 0; round < 4; ++round) {
+        Tree a, b;
+        int range = round % 2 == 0 ? 50000 : 500;
+        auto ra = random_set(a, 20000, range);
+        auto rb = random_set(b, 15000, range);
+
+        std::vector<int> u, i, d;
+        std::set_union(ra.begin(), ra.end(), rb.begin(), rb.end(), std::back_inserter(u));
+        std::set_intersection(ra.begin(), ra.end(), rb.begin(), rb.end(), std::back_inserter(i));
+        std::set_difference(ra.begin(), ra.end(), rb.begin(), rb.end(), std::back_inserter(d));
+
+        auto su = set_union(a, b);
+        auto si = set_intersection(a, b);
+        auto sd = set_difference(a, b);
+        CHECK(test::as_vector(su) == u && su.size() == u.size());
+        CHECK(test::as_vector(si) == i && si.size() == i.size());
+        CHECK(test::as_vector(sd) == d && sd.size() == d.size());
+
+        Tree m (a);
+        m.merge(b);
+        CHECK(test::as_vector(m) == u && b.empty());
+
+        int pivot = range / 3;
+        Tree hi = a.split(pivot);
+        CHECK(test::as_vector(a) == std::vector<int>(ra.begin(), ra.lower_bound(pivot)));
+        CHECK(test::as_vector(hi) == std::vector<int>(ra.lower_bound(pivot), ra.end()));
+        CHECK(a.size() + hi.size() == ra.size());
+
+        a.join(hi);
+        CHECK(test::as_vector(a) == test::as_vector(ra) && hi.empty());
+    }
+}
+
+static void order_statistics()
+{
+    RankedTree t;
+    auto ref = random_set(t, 5000, 20000);
+    for (int x = 0; x < 20000; x += 5) {
+        t.remove(x);
+        ref.erase(x);
+    }
+
+    std::vector<int> v (ref.begin(), ref.end());
+    for (std::size_t k = 0; k < v.size(); k += 13) CHECK(*t.nth(k) == v[k]);
+    CHECK(t.nth(v.size()) == t.end());
+
+    for (int x = -1; x < 20001; x += 11) {
+        auto r = static_cast<std::size_t>(std::lower_bound(v.begin(), v.end(), x) - v.begin());
+        CHECK(t.rank(x) == r);
+    }
+
+    CHECK(t.count_range(1000, 3000) ==
+          static_cast<std::size_t>(std::distance(ref.lower_bound(1000), ref.lower_bound(3000))));
+}
+
+static void compact_and_print()
+{
+    PoolTree t;
+    std::set<int> ref;
+    for (int i = 0; i < 10000; ++i) {
+        t.insert(i);
+        ref.insert(i);
+    }
+    for (int i = 0; i < 10000; i += 3) {
+        t.remove(i);
+        ref.erase(i);
+    }
+
+    auto before = t.memory_usage();
+    t.compact(Homebrew::NodeLayout::van_emde_boas);
+    CHECK(test::as_vector(t) == test::as_vector(ref));
+    t.compact();
+    CHECK(test::as_vector(t) == test::as_vector(ref));
+    CHECK(t.memory_usage().nodes == ref.size());
+    CHECK(t.memory_usage().allocated_bytes <= before.allocated_bytes);
+
+    Tree small {3, 1, 2};
+    std::ostringstream os;
+    small.write_to(os);
+    CHECK(os.str() == "{1, 2, 3}\n");
+
+    std::ostringstream empty;
+    Tree().write_to(empty);
+    CHECK(empty.str() == "{}\n");
+}
+
+// Both branches finish and the exception comes out, with or without a thread
+static void fork_join()
+{
+    for (bool parallel : {false, true}) {
+        bool b_ran = false;
+        auto a = [] { throw std::runtime_error("a"); };
+        auto b = [&] { b_ran = true; };
+
+        std::string what;
+        try { Homebrew::detail::fork2(parallel, a, b); }
+        catch (const std::runtime_error& e) { what = e.what(); }
+        CHECK(b_ran && what == "a");
+
+        auto b_throws = [] { throw std::runtime_error("b"); };
+        what.clear();
+        try { Homebrew::detail::fork2(parallel, a, b_throws); }
+        catch (const std::runtime_error& e) { what = e.what(); }
+        CHECK(what == "b");
+    }
+}
+
+int main()
+{
+    return test::run({
+        {"tree insert/erase", insert_erase},
+        {"tree bounds", bounds},
+        {"tree node handles", node_handles},
+        {"tree batches", batches},
+        {"tree set operations", set_operations},
+        {"tree order statistics", order_statistics},
+        {"tree compact and print", compact_and_print},
+        {"fork2", fork_join},
+    });
+}
@@ -0,0 +1,64 @@
+#include <set>
+#include <sstream>
+#include <vector>
+
+#include "avltree_raw_pointers.hpp"
+#include "test_common.hpp"
+
+using Tree = Homebrew::AvlTree<int>;
+
+static void insert_erase()
+{
+    Tree t;
+    std::set<int> ref;
+
+    for (int i = 0; i < 20000; ++i) {
+        int x = test::random_int(0, 5000);
+        if (test::random_int(0, 2) == 0) {
+            t.remove(x);
+            ref.erase(x);
+        }
+        else {
+            t.insert(x);
+            ref.insert(x);
+        }
+    }
+
+    CHECK(t.size() == ref.size());
+    CHECK(test::as_vector(t) == test::as_vector(ref));
+    CHECK(std::equal(t.rbegin(), t.rend(), ref.rbegin(), ref.rend()));
+
+    for (int x = -1; x <= 5001; ++x) CHECK(t.search(x) == (ref.count(x) == 1));
+
+    CHECK(t.min_element() == *ref.begin());
+    CHECK(t.max_element() == *ref.rbegin());
+
+    Tree copy (t);
+    t.clear();
+    CHECK(t.empty() && t.begin() == t.end());
+    CHECK(test::as_vector(copy) == test::as_vector(ref));
+
+    std::vector<int> sorted (ref.begin(), ref.end());
+    Tree bulk (Homebrew::sorted_unique, sorted.begin(), sorted.end());
+    CHECK(test::as_vector(bulk) == sorted);
+}
+
+static void print()
+{
+    Tree t {3, 1, 2};
+    std::ostringstream os;
+    t.write_to(os);
+    CHECK(os.str() == "{1, 2, 3}\n");
+
+    int sum = 0;
+    t.visit([&](int x) { sum += x; });
+    CHECK(sum == 6);
+}
+
+int main()
+{
+    return test::run({
+        {"raw tree insert/erase", insert_erase},
+        {"raw tree print", print},
+    });
+}
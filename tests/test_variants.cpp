@@ -0,0 +1,262 @@
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "avlmap.hpp"
+#include "avlmap_buffered.hpp"
+#include "avlmap_compact.hpp"
+#include "avlmap_concurrent.hpp"
+#include "avlmap_mapped.hpp"
+#include "avlmap_persistent.hpp"
+#include "avlmap_sharded.hpp"
+#include "avlmap_wide.hpp"
+#include "test_common.hpp"
+
+using Pairs = std::vector<std::pair<int, int>>;
+
+/**
+ * Same random inserts, assignments and erases on m and on a std::map,
+ * then every lookup and the full contents (as listed by dump) compared.
+ */
+template<typename M, typename Dump>
+void against_std_map(M& m, Dump dump, int ops = 20000, int range = 4000)
+{
+    std::map<int, int> ref;
+
+    for (int i = 0; i < ops; ++i) {
+        int k = test::random_int(0, range);
+        switch (test::random_int(0, 3)) {
+        case 0:
+            m.erase(k);
+            ref.erase(k);
+            break;
+        case 1:
+            m.insert_or_assign(k, i);
+            ref[k] = i;
+            break;
+        default:
+            m.insert(k, i);
+            ref.emplace(k, i);
+        }
+    }
+
+    CHECK(m.size() == ref.size());
+    for (int k = -1; k <= range + 1; ++k) CHECK(m.search(k) == (ref.count(k) == 1));
+    CHECK(dump(m) == test::pairs_of(ref));
+}
+
+// Contents of the maps that offer for_each(fn(pair))
+struct ForEachPair {
+    template<typename M>
+    Pairs operator()(const M& m) const
+    {
+        Pairs v;
+        m.for_each([&](const std::pair<const int, int>& kv) { v.emplace_back(kv.first, kv.second); });
+        return v;
+    }
+};
+
+// ... and those whose for_each passes key and value apart
+struct ForEachKeyValue {
+    template<typename M>
+    Pairs operator()(const M& m) const
+    {
+        Pairs v;
+        m.for_each([&](int k, int x) { v.emplace_back(k, x); });
+        return v;
+    }
+};
+
+struct Iterate {
+    template<typename M>
+    Pairs operator()(const M& m) const
+    {
+        return test::pairs_of(m);
+    }
+};
+
+static void compact_map()
+{
+    Homebrew::CompactAvlMap<int, int> m;
+    against_std_map(m, Iterate());
+
+    Homebrew::CompactAvlMap<int, std::string> s;
+    for (int i = 0; i < 15; ++i) s.insert(i, std::string(40, char('a' + i)));
+    for (int i = 0; i < 100; ++i) s.insert(100 + i, s.at(3));
+    CHECK(s.at(150) == std::string(40, 'd'));
+}
+
+static void persistent_map()
+{
+    Homebrew::PersistentAvlMap<int, int> m;
+    against_std_map(m, ForEachPair());
+
+    auto snap = m.snapshot();
+    auto before = ForEachPair()(snap);
+    for (int k = 0; k < 4000; k += 2) m.erase(k);
+    m.insert_or_assign(1, -1);
+    CHECK(ForEachPair()(snap) == before);
+    CHECK(snap.size() == before.size());
+}
+
+static void concurrent_map()
+{
+    Homebrew::ConcurrentAvlMap<int, int> m;
+    against_std_map(m, ForEachPair());
+
+    m.clear();
+    CHECK(m.empty() && !m.search(1));
+}
+
+static void sharded_map()
+{
+    Homebrew::ShardedAvlMap<int, int> m;
+    against_std_map(m, ForEachPair());
+}
+
+static void wide_map()
+{
+    Homebrew::WideAvlMap<int, int> m;
+    against_std_map(m, ForEachKeyValue(), 50000, 20000);
+
+    Homebrew::WideAvlMap<int, int> copy (m);
+    CHECK(ForEachKeyValue()(copy) == ForEachKeyValue()(m));
+}
+
+// Moves throw once the budget is spent, moved from values read -1
+struct Fragile {
+    static int budget;
+    int v;
+
+    Fragile(int x = 0) : v{x} {}
+    Fragile(const Fragile&) = default;
+    Fragile(Fragile&& o) : v{o.v} { spend(); o.v = -1; }
+    Fragile& operator=(const Fragile&) = default;
+    Fragile& operator=(Fragile&& o) { spend(); v = o.v; o.v = -1; return *this; }
+
+    static void spend()
+    {
+        if (budget == 0) throw std::runtime_error("move");
+        if (budget > 0) --budget;
+    }
+};
+
+int Fragile::budget = -1;
+
+static void buffered_map()
+{
+    Homebrew::BufferedAvlMap<int, int> m (64);
+    against_std_map(m, Iterate());
+    CHECK(m.pending() == 0);
+
+    // a flush that throws halfway can be retried
+    Homebrew::BufferedAvlMap<int, Fragile> f (1000);
+    for (int k = 0; k < 20; ++k) f.insert(k, Fragile(k));
+    f.flush();
+    for (int k = 0; k < 20; ++k) f.insert_or_assign(k, Fragile(k + 100));
+
+    Fragile::budget = 7;
+    bool threw = false;
+    try { f.flush(); }
+    catch (const std::runtime_error&) { threw = true; }
+    CHECK(threw && f.pending() == 13);
+
+    Fragile::budget = -1;
+    f.flush();
+    bool same = true;
+    for (int k = 0; k < 20; ++k) same = same && f.at(k).v == k + 100;
+    CHECK(same && f.size() == 20);
+}
+
+static void mapped_map()
+{
+    Homebrew::AvlMap<int, int> src;
+    std::map<int, int> ref;
+    for (int i = 0; i < 5000; ++i) {
+        int k = test::random_int(0, 100000);
+        src.insert(k, i);
+        ref.emplace(k, i);
+    }
+
+    std::stringstream ss;
+    src.serialize(ss);
+    std::string bytes = ss.str();
+
+    // the records have to be aligned, as in a mapped file
+    std::vector<std::uint64_t> storage ((bytes.size() + 7) / 8);
+    std::memcpy(storage.data(), bytes.data(), bytes.size());
+
+    Homebrew::MappedAvlMap<int, int> view (storage.data(), bytes.size());
+    CHECK(view.size() == ref.size());
+    CHECK(ForEachKeyValue()(view) == test::pairs_of(ref));
+    for (int k = -1; k < 100001; k += 7) {
+        const int* v = view.find(k);
+        CHECK((v != nullptr) == (ref.count(k) == 1));
+        if (v != nullptr) CHECK(*v == ref[k]);
+    }
+}
+
+template<typename M>
+std::string text_of(const M& m)
+{
+    std::ostringstream os;
+    m.write_to(os);
+    return os.str();
+}
+
+static void printing()
+{
+    const std::string want = "{(1, 10), (2, 20)}\n";
+    Pairs two {{2, 20}, {1, 10}};
+    auto fill = [&](auto& m) {
+        CHECK(text_of(m) == "{}\n");
+        for (const auto& kv : two) m.insert(kv.first, kv.second);
+        return text_of(m);
+    };
+
+    Homebrew::CompactAvlMap<int, int> compact;
+    Homebrew::PersistentAvlMap<int, int> persistent;
+    Homebrew::ConcurrentAvlMap<int, int> concurrent;
+    Homebrew::ShardedAvlMap<int, int> sharded;
+    Homebrew::WideAvlMap<int, int> wide;
+    CHECK(fill(compact) == want);
+    CHECK(fill(persistent) == want);
+    CHECK(fill(concurrent) == want);
+    CHECK(fill(sharded) == want);
+    CHECK(fill(wide) == want);
+
+    Homebrew::AvlMap<int, int> src {{2, 20}, {1, 10}};
+    CHECK(text_of(src.freeze()) == want);
+
+    std::stringstream ss;
+    src.serialize(ss);
+    std::string bytes = ss.str();
+    std::vector<std::uint64_t> storage ((bytes.size() + 7) / 8);
+    std::memcpy(storage.data(), bytes.data(), bytes.size());
+    CHECK(text_of(Homebrew::MappedAvlMap<int, int>(storage.data(), bytes.size())) == want);
+
+    // the stream's flags hold for every variant
+    std::ostringstream hex;
+    hex << std::hex;
+    wide.write_to(hex);
+    CHECK(hex.str() == "{(1, a), (2, 14)}\n");
+}
+
+int main()
+{
+    return test::run({
+        {"CompactAvlMap", compact_map},
+        {"PersistentAvlMap", persistent_map},
+        {"ConcurrentAvlMap", concurrent_map},
+        {"ShardedAvlMap", sharded_map},
+        {"WideAvlMap", wide_map},
+        {"BufferedAvlMap", buffered_map},
+        {"MappedAvlMap", mapped_map},
+        {"write_to", printing},
+    });
+}